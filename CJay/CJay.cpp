@@ -16,16 +16,74 @@
  ***************************************************************************/
 #define CONSTRUCTOR_METHOD_NAME "<init>"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <type_traits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __GNUC__
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#endif
+
 #include "CJay.hpp"
 
+#ifdef CJAY_EMBED_CLASSES
+#ifndef __ELF__
+#error "CJAY_EMBED_CLASSES needs an ELF target (.incbin)"
+#endif
+#ifndef CJAY_CLASSES_DIR
+#define CJAY_CLASSES_DIR "java/bin" // built by java/build.sh, relative to the compiler's working directory
+#endif
+// Links a class file into the library, between cjay_class_<sym>_start and _end
+#define CJAY_INCBIN(sym, file) \
+    __asm__(".pushsection .rodata\n" \
+            ".global cjay_class_" #sym "_start\n" \
+            ".hidden cjay_class_" #sym "_start\n" \
+            "cjay_class_" #sym "_start:\n" \
+            ".incbin \"" CJAY_CLASSES_DIR "/" file "\"\n" \
+            ".global cjay_class_" #sym "_end\n" \
+            ".hidden cjay_class_" #sym "_end\n" \
+            "cjay_class_" #sym "_end:\n" \
+            ".popsection\n"); \
+    extern "C" const unsigned char cjay_class_##sym##_start[]; \
+    extern "C" const unsigned char cjay_class_##sym##_end[];
+CJAY_INCBIN(Signature, "cjay/reflect/Signature.class")
+CJAY_INCBIN(Util, "cjay/converter/Util.class")
+CJAY_INCBIN(NativeSink, "cjay/callback/NativeSink.class")
+CJAY_INCBIN(NativeCompletion, "cjay/concurrent/NativeCompletion.class")
+CJAY_INCBIN(MemoryClassLoader, "cjay/loader/MemoryClassLoader.class")
+CJAY_INCBIN(RecordBatch, "cjay/converter/RecordBatch.class")
+CJAY_INCBIN(CommandInterpreter, "cjay/batch/CommandInterpreter.class")
+CJAY_INCBIN(Packer, "cjay/converter/Packer.class")
+#undef CJAY_INCBIN
+#endif
+
 namespace VM {
 
 /**
  ** VM implementation
  **/
 
-JNIEnv* env = NULL;
+thread_local JNIEnv* env = NULL;
+static thread_local bool envAttached = false; // attached by CJay, detached by detachCurrentThread
 JavaVM* jvm = NULL;
+static bool vmOwned = false; // false when embedded in a host JVM
+
+void clearBindingCache();
+static void clearMemoryClasses();
+static void clearArrayPools();
 
 inline std::string getParmPath() {
     char* pPath = getenv("CLASSPATH");
@@ -48,73 +106,264 @@ inline char* TOCHAR (std::string str) {
     return writable;
 }
 
-void createVM(std::vector<std::string>& vmOption) {
-    if (env == NULL || jvm == NULL) {
-        int nOptions = vmOption.size();
+/**
+ ** VMConfig implementation
+ **/
+VMConfig::VMConfig() : gc(GC::DEFAULT) { }
 
-        JavaVMInitArgs vm_args;
-        JavaVMOption* options = new JavaVMOption[nOptions + 1];
+VMConfig& VMConfig::addOption(std::string option) {
+    this->options.push_back(option);
+    return *this;
+}
 
-        // Assign options
-        for (std::vector<std::string>::iterator it = vmOption.begin(); it != vmOption.end(); ++it) {
-            options[it-vmOption.begin()].optionString = const_cast<char*>(it->c_str()); //(char*) it->c_str();
-        }
-        // Add CLASSPATH parameter
-        char* paramPath = TOCHAR(getParmPath());
-        options[nOptions].optionString = paramPath;
-        // Assign vm_args
-        vm_args.version = CJ::JNI_VERSION;
-        vm_args.nOptions = nOptions + 1;
-        vm_args.options = options;
-        vm_args.ignoreUnrecognized = JNI_FALSE;
-        // Create JavaVM
-        jint status = createJavaVM(vm_args);
-        //int status = JNI_CreateJavaVM(&jvm, (void**)&env, &vm_args); // create only once with global variables
-        // Check Status
-        if(status != JNI_OK) {
-            delete[] paramPath;
-            delete[] options;
-            throw HandlerExc("JNI: Unable to launch JVM. JNI_CreateJavaVM call failed.");
-        }
-        delete[] paramPath;
-        delete options; // clean memory leaks
+VMConfig& VMConfig::setClassPath(std::string classPath) {
+    this->classPath = classPath;
+    return *this;
+}
+
+VMConfig& VMConfig::setInitialHeap(std::string size) {
+    this->initialHeap = size;
+    return *this;
+}
+
+VMConfig& VMConfig::setMaxHeap(std::string size) {
+    this->maxHeap = size;
+    return *this;
+}
+
+VMConfig& VMConfig::setGC(GC gc) {
+    this->gc = gc;
+    return *this;
+}
+
+VMConfig& VMConfig::useSharedArchive(std::string path) {
+    this->sharedArchive = path;
+    return *this;
+}
+
+VMConfig& VMConfig::dumpSharedArchive(std::string path) {
+    this->dumpArchive = path;
+    return *this;
+}
+
+VMConfig& VMConfig::writeClassList(std::string path) {
+    this->classList = path;
+    return *this;
+}
+
+VMConfig& VMConfig::preload(std::string className) {
+    this->preloadClasses.push_back(className);
+    return *this;
+}
+
+VMConfig& VMConfig::addJar(std::string path) {
+    this->jars.push_back(path);
+    return *this;
+}
+
+std::vector<std::string> VMConfig::getOptions() const {
+    std::vector<std::string> result(this->options);
+    if (!this->initialHeap.empty()) { result.push_back("-Xms" + this->initialHeap); }
+    if (!this->maxHeap.empty()) { result.push_back("-Xmx" + this->maxHeap); }
+    switch (this->gc)
+    {
+    case GC::SERIAL : result.push_back("-XX:+UseSerialGC"); break;
+    case GC::PARALLEL : result.push_back("-XX:+UseParallelGC"); break;
+    case GC::G1 : result.push_back("-XX:+UseG1GC"); break;
+    case GC::Z : result.push_back("-XX:+UseZGC"); break;
+    case GC::SHENANDOAH : result.push_back("-XX:+UseShenandoahGC"); break;
+    case GC::EPSILON :
+        result.push_back("-XX:+UnlockExperimentalVMOptions");
+        result.push_back("-XX:+UseEpsilonGC");
+        break;
+    default : break;
+    }
+    if (!this->sharedArchive.empty()) {
+        result.push_back("-Xshare:auto");
+        result.push_back("-XX:SharedArchiveFile=" + this->sharedArchive);
     }
+    if (!this->dumpArchive.empty()) {
+        result.push_back("-XX:ArchiveClassesAtExit=" + this->dumpArchive);
+    }
+    if (!this->classPath.empty()) {
+        result.push_back("-Djava.class.path=" + this->classPath);
+    } else if (getenv("CLASSPATH") != NULL || (!hasEmbeddedClasses() && this->jars.empty())) {
+        result.push_back(getParmPath());
+    }
+    return result;
 }
 
-void createVM() {
-    if (env == NULL || jvm == NULL) {
-        JavaVMInitArgs vm_args;
-        JavaVMOption* options = new JavaVMOption[1];
-
-        // Add CLASSPATH parameter to options
-        char* paramPath = TOCHAR(getParmPath());
-        options[0].optionString = paramPath;
-        // Assign vm_args
-        vm_args.version = CJ::JNI_VERSION;
-        vm_args.nOptions = 1;
-        vm_args.options = options;
-        vm_args.ignoreUnrecognized = JNI_FALSE;
-        // Create JavaVM
-        jint status = createJavaVM(vm_args);
-        //int status = JNI_CreateJavaVM(&jvm, (void**)&env, &vm_args); // create only once with global variables
-        // Check status
-        if(status != JNI_OK) {
-            delete[] paramPath;
-            delete[] options;
-            throw HandlerExc("JNI: Unable to launch JVM. JNI_CreateJavaVM call failed.");
-        }
-        delete[] paramPath;
-        delete[] options; // clean memory leaks
+const std::vector<std::string>& VMConfig::getPreloadClasses() const {
+    return this->preloadClasses;
+}
+
+const std::vector<std::string>& VMConfig::getJars() const {
+    return this->jars;
+}
+
+std::string VMConfig::getClassList() const {
+    return this->classList;
+}
+
+// Classes bound through CJ::setClass, in binding order
+static std::vector<std::string> boundClasses;
+static std::mutex boundClassesMutex;
+static std::string classListPath;
+static std::map<std::string, std::unique_ptr<CJ>> preloadedClasses;
+static std::mutex preloadedClassesMutex;
+
+static void registerBoundClass(std::string className) {
+    std::lock_guard<std::mutex> lock(boundClassesMutex);
+    if (std::find(boundClasses.begin(), boundClasses.end(), className) == boundClasses.end()) {
+        boundClasses.push_back(className);
+    }
+}
+
+std::vector<std::string> getBoundClasses() {
+    std::lock_guard<std::mutex> lock(boundClassesMutex);
+    return boundClasses;
+}
+
+CJ* getPreloadedClass(std::string className) {
+    std::lock_guard<std::mutex> lock(preloadedClassesMutex);
+    auto it = preloadedClasses.find(className);
+    return (it == preloadedClasses.end()) ? NULL : it->second.get();
+}
+
+void createVM(const VMConfig& config) {
+    // env is per thread: a thread other than the creator only attaches
+    if (jvm != NULL) {
+        attachCurrentThread();
+        return;
+    }
+#ifdef CJAY_TRACING
+    TraceSpan span("createVM", "startup");
+    TraceSpan launch("JNI_CreateJavaVM", "startup");
+#endif
+    std::vector<std::string> vmOption = config.getOptions();
+    int nOptions = vmOption.size();
+
+    JavaVMInitArgs vm_args;
+    JavaVMOption* options = new JavaVMOption[nOptions];
+
+    // Assign options
+    for (int i = 0; i < nOptions; i++) {
+        options[i].optionString = const_cast<char*>(vmOption[i].c_str());
+    }
+    // Assign vm_args
+    vm_args.version = CJ::JNI_VERSION;
+    vm_args.nOptions = nOptions;
+    vm_args.options = options;
+    vm_args.ignoreUnrecognized = JNI_FALSE;
+    // Create JavaVM
+    jint status = createJavaVM(vm_args);
+    delete[] options; // clean memory leaks
+    // Check status
+    if(status != JNI_OK) {
+        throw HandlerExc("JNI: Unable to launch JVM. JNI_CreateJavaVM call failed.");
     }
+    vmOwned = true;
+#ifdef CJAY_TRACING
+    launch.end();
+    TraceSpan classes("defineClasses", "startup");
+#endif
+
+    // CJay helper classes linked into the library, then jars served from memory
+    defineEmbeddedClasses();
+    for (auto& jar : config.getJars()) { addJar(jar); }
+#ifdef CJAY_TRACING
+    classes.end();
+    TraceSpan preload("preloadClasses", "startup");
+#endif
+
+    classListPath = config.getClassList();
+    // Load, link and bind the preloaded classes
+    for (auto& className : config.getPreloadClasses()) {
+        if (getPreloadedClass(className) != NULL) { continue; }
+        std::unique_ptr<CJ> cj(new CJ()); // lives as long as the JVM
+        cj->setClass(className);
+        std::lock_guard<std::mutex> lock(preloadedClassesMutex);
+        preloadedClasses[className] = std::move(cj);
+    }
+}
+
+void createVM(std::vector<std::string>& vmOption) {
+    VMConfig config;
+    for (auto& option : vmOption) { config.addOption(option); }
+    createVM(config);
+}
+
+void createVM() {
+    createVM(VMConfig());
 }
 
 void destroyVM() {
-    jvm->DestroyJavaVM();
+    // Class list of the classes bound in this run, for an offline -Xshare:dump
+    if (!classListPath.empty()) {
+        std::ofstream classList(classListPath.c_str());
+        for (auto& className : getBoundClasses()) { classList << className << std::endl; }
+    }
+    {
+        std::lock_guard<std::mutex> lock(preloadedClassesMutex);
+        preloadedClasses.clear();
+    }
+    clearBindingCache();
+    clearMemoryClasses();
+    clearArrayPools();
+    clearStringCache();
+
+    // An embedded library does not own the JVM of its host
+    if (vmOwned) { jvm->DestroyJavaVM(); }
+    vmOwned = false;
+    jvm = NULL;
+    env = NULL;
+}
+
+JNIEnv* attachCurrentThread(std::string name, bool asDaemon) {
+    if (jvm == NULL) {
+        throw HandlerExc("CJay: No Java Virtual Machine instance. Please, call VM::createVM beforehand.");
+    }
+    if (env != NULL) { return env; }
+    // A Java thread (or a thread attached by the host) already has its JNIEnv
+    if (jvm->GetEnv((void**)&env, CJ::JNI_VERSION) == JNI_OK) { return env; }
+    env = NULL;
+
+    JavaVMAttachArgs args;
+    args.version = CJ::JNI_VERSION;
+    args.name = name.empty() ? NULL : const_cast<char*>(name.c_str());
+    args.group = NULL;
+    jint status = asDaemon ?
+            jvm->AttachCurrentThreadAsDaemon((void**)&env, &args) :
+            jvm->AttachCurrentThread((void**)&env, &args);
+    if (status != JNI_OK) {
+        env = NULL;
+        throw HandlerExc("JNI: Unable to attach thread to JVM. AttachCurrentThread call failed.");
+    }
+    envAttached = true;
+    return env;
+}
+
+void detachCurrentThread() {
+    if (jvm != NULL && env != NULL && envAttached) {
+        jvm->DetachCurrentThread();
+    }
+    env = NULL;
+    envAttached = false;
+}
+
+void useEnv(JNIEnv* e) {
+    if (jvm == NULL && e != NULL) {
+        if (e->GetJavaVM(&jvm) != JNI_OK) {
+            throw HandlerExc("JNI: GetJavaVM call failed.");
+        }
+        vmOwned = false;
+    }
+    env = e;
+    envAttached = false; // owned by the JVM: never detached by CJay
 }
 
 template <> std::string FromJavaObjectToCpp(jobject x) {
-    std::string str = std::string(env->GetStringUTFChars((jstring) x, JNI_FALSE));
-    return str;
+    return toUTF8((jstring) x);
 }
 
 template <> bool FromJavaObjectToCpp(jobject x) {
@@ -162,10 +411,250 @@ JavaMethodReflect::~JavaMethodReflect() { }
  ** SignatureBase implementation
  **/
 SignatureBase::SignatureBase(std::string name, std::string descriptor, bool isStatic) :
-    name(name), descriptor(descriptor), isStatic(isStatic) , mid(NULL) { }
+    name(name), descriptor(descriptor), isStatic(isStatic) , mid(NULL), stats(NULL) { }
+
+SignatureBase::SignatureBase() : name(""), descriptor(""), isStatic(false), mid(NULL), stats(NULL) { }
+SignatureBase::~SignatureBase() {
+    delete this->stats.load();
+}
+
+/**
+ ** MethodStats implementation
+ **/
+MethodStatsSnapshot::MethodStatsSnapshot() :
+    count(0), totalNanos(0), maxNanos(0), buckets(CJAY_STATS_BUCKETS, 0) { }
+
+std::uint64_t MethodStatsSnapshot::meanNanos() const {
+    return (this->count == 0) ? 0 : this->totalNanos / this->count;
+}
+
+std::uint64_t MethodStatsSnapshot::percentile(double p) const {
+    if (this->count == 0) { return 0; }
+    std::uint64_t rank = (std::uint64_t) (p / 100.0 * (double) this->count + 0.5);
+    if (rank == 0) { rank = 1; }
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < this->buckets.size(); i++) {
+        seen += this->buckets[i];
+        if (seen >= rank) {
+            // upper bound of the bucket, never above the observed maximum
+            std::uint64_t bound = MethodStats::bucketUpperBound(i);
+            return (bound < this->maxNanos) ? bound : this->maxNanos;
+        }
+    }
+    return this->maxNanos;
+}
+
+MethodStats::MethodStats() {
+    this->reset();
+}
+
+std::size_t MethodStats::shardIndex() {
+    // Threads are spread round-robin over the shards on first use
+    static std::atomic<std::size_t> nextShard(0);
+    static thread_local std::size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % CJAY_STATS_SHARDS;
+    return shard;
+}
+
+std::size_t MethodStats::bucketIndex(std::uint64_t nanos) {
+    const std::uint64_t subBuckets = 1 << CJAY_STATS_SUB_BUCKET_BITS;
+    const std::uint64_t maxValue = (((std::uint64_t) 1) << CJAY_STATS_MAX_MAGNITUDE) - 1;
+    if (nanos > maxValue) { nanos = maxValue; }
+    if (nanos < subBuckets) { return (std::size_t) nanos; }
+
+    // magnitude = position of the most significant bit
+    std::size_t magnitude = 0;
+    for (std::uint64_t v = nanos; v > 1; v >>= 1) { magnitude++; }
+    std::size_t sub = (std::size_t) ((nanos >> (magnitude - CJAY_STATS_SUB_BUCKET_BITS)) & (subBuckets - 1));
+
+    return ((magnitude - CJAY_STATS_SUB_BUCKET_BITS + 1) << CJAY_STATS_SUB_BUCKET_BITS) + sub;
+}
+
+std::uint64_t MethodStats::bucketUpperBound(std::size_t index) {
+    const std::size_t subBuckets = 1 << CJAY_STATS_SUB_BUCKET_BITS;
+    if (index < subBuckets) { return index; }
+    std::size_t magnitude = (index >> CJAY_STATS_SUB_BUCKET_BITS) + CJAY_STATS_SUB_BUCKET_BITS - 1;
+    std::size_t shift = magnitude - CJAY_STATS_SUB_BUCKET_BITS;
+    std::uint64_t lower = ((std::uint64_t) (subBuckets + (index & (subBuckets - 1)))) << shift;
+    return lower + (((std::uint64_t) 1) << shift) - 1;
+}
+
+void MethodStats::record(std::uint64_t nanos) {
+    Shard& shard = this->shards[shardIndex()];
+    shard.count.fetch_add(1, std::memory_order_relaxed);
+    shard.totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+    shard.buckets[bucketIndex(nanos)].fetch_add(1, std::memory_order_relaxed);
+    std::uint64_t max = shard.maxNanos.load(std::memory_order_relaxed);
+    while (nanos > max && !shard.maxNanos.compare_exchange_weak(max, nanos, std::memory_order_relaxed)) { }
+}
+
+MethodStatsSnapshot MethodStats::snapshot() const {
+    MethodStatsSnapshot snap;
+    for (const Shard& shard : this->shards) {
+        snap.count += shard.count.load(std::memory_order_relaxed);
+        snap.totalNanos += shard.totalNanos.load(std::memory_order_relaxed);
+        std::uint64_t max = shard.maxNanos.load(std::memory_order_relaxed);
+        if (max > snap.maxNanos) { snap.maxNanos = max; }
+        for (std::size_t i = 0; i < CJAY_STATS_BUCKETS; i++) {
+            snap.buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+        }
+    }
+    return snap;
+}
+
+void MethodStats::reset() {
+    for (Shard& shard : this->shards) {
+        shard.count.store(0, std::memory_order_relaxed);
+        shard.totalNanos.store(0, std::memory_order_relaxed);
+        shard.maxNanos.store(0, std::memory_order_relaxed);
+        for (auto& bucket : shard.buckets) { bucket.store(0, std::memory_order_relaxed); }
+    }
+}
+
+#ifdef CJAY_TRACING
+/**
+ ** Tracer implementation
+ **/
+struct TraceChunk {
+    TraceEvent events[Tracer::CHUNK_EVENTS];
+};
+
+// Written by its thread only: an event is filled in, then published by size.
+// After a clear() the thread rewinds it under traceBuffersMutex, so that an
+// export never reads an event being overwritten.
+struct TraceBuffer {
+    int tid;
+    std::atomic<TraceChunk*> chunks[Tracer::MAX_CHUNKS];
+    std::atomic<std::size_t> size;
+    std::atomic<std::size_t> start; // first event not cleared
+    std::uint64_t generation;       // clear() seen by the thread
+    TraceBuffer(int tid, std::uint64_t generation) : tid(tid), size(0), start(0), generation(generation) {
+        for (auto& chunk : this->chunks) { chunk.store(NULL); }
+    }
+};
+
+std::atomic<bool> Tracer::callsEnabled(false);
+static std::mutex traceBuffersMutex;
+static std::vector<TraceBuffer*> traceBuffers; // never freed: spans outlive their threads
+static std::atomic<std::uint64_t> traceDropped(0);
+static std::atomic<std::uint64_t> traceGeneration(0); // bumped by clear()
+
+static TraceBuffer* traceBuffer() {
+    static thread_local TraceBuffer* buffer = NULL;
+    if (buffer == NULL) {
+        std::lock_guard<std::mutex> lock(traceBuffersMutex);
+        buffer = new TraceBuffer((int) traceBuffers.size() + 1, traceGeneration.load());
+        traceBuffers.push_back(buffer);
+    }
+    return buffer;
+}
+
+void Tracer::traceCalls(bool enabled) {
+    callsEnabled.store(enabled);
+}
+
+std::uint64_t Tracer::now() {
+    static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    return (std::uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Tracer::record(const char* name, const char* category, const char* detail, std::size_t detailSize,
+                    std::uint64_t startNanos, std::uint64_t endNanos) {
+    TraceBuffer* buffer = traceBuffer();
+    std::uint64_t generation = traceGeneration.load(std::memory_order_relaxed);
+    if (buffer->generation != generation) {
+        std::lock_guard<std::mutex> lock(traceBuffersMutex);
+        buffer->start.store(0);
+        buffer->size.store(0);
+        buffer->generation = generation;
+    }
+    std::size_t n = buffer->size.load(std::memory_order_relaxed);
+    if (n / CHUNK_EVENTS >= MAX_CHUNKS) {
+        traceDropped++;
+        return;
+    }
+    TraceChunk* chunk = buffer->chunks[n / CHUNK_EVENTS].load(std::memory_order_relaxed);
+    if (chunk == NULL) {
+        chunk = new TraceChunk();
+        buffer->chunks[n / CHUNK_EVENTS].store(chunk, std::memory_order_release);
+    }
+    TraceEvent& event = chunk->events[n % CHUNK_EVENTS];
+    event.name = name;
+    event.category = category;
+    std::size_t size = std::min(detailSize, sizeof(event.detail) - 1);
+    if (size > 0) { std::memcpy(event.detail, detail, size); }
+    event.detail[size] = '\0';
+    event.startNanos = startNanos;
+    event.durationNanos = endNanos - startNanos;
+    buffer->size.store(n + 1, std::memory_order_release);
+}
+
+// Microseconds with nanosecond precision, as Chrome trace expects
+static void writeTraceMicros(std::ostream& out, std::uint64_t nanos) {
+    char fraction[4];
+    std::snprintf(fraction, sizeof(fraction), "%03u", (unsigned) (nanos % 1000));
+    out << nanos / 1000 << "." << fraction;
+}
+
+static void writeTraceString(std::ostream& out, const char* str) {
+    out << '"';
+    for (const char* c = str; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') { out << '\\' << *c; }
+        else if ((unsigned char) *c >= 0x20) { out << *c; }
+    }
+    out << '"';
+}
+
+std::string Tracer::getChromeTrace() {
+    std::ostringstream out;
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    std::lock_guard<std::mutex> lock(traceBuffersMutex);
+    for (TraceBuffer* buffer : traceBuffers) {
+        std::size_t size = buffer->size.load(std::memory_order_acquire);
+        for (std::size_t i = buffer->start.load(); i < size; i++) {
+            const TraceEvent& event = buffer->chunks[i / CHUNK_EVENTS].load(std::memory_order_acquire)->events[i % CHUNK_EVENTS];
+            if (!first) { out << ","; }
+            first = false;
+            out << "{\"name\":";
+            writeTraceString(out, event.name);
+            out << ",\"cat\":";
+            writeTraceString(out, event.category);
+            out << ",\"ph\":\"X\",\"ts\":";
+            writeTraceMicros(out, event.startNanos);
+            out << ",\"dur\":";
+            writeTraceMicros(out, event.durationNanos);
+            out << ",\"pid\":" << getpid() << ",\"tid\":" << buffer->tid;
+            if (event.detail[0] != '\0') {
+                out << ",\"args\":{\"detail\":";
+                writeTraceString(out, event.detail);
+                out << "}";
+            }
+            out << "}";
+        }
+    }
+    out << "]}";
+    return out.str();
+}
+
+void Tracer::writeChromeTrace(std::string path) {
+    std::ofstream file(path.c_str());
+    if (!file) {
+        throw HandlerExc("CJay: Cannot write trace to " + path + ".");
+    }
+    file << getChromeTrace();
+}
+
+void Tracer::clear() {
+    std::lock_guard<std::mutex> lock(traceBuffersMutex);
+    for (TraceBuffer* buffer : traceBuffers) { buffer->start.store(buffer->size.load()); }
+    traceGeneration++; // each thread rewinds its buffer on its next span
+    traceDropped.store(0);
+}
 
-SignatureBase::SignatureBase() : name(""), descriptor(""), isStatic(false), mid(NULL) { }
-SignatureBase::~SignatureBase() { }
+std::uint64_t Tracer::getDropped() {
+    return traceDropped.load();
+}
+#endif
 
 /**
  ** Signature implementation
@@ -193,22 +682,439 @@ template <class To> Signature<To>::Signature() : SignatureBase() {
 template <class To> Signature<To>::~Signature() { }
 
 /**
- ** CJ implementation
+ ** Binding cache
+ **/
+
+// Reflection and method IDs of every class bound so far, kept for the
+// lifetime of the JVM (or of the library, in embedded mode): binding the
+// same class again costs no JNI call but NewGlobalRef.
+struct CachedBinding {
+    jclass clazz; // global reference
+    isNonUniqueCollection isNonUnique;
+    methodReflectCollection methodReflect;
+    std::map<std::string, jmethodID> mids;
+    CachedBinding() : clazz(NULL) { }
+};
+
+static std::map<std::string, CachedBinding> bindingCache;
+static std::mutex bindingCacheMutex;
+static std::atomic<std::uint64_t> bindingCacheGeneration(1);
+static jclass reflectClass = NULL;
+
+static bool findCachedBinding(std::string className, CachedBinding& binding) {
+    std::lock_guard<std::mutex> lock(bindingCacheMutex);
+    std::map<std::string, CachedBinding>::iterator it = bindingCache.find(className);
+    if (it == bindingCache.end()) { return false; }
+    binding = it->second;
+    return true;
+}
+
+static void storeCachedBinding(std::string className, jclass clazz, const isNonUniqueCollection& isNonUnique,
+        const methodReflectCollection& methodReflect, const methodLinkageCollection& methodLinkage) {
+    std::lock_guard<std::mutex> lock(bindingCacheMutex);
+    if (bindingCache.find(className) != bindingCache.end()) { return; }
+    CachedBinding& binding = bindingCache[className];
+    binding.clazz = (jclass) env->NewGlobalRef(clazz);
+    binding.isNonUnique = isNonUnique;
+    binding.methodReflect = methodReflect;
+    for (auto& kv : methodLinkage) { binding.mids[kv.first] = kv.second->mid; }
+}
+
+static jclass getReflectClass() {
+    std::lock_guard<std::mutex> lock(bindingCacheMutex);
+    if (reflectClass == NULL) {
+        jclass local = env->FindClass("cjay/reflect/Signature");
+        if (local == NULL) {
+            env->ExceptionDescribe();
+            env->ExceptionClear();
+            throw HandlerExc("JNI: Can't find class cjay/reflect/Signature. Is CJay java/bin in the class path?");
+        }
+        reflectClass = (jclass) env->NewGlobalRef(local);
+        env->DeleteLocalRef(local);
+    }
+    return reflectClass;
+}
+
+void clearBindingCache() {
+    std::lock_guard<std::mutex> lock(bindingCacheMutex);
+    if (env != NULL) {
+        for (auto& kv : bindingCache) { env->DeleteGlobalRef(kv.second.clazz); }
+        if (reflectClass != NULL) { env->DeleteGlobalRef(reflectClass); }
+    }
+    bindingCache.clear();
+    reflectClass = NULL;
+    bindingCacheGeneration++;
+}
+
+std::uint64_t bindingGeneration() {
+    return bindingCacheGeneration.load(std::memory_order_acquire);
+}
+
+void prebindClasses(const std::vector<std::string>& classNames) {
+    getReflectClass();
+    for (auto& className : classNames) {
+        CJ cj;
+        cj.setClass(className); // fills the cache
+    }
+}
+
+std::vector<std::string> converterClasses() {
+    return std::vector<std::string> {
+        "cjay/converter/Util", "java/util/ArrayList", "java/util/Set", "java/util/Collection", "java/util/Map",
+        "java/lang/Number", "java/lang/Boolean", "java/lang/Byte", "java/lang/Short", "java/lang/Long",
+        "java/lang/Integer", "java/lang/Float", "java/lang/Double", "java/lang/Character"
+    };
+}
+
+/**
+ ** In-memory classes
  **/
-CJ::CJ() : clazz(NULL), obj(NULL) {
-    this->methodLinkage.clear();
+#ifdef CJAY_EMBED_CLASSES
+struct EmbeddedClass {
+    const char* name;
+    const unsigned char* start;
+    const unsigned char* end;
+};
+
+static const EmbeddedClass embeddedClasses[] = {
+    { "cjay/reflect/Signature", cjay_class_Signature_start, cjay_class_Signature_end },
+    { "cjay/converter/Util", cjay_class_Util_start, cjay_class_Util_end },
+    { "cjay/callback/NativeSink", cjay_class_NativeSink_start, cjay_class_NativeSink_end },
+    { "cjay/concurrent/NativeCompletion", cjay_class_NativeCompletion_start, cjay_class_NativeCompletion_end },
+    { "cjay/loader/MemoryClassLoader", cjay_class_MemoryClassLoader_start, cjay_class_MemoryClassLoader_end },
+    { "cjay/converter/RecordBatch", cjay_class_RecordBatch_start, cjay_class_RecordBatch_end },
+    { "cjay/batch/CommandInterpreter", cjay_class_CommandInterpreter_start, cjay_class_CommandInterpreter_end },
+    { "cjay/converter/Packer", cjay_class_Packer_start, cjay_class_Packer_end }
+};
+#endif
+
+static jobject memoryLoader = NULL; // cjay/loader/MemoryClassLoader, global reference
+static jmethodID midLoaderLookup = NULL;
+static jmethodID midLoaderAddJar = NULL;
+static jmethodID midLoaderAddClass = NULL;
+static std::mutex memoryLoaderMutex;
+
+// Message of a pending Java exception, which is cleared
+static std::string takeJavaException() {
+    jthrowable exc = env->ExceptionOccurred();
+    if (exc == NULL) { return std::string(); }
+    env->ExceptionClear();
+    jclass clazz = env->GetObjectClass(exc);
+    jmethodID toString = env->GetMethodID(clazz, "toString", "()Ljava/lang/String;");
+    jstring str = (jstring) env->CallObjectMethod(exc, toString);
+    std::string what = (str == NULL) ? std::string() : toUTF8(str);
+    env->DeleteLocalRef(str);
+    env->DeleteLocalRef(clazz);
+    env->DeleteLocalRef(exc);
+    return what;
+}
+
+static jobject getSystemClassLoader() {
+    jclass CLASSLOADER = env->FindClass("java/lang/ClassLoader");
+    jmethodID mid = env->GetStaticMethodID(CLASSLOADER, "getSystemClassLoader", "()Ljava/lang/ClassLoader;");
+    jobject loader = env->CallStaticObjectMethod(CLASSLOADER, mid);
+    env->DeleteLocalRef(CLASSLOADER);
+    return loader;
+}
+
+// Drops the cached binding of a class now served from memory
+static void forgetCachedBinding(std::string className) {
+    std::lock_guard<std::mutex> lock(bindingCacheMutex);
+    bindingCacheGeneration++; // generated proxies look the class up again
+    std::map<std::string, CachedBinding>::iterator it = bindingCache.find(className);
+    if (it == bindingCache.end()) { return; }
+    if (env != NULL) { env->DeleteGlobalRef(it->second.clazz); }
+    bindingCache.erase(it);
+}
+
+// With memoryLoaderMutex held
+static jobject getMemoryLoader() {
+    if (memoryLoader != NULL) { return memoryLoader; }
+    jclass LOADER = env->FindClass("cjay/loader/MemoryClassLoader");
+    if (LOADER == NULL) {
+        env->ExceptionClear();
+        throw HandlerExc("JNI: Can't find class cjay/loader/MemoryClassLoader. Is CJay java/bin in the class path (or CJAY_EMBED_CLASSES set)?");
+    }
+    midLoaderLookup = env->GetMethodID(LOADER, "lookup", "(Ljava/lang/String;)Ljava/lang/Class;");
+    midLoaderAddJar = env->GetMethodID(LOADER, "addJar", "(Ljava/nio/ByteBuffer;)[Ljava/lang/String;");
+    midLoaderAddClass = env->GetMethodID(LOADER, "addClass", "(Ljava/lang/String;Ljava/nio/ByteBuffer;)V");
+    jmethodID midConstructor = env->GetMethodID(LOADER, CONSTRUCTOR_METHOD_NAME, "(Ljava/lang/ClassLoader;)V");
+    jobject parent = getSystemClassLoader();
+    jobject loader = env->NewObject(LOADER, midConstructor, parent);
+    memoryLoader = env->NewGlobalRef(loader);
+    env->DeleteLocalRef(loader);
+    env->DeleteLocalRef(parent);
+    env->DeleteLocalRef(LOADER);
+    return memoryLoader;
+}
+
+static void clearMemoryClasses() {
+    std::lock_guard<std::mutex> lock(memoryLoaderMutex);
+    if (env != NULL && memoryLoader != NULL) { env->DeleteGlobalRef(memoryLoader); }
+    memoryLoader = NULL;
+}
+
+bool hasEmbeddedClasses() {
+#ifdef CJAY_EMBED_CLASSES
+    return true;
+#else
+    return false;
+#endif
+}
+
+void defineEmbeddedClasses() {
+#ifdef CJAY_EMBED_CLASSES
+    jobject loader = getSystemClassLoader();
+    for (auto& embedded : embeddedClasses) {
+        jclass clazz = env->DefineClass(embedded.name, loader, (const jbyte*) embedded.start, embedded.end - embedded.start);
+        if (clazz == NULL) {
+            // already defined (e.g. by an earlier onLoad): that copy is used
+            std::string what = takeJavaException();
+            if (what.find("LinkageError") == std::string::npos) {
+                env->DeleteLocalRef(loader);
+                throw HandlerExc(std::string("JNI: Unable to define embedded class ") + embedded.name + ": " + what);
+            }
+            continue;
+        }
+        env->DeleteLocalRef(clazz);
+    }
+    env->DeleteLocalRef(loader);
+#endif
 }
 
-CJ::~CJ() {
+jclass defineClass(std::string className, const void* bytes, std::size_t size) {
+    jobject loader = getSystemClassLoader();
+    jclass clazz = env->DefineClass(className.c_str(), loader, (const jbyte*) bytes, (jsize) size);
+    env->DeleteLocalRef(loader);
+    if (clazz == NULL) {
+        throw HandlerExc("JNI: Unable to define class " + className + ": " + takeJavaException());
+    }
+    jclass global = (jclass) env->NewGlobalRef(clazz);
+    env->DeleteLocalRef(clazz);
+    return global;
+}
+
+std::vector<std::string> addJar(const void* bytes, std::size_t size) {
+    std::vector<std::string> names;
+    {
+        std::lock_guard<std::mutex> lock(memoryLoaderMutex);
+        jobject loader = getMemoryLoader();
+        // the loader copies the classes out of the buffer before returning
+        jobject buffer = env->NewDirectByteBuffer(const_cast<void*>(bytes), (jlong) size);
+        jobjectArray jnames = (jobjectArray) env->CallObjectMethod(loader, midLoaderAddJar, buffer);
+        env->DeleteLocalRef(buffer);
+        if (jnames == NULL) {
+            throw HandlerExc("JNI: Unable to read jar: " + takeJavaException());
+        }
+        jsize n = env->GetArrayLength(jnames);
+        names.reserve(n);
+        for (jsize i = 0; i < n; i++) {
+            jstring name = (jstring) env->GetObjectArrayElement(jnames, i);
+            names.push_back(toUTF8(name));
+            env->DeleteLocalRef(name);
+        }
+        env->DeleteLocalRef(jnames);
+    }
+    for (auto& name : names) { forgetCachedBinding(name); }
+    return names;
+}
+
+std::vector<std::string> addJar(std::string path) {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        if (fd >= 0) { close(fd); }
+        throw HandlerExc("CJay: Unable to open jar " + path);
+    }
+    void* data = mmap(NULL, (std::size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw HandlerExc("CJay: Unable to map jar " + path);
+    }
+    try {
+        std::vector<std::string> names = addJar(data, (std::size_t) st.st_size);
+        munmap(data, (std::size_t) st.st_size);
+        return names;
+    } catch (...) {
+        munmap(data, (std::size_t) st.st_size);
+        throw;
+    }
+#else
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in) {
+        throw HandlerExc("CJay: Unable to open jar " + path);
+    }
+    std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return addJar(data.data(), data.size());
+#endif
+}
+
+void addClass(std::string className, const void* bytes, std::size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(memoryLoaderMutex);
+        jobject loader = getMemoryLoader();
+        jstring name = newJavaString(className.data(), className.size());
+        jobject buffer = env->NewDirectByteBuffer(const_cast<void*>(bytes), (jlong) size);
+        env->CallVoidMethod(loader, midLoaderAddClass, name, buffer);
+        env->DeleteLocalRef(buffer);
+        env->DeleteLocalRef(name);
+        if (env->ExceptionCheck()) {
+            throw HandlerExc("JNI: Unable to add class " + className + ": " + takeJavaException());
+        }
+    }
+    forgetCachedBinding(className);
+}
+
+jclass findClass(std::string className) {
+    {
+        std::lock_guard<std::mutex> lock(memoryLoaderMutex);
+        if (memoryLoader != NULL) {
+            jstring name = newJavaString(className.data(), className.size());
+            jclass clazz = (jclass) env->CallObjectMethod(memoryLoader, midLoaderLookup, name);
+            env->DeleteLocalRef(name);
+            if (env->ExceptionCheck()) {
+                throw HandlerExc("JNI: Can't define class " + className + ": " + takeJavaException());
+            }
+            if (clazz != NULL) { return clazz; }
+        }
+    }
+    jclass clazz = env->FindClass(className.c_str());
+    if (clazz == NULL) {
+        env->ExceptionClear();
+        throw HandlerExc("JNI: Can't find class " + className);
+    }
+    return clazz;
+}
+
+/**
+ ** Embedded mode
+ **/
+bool ownsVM() {
+    return vmOwned;
+}
+
+jint onLoad(JavaVM* vm) {
+    jvm = vm;
+    vmOwned = false;
+    if (vm->GetEnv((void**)&env, CJ::JNI_VERSION) != JNI_OK) {
+        env = NULL;
+        throw HandlerExc("JNI: Unsupported JNI version in JNI_OnLoad.");
+    }
+    // The loading thread sees the class loader of the library: bind now
+    defineEmbeddedClasses();
+    prebindClasses(converterClasses());
+    return CJ::JNI_VERSION;
+}
+
+void onUnload() {
+    // JNI_OnUnload may run on a thread CJay has not seen: global references
+    // can only be deleted through its JNIEnv
+    if (env == NULL && jvm != NULL && jvm->GetEnv((void**)&env, CJ::JNI_VERSION) != JNI_OK) {
+        env = NULL;
+    }
+    clearBindingCache();
+    clearMemoryClasses();
+    clearArrayPools();
+    clearStringCache();
+    jvm = NULL;
+    env = NULL;
+}
+
+void attachVM() {
+    if (jvm != NULL) { return; }
+    JavaVM* vm = NULL;
+    jsize nVMs = 0;
+    if (JNI_GetCreatedJavaVMs(&vm, 1, &nVMs) != JNI_OK || nVMs == 0) {
+        throw HandlerExc("JNI: No Java Virtual Machine in this process. JNI_GetCreatedJavaVMs call failed.");
+    }
+    jvm = vm;
+    vmOwned = false;
+    if (jvm->GetEnv((void**)&env, CJ::JNI_VERSION) != JNI_OK) {
+        env = NULL;
+        attachCurrentThread();
+    }
+}
+
+/**
+ ** Binding implementation
+ **/
+Binding::Binding() : clazz(NULL), pins(0) { }
+
+Binding::~Binding() {
     // avoid memory leaks
     for (auto& kv : this->methodLinkage) {
         delete kv.second;
         kv.second = NULL;
     }
+    // global reference (the JVM may already be gone)
+    if (env != NULL && this->clazz != NULL) { env->DeleteGlobalRef(this->clazz); }
+}
+
+SignatureBase* Binding::find(const std::string& key) const {
+    methodLinkageCollection::const_iterator it = this->methodLinkage.find(key);
+    return (it == this->methodLinkage.end()) ? NULL : it->second;
+}
+
+/**
+ ** CJ implementation
+ **/
+// Each snapshot pins its own binding. The pinning count only covers the few
+// instructions between loading the pointer and pinning it: once a rebind has
+// swapped the pointer and then sees it at zero, a retired binding without pins
+// cannot be pinned anymore.
+CJ::Snapshot::Snapshot(CJ& cj) : cj(cj) {
+    cj.pinning.fetch_add(1);
+    this->current = cj.binding.load();
+    if (this->current != NULL) { this->current->pins.fetch_add(1); }
+    cj.pinning.fetch_sub(1);
+}
+
+CJ::Snapshot::~Snapshot() {
+    if (this->current != NULL) { this->current->pins.fetch_sub(1); }
+    if (this->cj.hasRetired.load()) {
+        // frees the retired bindings nobody pins, unless a rebind is busy
+        std::unique_lock<std::mutex> lock(this->cj.rebindMutex, std::try_to_lock);
+        if (lock.owns_lock()) { this->cj.reclaim(); }
+    }
+}
+
+SignatureBase* CJ::Snapshot::getSignatureObj(const std::string& key) const {
+    SignatureBase* sig = (this->current == NULL) ? NULL : this->current->find(key);
+    if (sig == NULL) {
+        throw HandlerExc("Key does not exit. Use setSignature member beforehand.");
+    }
+    return sig;
+}
+
+CJ::CJ() : binding(NULL), pinning(0), hasRetired(false), obj(NULL) { }
+
+CJ::~CJ() {
+    // no call can be in flight anymore
+    delete this->binding.load();
+    for (auto b : this->retired) { delete b; }
+    // global reference (the JVM may already be gone)
+    jobject obj = this->obj.load();
+    if (env != NULL && obj != NULL) { env->DeleteGlobalRef(obj); }
+}
+
+void CJ::reclaim() {
+    if (this->pinning.load() != 0) { return; }
+    std::vector<Binding*> pinned;
+    for (auto b : this->retired) {
+        if (b->pins.load() == 0) { delete b; } else { pinned.push_back(b); }
+    }
+    this->retired.swap(pinned);
+    this->hasRetired.store(!this->retired.empty());
+}
+
+int CJ::getRetiredCount() {
+    std::lock_guard<std::mutex> lock(this->rebindMutex);
+    return this->retired.size();
 }
 
-void CJ::assignMethodReflectCollection() {
-    jclass clazzReflect = env->FindClass("cjay/reflect/Signature");
+void CJ::assignMethodReflectCollection(Binding* b) {
+    jclass clazzReflect = getReflectClass();
     // Reflect methodIDs
     jmethodID midConstructor = env->GetMethodID(clazzReflect, "<init>", "(Ljava/lang/Class;)V");
     jmethodID midNames = env->GetMethodID(clazzReflect, "getAllMembersNames", "()Ljava/util/ArrayList;");
@@ -219,7 +1125,7 @@ void CJ::assignMethodReflectCollection() {
     jobject oReflect = env->NewObject(
             clazzReflect,
             midConstructor,
-            this->clazz
+            b->clazz
             );
 
     jobject ALNames = env->CallObjectMethod(oReflect, midNames);
@@ -238,11 +1144,11 @@ void CJ::assignMethodReflectCollection() {
 
     // Search what method were overloaded,
     // in other words, the methods that have the same name.
-    this->isNonUnique.clear();
+    b->isNonUnique.clear();
     for(size_t i = 0 ; i < names.size(); i++) {
         for(size_t j = 0 ; j < names.size(); j++) {
             if(names[i] == names[j] && i != j) {
-                this->isNonUnique.insert(isNonUniqueCollection::value_type(names[i], 0)); // Store non-unique method name
+                b->isNonUnique.insert(isNonUniqueCollection::value_type(names[i], 0)); // Store non-unique method name
             }
         }
     }
@@ -253,27 +1159,27 @@ void CJ::assignMethodReflectCollection() {
     int timesNameRepeat;
     std::string intString;
     for(auto& name : names) {
-        if (this->isNonUnique.find(name) == this->isNonUnique.end() ) { // current name is unique
+        if (b->isNonUnique.find(name) == b->isNonUnique.end() ) { // current name is unique
             key.assign(name);
         } else { // current method name is non-unqiue
-            timesNameRepeat = this->isNonUnique[name] + 1;
+            timesNameRepeat = b->isNonUnique[name] + 1;
             // add line below because gcc complier complains with standard C++11 "std::to_string" instruction.
             intString.assign(static_cast<std::ostringstream*>( &(std::ostringstream() << timesNameRepeat) )->str());
             key.assign(name + "_" + intString);
-            this->isNonUnique[name] = timesNameRepeat;
+            b->isNonUnique[name] = timesNameRepeat;
         }
         keys.push_back(key);
     }
 
     // Assign method reflect
-    this->methodReflect.clear();
+    b->methodReflect.clear();
     for(size_t i = 0; i < keys.size(); i++) {
         JavaMethodReflect methodR(names[i], descriptors[i], isStatic[i]);
-        this->methodReflect.insert(methodReflectCollection::value_type(keys[i], methodR));
+        b->methodReflect.insert(methodReflectCollection::value_type(keys[i], methodR));
     }
 }
 
-void CJ::assignMethodLinkageCollection() {
+void CJ::assignMethodLinkageCollection(Binding* b) {
     SignatureBase* signature;
     std::string rv; // method return value
     std::string key; // the unique identifier of method
@@ -282,7 +1188,7 @@ void CJ::assignMethodLinkageCollection() {
     std::string descriptor;
     bool isStatic;
 
-    for(auto& kv : this->methodReflect) {
+    for(auto& kv : b->methodReflect) {
         key = kv.first;
         methodR = kv.second;
         name.assign(methodR.name);
@@ -294,6 +1200,7 @@ void CJ::assignMethodLinkageCollection() {
         std::size_t pos = descriptor.find(")");
         rv = descriptor[pos+1];
         if (rv == "[") { rv = descriptor[pos+2]; isArray = true; } // array case
+        if (isArray && rv == "[") { rv = "L"; } // multidimensional: array of arrays
 
         if(isArray) {
             // Assign array signature
@@ -330,43 +1237,121 @@ void CJ::assignMethodLinkageCollection() {
             }
         }
         // Store linkage
-        this->methodLinkage.insert(methodLinkageCollection::value_type(key, signature));
+        b->methodLinkage.insert(methodLinkageCollection::value_type(key, signature));
     }
 }
 
-void CJ::assignCollections() {
-    this->assignMethodReflectCollection();
-    this->assignMethodLinkageCollection();
+void CJ::assignCollections(Binding* b) {
+    this->assignMethodReflectCollection(b);
+    this->assignMethodLinkageCollection(b);
 }
 
 void CJ::printSignatures() {
-    for (auto& it : methodReflect) {
+    Snapshot snap(*this);
+    if (snap.get() == NULL) { return; }
+    for (auto& it : snap->methodReflect) {
         std::string key = it.first;
+        SignatureBase* sig = snap->find(key);
         std::cout <<
                 "<" <<
                 "Unique Key:" << key <<
-                ", Name: " << this->methodLinkage[key]->name <<
-                ", Descriptor: " << this->methodLinkage[key]->descriptor <<
-                ", isStatic: " << this->methodLinkage[key]->isStatic <<
+                ", Name: " << sig->name <<
+                ", Descriptor: " << sig->descriptor <<
+                ", isStatic: " << sig->isStatic <<
+                ">" <<
+                std::endl;
+    }
+}
+
+#ifdef CJAY_METHOD_STATS
+void CJ::printStats() {
+    std::cout << this->getStatsText();
+}
+
+std::string CJ::getStatsText() {
+    Snapshot snap(*this);
+    std::ostringstream out;
+    if (snap.get() == NULL) { return out.str(); }
+    for (auto& it : snap->methodLinkage) {
+        MethodStats* recorded = it.second->stats.load(); // NULL if never called
+        MethodStatsSnapshot stats = (recorded == NULL) ? MethodStatsSnapshot() : recorded->snapshot();
+        out <<
+                "<" <<
+                "Unique Key:" << it.first <<
+                ", Calls: " << stats.count <<
+                ", Total(ns): " << stats.totalNanos <<
+                ", Mean(ns): " << stats.meanNanos() <<
+                ", p50(ns): " << stats.percentile(50.0) <<
+                ", p90(ns): " << stats.percentile(90.0) <<
+                ", p99(ns): " << stats.percentile(99.0) <<
+                ", Max(ns): " << stats.maxNanos <<
                 ">" <<
                 std::endl;
     }
+    return out.str();
+}
+
+std::string CJ::getStatsJSON() {
+    Snapshot snap(*this);
+    std::ostringstream out;
+    out << "{\"class\":\"" << (snap.get() == NULL ? std::string() : snap->className) << "\",\"methods\":[";
+    bool first = true;
+    if (snap.get() != NULL) {
+        for (auto& it : snap->methodLinkage) {
+            MethodStats* recorded = it.second->stats.load(); // NULL if never called
+            MethodStatsSnapshot stats = (recorded == NULL) ? MethodStatsSnapshot() : recorded->snapshot();
+            if (!first) { out << ","; }
+            first = false;
+            // keys, names and descriptors never contain '"' or '\\'
+            out << "{\"key\":\"" << it.first << "\"" <<
+                    ",\"name\":\"" << it.second->name << "\"" <<
+                    ",\"descriptor\":\"" << it.second->descriptor << "\"" <<
+                    ",\"calls\":" << stats.count <<
+                    ",\"total_ns\":" << stats.totalNanos <<
+                    ",\"mean_ns\":" << stats.meanNanos() <<
+                    ",\"p50_ns\":" << stats.percentile(50.0) <<
+                    ",\"p90_ns\":" << stats.percentile(90.0) <<
+                    ",\"p99_ns\":" << stats.percentile(99.0) <<
+                    ",\"max_ns\":" << stats.maxNanos << "}";
+        }
+    }
+    out << "]}";
+    return out.str();
+}
+
+void CJ::resetStats() {
+    Snapshot snap(*this);
+    if (snap.get() == NULL) { return; }
+    for (auto& it : snap->methodLinkage) {
+        MethodStats* stats = it.second->stats.load();
+        if (stats != NULL) { stats->reset(); }
+    }
 }
+#endif
 
 jclass CJ::getClass() {
-    return this->clazz;
+    Binding* b = this->binding.load();
+    return (b == NULL) ? NULL : b->clazz;
 }
 
 jobject CJ::getObj() {
-    return this->obj;
+    return this->obj.load();
+}
+
+std::string CJ::getClassName() {
+    Snapshot snap(*this);
+    return (snap.get() == NULL) ? std::string() : snap->className;
 }
 
 std::string CJ::getUniqueKey(std::string name, std::string descriptor) {
+    Snapshot snap(*this);
     std::string keyMatch = "";
-    for(auto& kv : this->methodLinkage) {
-        if( (name == kv.second->name) && (descriptor == kv.second->descriptor) ) {
-            keyMatch.assign(kv.first);
-            break;
+    if (snap.get() != NULL) {
+        for(auto& kv : snap->methodLinkage) {
+            if( (name == kv.second->name) && (descriptor == kv.second->descriptor) ) {
+                keyMatch.assign(kv.first);
+                break;
+            }
         }
     }
     if(keyMatch == "") {
@@ -377,79 +1362,164 @@ std::string CJ::getUniqueKey(std::string name, std::string descriptor) {
 }
 
 methodLinkageCollection CJ::getMap() {
-    return this->methodLinkage;
+    Binding* b = this->binding.load();
+    return (b == NULL) ? methodLinkageCollection() : b->methodLinkage;
 }
 
 std::string CJ::getDescriptor(std::string key) {
-    return this->getSignatureObj(key)->descriptor;
+    Snapshot snap(*this);
+    return snap.getSignatureObj(key)->descriptor;
 }
 
 jmethodID CJ::getMid(std::string key) {
-    return this->getSignatureObj(key)->mid;
+    Snapshot snap(*this);
+    return snap.getSignatureObj(key)->mid;
 }
 
 int CJ::getSizeSignatures() {
-    return this->methodLinkage.size();
+    Snapshot snap(*this);
+    return (snap.get() == NULL) ? 0 : snap->methodLinkage.size();
 }
 
+// Builds the new binding aside and swaps it in: calls in flight keep using
+// the previous one, which is freed after the last of them.
 void CJ::setClass(std::string className) {
-    if (env == NULL || jvm == NULL) {
+    if (jvm == NULL) {
     	throw HandlerExc("CJay: No Java Virtual Machine instance. Please, call VM::createVM beforehand.");
     }
-
-    jclass clazz = env->FindClass(className.c_str());
-	if (clazz == NULL) {
-        jthrowable exc = env->ExceptionOccurred();
-        if (exc) {
-            env->ExceptionDescribe();
-            env->ExceptionClear();
-            throw HandlerExc("JNI: Can't find class " + className);
-        }
+    if (env == NULL) { attachCurrentThread(); }
+
+#ifdef CJAY_TRACING
+    TraceSpan span("setClass", "binding", className);
+    TraceSpan lookup("findClass", "binding", className);
+#endif
+    std::unique_ptr<Binding> b(new Binding());
+    CachedBinding cached;
+    bool isCached = findCachedBinding(className, cached);
+
+    // in-memory classes first, then the class path
+    jclass clazz = isCached ? cached.clazz : findClass(className);
+#ifdef CJAY_TRACING
+    lookup.end();
+#endif
+	b->className = className;
+	registerBoundClass(className);
+	// global reference, so that the binding can be used from any attached thread
+	b->clazz = (jclass) env->NewGlobalRef(clazz);
+
+	if (isCached) {
+#ifdef CJAY_TRACING
+	    TraceSpan reuse("bindingCache", "binding", className);
+#endif
+	    // no reflection nor method lookup: reuse the cached binding, which
+	    // addJar and addClass drop when they replace the class
+	    b->isNonUnique = cached.isNonUnique;
+	    b->methodReflect = cached.methodReflect;
+	    this->assignMethodLinkageCollection(b.get());
+	    for (auto& it : b->methodLinkage) {
+	        it.second->mid = cached.mids[it.first];
+	    }
+	} else {
+	    env->DeleteLocalRef(clazz);
+
+	    // Assign: Java Reflect Collection & Method Linkage
+	    {
+#ifdef CJAY_TRACING
+	        TraceSpan reflection("reflection", "binding", className);
+#endif
+	        this->assignMethodReflectCollection(b.get());
+	    }
+	    {
+#ifdef CJAY_TRACING
+	        TraceSpan keys("assignKeys", "binding", className);
+#endif
+	        this->assignMethodLinkageCollection(b.get());
+	    }
+
+	    // Set methodID of signatures
+#ifdef CJAY_TRACING
+	    TraceSpan lookupMethods("GetMethodID", "binding", className);
+#endif
+	    VM::SignatureBase* signature;
+	    jmethodID mid;
+	    for (auto& it : b->methodLinkage) {
+	        std::string key = it.first;
+	        signature = it.second;
+	        // get methodID
+	        if (signature->isStatic) {
+	            mid = env->GetStaticMethodID(b->clazz, signature->name.c_str(), signature->descriptor.c_str());
+	        } else {
+	            mid = env->GetMethodID(b->clazz, signature->name.c_str(), signature->descriptor.c_str());
+	        }
+	        if (mid == NULL) {
+	            jthrowable exc;
+	            exc = env->ExceptionOccurred();
+	            if (exc) {
+	                env->ExceptionDescribe();
+	                env->ExceptionClear();
+	                throw HandlerExc(
+	                    "JNI: Failed to get method ID of " + key + " with descriptor: " + signature->descriptor);
+	            }
+	        }
+	        // update signature
+	        it.second->mid = mid;
+	    }
+#ifdef CJAY_TRACING
+	    lookupMethods.end();
+#endif
+
+	    storeCachedBinding(className, b->clazz, b->isNonUnique, b->methodReflect, b->methodLinkage);
+	}
+
+	// publish
+	std::lock_guard<std::mutex> lock(this->rebindMutex);
+	Binding* previous = this->binding.exchange(b.release());
+	if (previous != NULL) {
+	    this->retired.push_back(previous);
+	    this->hasRetired.store(true);
+	    // snapshots being taken hold the pinning count for a few instructions only
+	    while (this->pinning.load() != 0) { std::this_thread::yield(); }
+	    this->reclaim();
+	}
+}
+
+void CJ::initializeClass() {
+    Snapshot snap(*this);
+    if (snap.get() == NULL) {
+        throw HandlerExc("CJay: No class bound. Use setClass beforehand.");
     }
-	this->className = className;
-	this->clazz = clazz;
-
-	// Assign: Java Reflect Collection & Method Linkage
-	this->assignCollections();
-
-	// Set methodID of signatures
-    VM::SignatureBase* signature;
-    jmethodID mid;
-    for (auto& it : this->methodLinkage) {
-        std::string key = it.first;
-        signature = it.second;
-        // get methodID
-        if (signature->isStatic) {
-        	mid = env->GetStaticMethodID(this->clazz, signature->name.c_str(), signature->descriptor.c_str());
-        } else {
-        	mid = env->GetMethodID(this->clazz, signature->name.c_str(), signature->descriptor.c_str());
-        }
-        if (mid == NULL) {
-            jthrowable exc;
-            exc = env->ExceptionOccurred();
-            if (exc) {
-                env->ExceptionDescribe();
-                env->ExceptionClear();
-                throw HandlerExc(
-                    "JNI: Failed to get method ID of " + key + " with descriptor: " + signature->descriptor);
-            }
-        }
-        // update signature
-        it.second->mid = mid;
+    // Class.forName(name, true, loader) runs the static initializers
+    jclass CLASS = env->FindClass("java/lang/Class");
+    jmethodID midForName = env->GetStaticMethodID(CLASS, "forName",
+            "(Ljava/lang/String;ZLjava/lang/ClassLoader;)Ljava/lang/Class;");
+    jmethodID midGetClassLoader = env->GetMethodID(CLASS, "getClassLoader", "()Ljava/lang/ClassLoader;");
+
+    std::string binaryName(snap->className);
+    std::replace(binaryName.begin(), binaryName.end(), '/', '.');
+    jstring name = env->NewStringUTF(binaryName.c_str());
+    jobject loader = env->CallObjectMethod(snap->clazz, midGetClassLoader);
+    jobject initialized = env->CallStaticObjectMethod(CLASS, midForName, name, JNI_TRUE, loader);
+
+    env->DeleteLocalRef(initialized);
+    env->DeleteLocalRef(loader);
+    env->DeleteLocalRef(name);
+    env->DeleteLocalRef(CLASS);
+    if (env->ExceptionCheck()) {
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+        throw HandlerExc("JNI: Failed to initialize class " + snap->className);
     }
-
 }
 
 VM::SignatureBase* CJ::getSignatureObj(std::string key) {
-    if ( this->methodLinkage.find(key) == this->methodLinkage.end() ) {
-        throw HandlerExc("Key does not exit. Use setSignature member beforehand.");
-    }
-    return this->methodLinkage[key];
+    Snapshot snap(*this);
+    return snap.getSignatureObj(key);
 }
 
 void CJ::Constructor(std::string key, ...) {
     // Get Method Id (Constructor)
-    VM::SignatureBase* sig = this->getSignatureObj(key);
+    Snapshot snap(*this);
+    VM::SignatureBase* sig = snap.getSignatureObj(key);
     jmethodID mid = sig->mid;
     jobject obj;
 
@@ -457,28 +1527,44 @@ void CJ::Constructor(std::string key, ...) {
         throw HandlerExc("MethodID not set. Probably set class was not set.");
     }
 
+#ifdef CJAY_METHOD_STATS
+    MethodStatsTimer timer(methodStatsOf(*sig));
+#endif
+#ifdef CJAY_TRACING
+    TraceSpan span("Constructor", "call", key, Tracer::tracingCalls());
+#endif
     va_list args;
     va_start(args, key);
 
-    obj = env->NewObjectV(this->clazz, mid, args);
+    obj = env->NewObjectV(snap->clazz, mid, args);
 
     va_end(args);
 
-    this->obj = obj;
+    // published before the previous instance is released
+    jobject previous = this->obj.exchange(env->NewGlobalRef(obj));
+    if (previous != NULL) { env->DeleteGlobalRef(previous); }
+    env->DeleteLocalRef(obj);
 }
 
 template <typename To> To CJ::call(std::string key, ...) {
-    SignatureBase* sigSuper = this->getSignatureObj(key);
+    Snapshot snap(*this);
+    SignatureBase* sigSuper = snap.getSignatureObj(key);
     Signature<To>* sigChild = dynamic_cast<Signature<To>*>(sigSuper);
     jmethodID mid = sigChild->mid;
-    To (CJ::*pCall) (jmethodID, va_list);
+    To (CJ::*pCall) (jobject, jmethodID, va_list);
     pCall = sigChild->pCall;
     To jobj;
+#ifdef CJAY_METHOD_STATS
+    MethodStatsTimer timer(methodStatsOf(*sigChild));
+#endif
+#ifdef CJAY_TRACING
+    TraceSpan span("call", "call", key, Tracer::tracingCalls());
+#endif
 
     va_list args;
     va_start(args, key);
 
-    jobj = (this->*pCall) (mid, args);
+    jobj = (this->*pCall) (sigChild->isStatic ? snap->clazz : this->obj.load(), mid, args);
 
     va_end(args);
 
@@ -486,20 +1572,61 @@ template <typename To> To CJ::call(std::string key, ...) {
 }
 
 template <> void CJ::call(std::string key, ...) {
-    SignatureBase* sigSuper = this->getSignatureObj(key);
+    Snapshot snap(*this);
+    SignatureBase* sigSuper = snap.getSignatureObj(key);
     Signature<void>* sigChild = dynamic_cast<Signature<void>*>(sigSuper);
     jmethodID mid = sigChild->mid;
-    void (CJ::*pCall) (jmethodID, va_list);
+    void (CJ::*pCall) (jobject, jmethodID, va_list);
     pCall = sigChild->pCall;
+#ifdef CJAY_METHOD_STATS
+    MethodStatsTimer timer(methodStatsOf(*sigChild));
+#endif
+#ifdef CJAY_TRACING
+    TraceSpan span("call", "call", key, Tracer::tracingCalls());
+#endif
 
     va_list args;
     va_start(args, key);
 
-    (this->*pCall) (mid, args);
+    (this->*pCall) (sigChild->isStatic ? snap->clazz : this->obj.load(), mid, args);
 
     va_end(args);
 }
 
+// Call with arguments known only at run time. Reference results are local references.
+jvalue CJ::callA(std::string key, const jvalue* args) {
+    Snapshot snap(*this);
+    SignatureBase* sig = snap.getSignatureObj(key);
+    jmethodID mid = sig->mid;
+    jclass clazz = snap->clazz;
+    jobject obj = this->obj.load();
+    bool isStatic = sig->isStatic;
+    jvalue result;
+    result.j = 0;
+#ifdef CJAY_METHOD_STATS
+    MethodStatsTimer timer(methodStatsOf(*sig));
+#endif
+#ifdef CJAY_TRACING
+    TraceSpan span("callA", "call", key, Tracer::tracingCalls());
+#endif
+
+    switch (sig->descriptor[sig->descriptor.find(')') + 1])
+    {
+    case 'Z' : result.z = isStatic ? env->CallStaticBooleanMethodA(clazz, mid, args) : env->CallBooleanMethodA(obj, mid, args); break;
+    case 'B' : result.b = isStatic ? env->CallStaticByteMethodA(clazz, mid, args) : env->CallByteMethodA(obj, mid, args); break;
+    case 'C' : result.c = isStatic ? env->CallStaticCharMethodA(clazz, mid, args) : env->CallCharMethodA(obj, mid, args); break;
+    case 'S' : result.s = isStatic ? env->CallStaticShortMethodA(clazz, mid, args) : env->CallShortMethodA(obj, mid, args); break;
+    case 'I' : result.i = isStatic ? env->CallStaticIntMethodA(clazz, mid, args) : env->CallIntMethodA(obj, mid, args); break;
+    case 'J' : result.j = isStatic ? env->CallStaticLongMethodA(clazz, mid, args) : env->CallLongMethodA(obj, mid, args); break;
+    case 'F' : result.f = isStatic ? env->CallStaticFloatMethodA(clazz, mid, args) : env->CallFloatMethodA(obj, mid, args); break;
+    case 'D' : result.d = isStatic ? env->CallStaticDoubleMethodA(clazz, mid, args) : env->CallDoubleMethodA(obj, mid, args); break;
+    case 'V' : isStatic ? env->CallStaticVoidMethodA(clazz, mid, args) : env->CallVoidMethodA(obj, mid, args); break;
+    default :
+        result.l = isStatic ? env->CallStaticObjectMethodA(clazz, mid, args) : env->CallObjectMethodA(obj, mid, args);
+    }
+    return result;
+}
+
 template jboolean CJ::call(std::string, ...);
 template jbyte CJ::call(std::string, ...);
 template jchar CJ::call(std::string, ...);
@@ -520,192 +1647,192 @@ template jdoubleArray CJ::call(std::string, ...);
 template jobjectArray CJ::call(std::string, ...);
 template void CJ::call(std::string, ...);
 
-template <> jboolean CJ::callStatic(jmethodID mid, va_list args) {
-    return env->CallStaticBooleanMethodV(this->clazz, mid, args);
+template <> jboolean CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return env->CallStaticBooleanMethodV((jclass) clazz, mid, args);
 }
 
-template <> jbyte CJ::callStatic(jmethodID mid, va_list args) {
-    return env->CallStaticByteMethodV(this->clazz, mid, args);
+template <> jbyte CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return env->CallStaticByteMethodV((jclass) clazz, mid, args);
 }
 
-template <> jchar CJ::callStatic(jmethodID mid, va_list args) {
-    return env->CallStaticCharMethodV(this->clazz, mid, args);
+template <> jchar CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return env->CallStaticCharMethodV((jclass) clazz, mid, args);
 }
 
-template <> jshort CJ::callStatic(jmethodID mid, va_list args) {
-    return env->CallStaticShortMethodV(this->clazz, mid, args);
+template <> jshort CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return env->CallStaticShortMethodV((jclass) clazz, mid, args);
 }
 
-template <> jint CJ::callStatic(jmethodID mid, va_list args) {
-    return env->CallStaticIntMethodV(this->clazz, mid, args);
+template <> jint CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return env->CallStaticIntMethodV((jclass) clazz, mid, args);
 }
 
-template <> jlong CJ::callStatic(jmethodID mid, va_list args) {
-    return env->CallStaticLongMethodV(this->clazz, mid, args);
+template <> jlong CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return env->CallStaticLongMethodV((jclass) clazz, mid, args);
 }
 
-template <> jfloat CJ::callStatic(jmethodID mid, va_list args) {
-    return env->CallStaticFloatMethodV(this->clazz, mid, args);
+template <> jfloat CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return env->CallStaticFloatMethodV((jclass) clazz, mid, args);
 }
 
-template <> jdouble CJ::callStatic(jmethodID mid, va_list args) {
-    return env->CallStaticDoubleMethodV(this->clazz, mid, args);
+template <> jdouble CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return env->CallStaticDoubleMethodV((jclass) clazz, mid, args);
 }
 
-template <> jobject CJ::callStatic(jmethodID mid, va_list args) {
-    return env->CallStaticObjectMethodV(this->clazz, mid, args);
+template <> jobject CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return env->CallStaticObjectMethodV((jclass) clazz, mid, args);
 }
 
-template <> jbooleanArray CJ::callStatic(jmethodID mid, va_list args) {
-    return (jbooleanArray) env->CallStaticObjectMethodV(this->clazz, mid, args);
+template <> jbooleanArray CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return (jbooleanArray) env->CallStaticObjectMethodV((jclass) clazz, mid, args);
 }
 
-template <> jbyteArray CJ::callStatic(jmethodID mid, va_list args) {
-    return (jbyteArray) env->CallStaticObjectMethodV(this->clazz, mid, args);
+template <> jbyteArray CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return (jbyteArray) env->CallStaticObjectMethodV((jclass) clazz, mid, args);
 }
 
-template <> jcharArray CJ::callStatic(jmethodID mid, va_list args) {
-    return (jcharArray) env->CallStaticObjectMethodV(this->clazz, mid, args);
+template <> jcharArray CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return (jcharArray) env->CallStaticObjectMethodV((jclass) clazz, mid, args);
 }
 
-template <> jshortArray CJ::callStatic(jmethodID mid, va_list args) {
-    return (jshortArray) env->CallStaticObjectMethodV(this->clazz, mid, args);
+template <> jshortArray CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return (jshortArray) env->CallStaticObjectMethodV((jclass) clazz, mid, args);
 }
 
-template <> jintArray CJ::callStatic(jmethodID mid, va_list args) {
-    return (jintArray) env->CallStaticObjectMethodV(this->clazz, mid, args);
+template <> jintArray CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return (jintArray) env->CallStaticObjectMethodV((jclass) clazz, mid, args);
 }
 
-template <> jlongArray CJ::callStatic(jmethodID mid, va_list args) {
-    return (jlongArray) env->CallStaticObjectMethodV(this->clazz, mid, args);
+template <> jlongArray CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return (jlongArray) env->CallStaticObjectMethodV((jclass) clazz, mid, args);
 }
 
-template <> jfloatArray CJ::callStatic(jmethodID mid, va_list args) {
-    return (jfloatArray) env->CallStaticObjectMethodV(this->clazz, mid, args);
+template <> jfloatArray CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return (jfloatArray) env->CallStaticObjectMethodV((jclass) clazz, mid, args);
 }
 
-template <> jdoubleArray CJ::callStatic(jmethodID mid, va_list args) {
-    return (jdoubleArray) env->CallStaticObjectMethodV(this->clazz, mid, args);
+template <> jdoubleArray CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return (jdoubleArray) env->CallStaticObjectMethodV((jclass) clazz, mid, args);
 }
 
-template <> jobjectArray CJ::callStatic(jmethodID mid, va_list args) {
-    return (jobjectArray) env->CallStaticObjectMethodV(this->clazz, mid, args);
+template <> jobjectArray CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    return (jobjectArray) env->CallStaticObjectMethodV((jclass) clazz, mid, args);
 }
 
-template <> void CJ::callStatic(jmethodID mid, va_list args) {
-    env->CallStaticVoidMethodV(this->clazz, mid, args);
+template <> void CJ::callStatic(jobject clazz, jmethodID mid, va_list args) {
+    env->CallStaticVoidMethodV((jclass) clazz, mid, args);
 }
 
 /*
-template jboolean CJ::callStatic(jmethodID, va_list);
-template jbyte CJ::callStatic(jmethodID, va_list);
-template jchar CJ::callStatic(jmethodID, va_list);
-template jshort CJ::callStatic(jmethodID, va_list);
-template jint CJ::callStatic(jmethodID, va_list);
-template jlong CJ::callStatic(jmethodID, va_list);
-template jfloat CJ::callStatic(jmethodID, va_list);
-template jdouble CJ::callStatic(jmethodID, va_list);
-template jobject CJ::callStatic(jmethodID, va_list);
-template jbooleanArray CJ::callStatic(jmethodID, va_list);
-template jbyteArray CJ::callStatic(jmethodID, va_list);
-template jcharArray CJ::callStatic(jmethodID, va_list);
-template jshortArray CJ::callStatic(jmethodID, va_list);
-template jintArray CJ::callStatic(jmethodID, va_list);
-template jlongArray CJ::callStatic(jmethodID, va_list);
-template jfloatArray CJ::callStatic(jmethodID, va_list);
-template jdoubleArray CJ::callStatic(jmethodID, va_list);
-template jobjectArray CJ::callStatic(jmethodID, va_list);
-template void CJ::callStatic(jmethodID, va_list);
+template jboolean CJ::callStatic(jobject, jmethodID, va_list);
+template jbyte CJ::callStatic(jobject, jmethodID, va_list);
+template jchar CJ::callStatic(jobject, jmethodID, va_list);
+template jshort CJ::callStatic(jobject, jmethodID, va_list);
+template jint CJ::callStatic(jobject, jmethodID, va_list);
+template jlong CJ::callStatic(jobject, jmethodID, va_list);
+template jfloat CJ::callStatic(jobject, jmethodID, va_list);
+template jdouble CJ::callStatic(jobject, jmethodID, va_list);
+template jobject CJ::callStatic(jobject, jmethodID, va_list);
+template jbooleanArray CJ::callStatic(jobject, jmethodID, va_list);
+template jbyteArray CJ::callStatic(jobject, jmethodID, va_list);
+template jcharArray CJ::callStatic(jobject, jmethodID, va_list);
+template jshortArray CJ::callStatic(jobject, jmethodID, va_list);
+template jintArray CJ::callStatic(jobject, jmethodID, va_list);
+template jlongArray CJ::callStatic(jobject, jmethodID, va_list);
+template jfloatArray CJ::callStatic(jobject, jmethodID, va_list);
+template jdoubleArray CJ::callStatic(jobject, jmethodID, va_list);
+template jobjectArray CJ::callStatic(jobject, jmethodID, va_list);
+template void CJ::callStatic(jobject, jmethodID, va_list);
 */
 
-template <> jboolean CJ::callNonStatic(jmethodID mid, va_list args) {
-    return env->CallBooleanMethodV(this->obj, mid, args);
+template <> jboolean CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return env->CallBooleanMethodV(obj, mid, args);
 }
 
-template <> jbyte CJ::callNonStatic(jmethodID mid, va_list args) {
-    return env->CallByteMethodV(this->obj, mid, args);
+template <> jbyte CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return env->CallByteMethodV(obj, mid, args);
 }
 
-template <> jchar CJ::callNonStatic(jmethodID mid, va_list args) {
-    return env->CallCharMethodV(this->obj, mid, args);
+template <> jchar CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return env->CallCharMethodV(obj, mid, args);
 }
 
-template <> jshort CJ::callNonStatic(jmethodID mid, va_list args) {
-    return env->CallShortMethodV(this->obj, mid, args);
+template <> jshort CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return env->CallShortMethodV(obj, mid, args);
 }
 
-template <> jint CJ::callNonStatic(jmethodID mid, va_list args) {
-    return env->CallIntMethodV(this->obj, mid, args);
+template <> jint CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return env->CallIntMethodV(obj, mid, args);
 }
 
-template <> jlong CJ::callNonStatic(jmethodID mid, va_list args) {
-    return env->CallLongMethodV(this->obj, mid, args);
+template <> jlong CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return env->CallLongMethodV(obj, mid, args);
 }
 
-template <> jfloat CJ::callNonStatic(jmethodID mid, va_list args) {
-    return env->CallFloatMethodV(this->obj, mid, args);
+template <> jfloat CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return env->CallFloatMethodV(obj, mid, args);
 }
 
-template <> jdouble CJ::callNonStatic(jmethodID mid, va_list args) {
-    return env->CallDoubleMethodV(this->obj, mid, args);
+template <> jdouble CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return env->CallDoubleMethodV(obj, mid, args);
 }
 
-template <> jobject CJ::callNonStatic(jmethodID mid, va_list args) {
-    return env->CallObjectMethodV(this->obj, mid, args);
+template <> jobject CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return env->CallObjectMethodV(obj, mid, args);
 }
 
-template <> jbooleanArray CJ::callNonStatic(jmethodID mid, va_list args) {
-    return (jbooleanArray) env->CallObjectMethodV(this->obj, mid, args);
+template <> jbooleanArray CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return (jbooleanArray) env->CallObjectMethodV(obj, mid, args);
 }
 
-template <> jbyteArray CJ::callNonStatic(jmethodID mid, va_list args) {
-    return (jbyteArray) env->CallObjectMethodV(this->obj, mid, args);
+template <> jbyteArray CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return (jbyteArray) env->CallObjectMethodV(obj, mid, args);
 }
 
-template <> jcharArray CJ::callNonStatic(jmethodID mid, va_list args) {
-    return (jcharArray) env->CallObjectMethodV(this->obj, mid, args);
+template <> jcharArray CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return (jcharArray) env->CallObjectMethodV(obj, mid, args);
 }
 
-template <> jshortArray CJ::callNonStatic(jmethodID mid, va_list args) {
-    return (jshortArray) env->CallObjectMethodV(this->obj, mid, args);
+template <> jshortArray CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return (jshortArray) env->CallObjectMethodV(obj, mid, args);
 }
 
-template <> jintArray CJ::callNonStatic(jmethodID mid, va_list args) {
-    return (jintArray) env->CallObjectMethodV(this->obj, mid, args);
+template <> jintArray CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return (jintArray) env->CallObjectMethodV(obj, mid, args);
 }
 
-template <> jlongArray CJ::callNonStatic(jmethodID mid, va_list args) {
-    return (jlongArray) env->CallObjectMethodV(this->obj, mid, args);
+template <> jlongArray CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return (jlongArray) env->CallObjectMethodV(obj, mid, args);
 }
 
-template <> jfloatArray CJ::callNonStatic(jmethodID mid, va_list args) {
-    return (jfloatArray) env->CallObjectMethodV(this->obj, mid, args);
+template <> jfloatArray CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return (jfloatArray) env->CallObjectMethodV(obj, mid, args);
 }
 
-template <> jdoubleArray CJ::callNonStatic(jmethodID mid, va_list args) {
-    return (jdoubleArray) env->CallObjectMethodV(this->obj, mid, args);
+template <> jdoubleArray CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return (jdoubleArray) env->CallObjectMethodV(obj, mid, args);
 }
 
-template <> jobjectArray CJ::callNonStatic(jmethodID mid, va_list args) {
-    return (jobjectArray) env->CallObjectMethodV(this->obj, mid, args);
+template <> jobjectArray CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    return (jobjectArray) env->CallObjectMethodV(obj, mid, args);
 }
 
-template <> void CJ::callNonStatic(jmethodID mid, va_list args) {
-    env->CallVoidMethodV(this->obj, mid, args);
+template <> void CJ::callNonStatic(jobject obj, jmethodID mid, va_list args) {
+    env->CallVoidMethodV(obj, mid, args);
 }
 
 /*
-template jboolean CJ::callNonStatic(jmethodID, va_list);
-template jbyte CJ::callNonStatic(jmethodID, va_list);
-template jchar CJ::callNonStatic(jmethodID, va_list);
-template jshort CJ::callNonStatic(jmethodID, va_list);
-template jint CJ::callNonStatic(jmethodID, va_list);
-template jlong CJ::callNonStatic(jmethodID, va_list);
-template jfloat CJ::callNonStatic(jmethodID, va_list);
-template jdouble CJ::callNonStatic(jmethodID, va_list);
-template jobject CJ::callNonStatic(jmethodID, va_list);
-template jbooleanArray CJ::callNonStatic(jmethodID, va_list);
-template void CJ::callNonStatic(jmethodID, va_list);
+template jboolean CJ::callNonStatic(jobject, jmethodID, va_list);
+template jbyte CJ::callNonStatic(jobject, jmethodID, va_list);
+template jchar CJ::callNonStatic(jobject, jmethodID, va_list);
+template jshort CJ::callNonStatic(jobject, jmethodID, va_list);
+template jint CJ::callNonStatic(jobject, jmethodID, va_list);
+template jlong CJ::callNonStatic(jobject, jmethodID, va_list);
+template jfloat CJ::callNonStatic(jobject, jmethodID, va_list);
+template jdouble CJ::callNonStatic(jobject, jmethodID, va_list);
+template jobject CJ::callNonStatic(jobject, jmethodID, va_list);
+template jbooleanArray CJ::callNonStatic(jobject, jmethodID, va_list);
+template void CJ::callNonStatic(jobject, jmethodID, va_list);
 */
 
 JNIEnv* CJ::getEnv() {
@@ -719,37 +1846,992 @@ ConverterBase::ConverterBase() { }
 ConverterBase::~ConverterBase() { }
 
 /**
- ** Converter implementation
+ ** Array kernels implementation
  **/
-Converter::Converter(): ConverterBase() { this->init(); }
-Converter::~Converter() { }
-
-void Converter::initUTIL() {
-    UTIL.setClass("cjay/converter/Util");
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CJAY_X86_SIMD
+#endif
+
+enum SimdLevel { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_AVX512 };
+
+// Best instruction set of this CPU, capped by the CJAY_SIMD environment
+// variable (scalar, sse2, avx2 or avx512)
+static SimdLevel detectSimdLevel() {
+    SimdLevel level = SIMD_SCALAR;
+#ifdef CJAY_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) { level = SIMD_SSE2; }
+    if (__builtin_cpu_supports("avx2")) { level = SIMD_AVX2; }
+    if (__builtin_cpu_supports("avx512f")) { level = SIMD_AVX512; }
+#endif
+    const char* cap = getenv("CJAY_SIMD");
+    if (cap != NULL) {
+        std::string s(cap);
+        SimdLevel max = s == "scalar" ? SIMD_SCALAR : s == "sse2" ? SIMD_SSE2 : s == "avx2" ? SIMD_AVX2 : SIMD_AVX512;
+        level = std::min(level, max);
+    }
+    return level;
 }
 
-void Converter::initARRAYLIST() {
-    ARRAYLIST.setClass("java/util/ArrayList");
+static SimdLevel simdLevel() {
+    static const SimdLevel level = detectSimdLevel();
+    return level;
 }
 
-void Converter::initSET() {
-    SET.setClass("java/util/Set");
+const char* getSimdLevel() {
+    static const char* names[] = { "scalar", "sse2", "avx2", "avx512" };
+    return names[simdLevel()];
 }
 
-void Converter::initCOLLECTION() {
-    COLLECTION.setClass("java/util/Collection");
+template <typename To, typename From> void convertArray(const From* src, To* dst, std::size_t n) {
+    for (std::size_t i = 0; i < n; i++) { dst[i] = javaCast<To>(src[i]); }
 }
 
-void Converter::initMAP() {
-    MAP.setClass("java/util/Map");
-}
+#ifdef CJAY_X86_SIMD
+// Each kernel converts a prefix of the input and returns its length; the
+// caller finishes the tail with scalar code.
 
-void Converter::initNUMBER() {
-    NUMBER.setClass("java/lang/Number");
+// float -> double
+static std::size_t convertSSE2(const jfloat* src, jdouble* dst, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128 x = _mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)));
+        _mm_storeu_pd(dst + i, _mm_cvtps_pd(x));
+    }
+    return i;
 }
-
-void Converter::initBOOLEAN() {
-    BOOLEAN.setClass("java/lang/Boolean");
+__attribute__((target("avx2"))) static std::size_t convertAVX2(const jfloat* src, jdouble* dst, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) { _mm256_storeu_pd(dst + i, _mm256_cvtps_pd(_mm_loadu_ps(src + i))); }
+    return i;
+}
+__attribute__((target("avx512f"))) static std::size_t convertAVX512(const jfloat* src, jdouble* dst, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) { _mm512_storeu_pd(dst + i, _mm512_cvtps_pd(_mm256_loadu_ps(src + i))); }
+    return i;
+}
+
+// double -> float
+static std::size_t convertSSE2(const jdouble* src, jfloat* dst, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128 x = _mm_cvtpd_ps(_mm_loadu_pd(src + i));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_castps_si128(x));
+    }
+    return i;
+}
+__attribute__((target("avx2"))) static std::size_t convertAVX2(const jdouble* src, jfloat* dst, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) { _mm_storeu_ps(dst + i, _mm256_cvtpd_ps(_mm256_loadu_pd(src + i))); }
+    return i;
+}
+__attribute__((target("avx512f"))) static std::size_t convertAVX512(const jdouble* src, jfloat* dst, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) { _mm256_storeu_ps(dst + i, _mm512_cvtpd_ps(_mm512_loadu_pd(src + i))); }
+    return i;
+}
+
+// int -> double
+static std::size_t convertSSE2(const jint* src, jdouble* dst, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(dst + i, _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i))));
+    }
+    return i;
+}
+__attribute__((target("avx2"))) static std::size_t convertAVX2(const jint* src, jdouble* dst, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i))));
+    }
+    return i;
+}
+__attribute__((target("avx512f"))) static std::size_t convertAVX512(const jint* src, jdouble* dst, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm512_storeu_pd(dst + i, _mm512_cvtepi32_pd(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i))));
+    }
+    return i;
+}
+
+// int -> float
+static std::size_t convertSSE2(const jint* src, jfloat* dst, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(dst + i, _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i))));
+    }
+    return i;
+}
+__attribute__((target("avx2"))) static std::size_t convertAVX2(const jint* src, jfloat* dst, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i))));
+    }
+    return i;
+}
+__attribute__((target("avx512f"))) static std::size_t convertAVX512(const jint* src, jfloat* dst, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(dst + i, _mm512_cvtepi32_ps(_mm512_loadu_si512(src + i)));
+    }
+    return i;
+}
+
+// int -> long (sign extension)
+static std::size_t convertSSE2(const jint* src, jlong* dst, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i sign = _mm_srai_epi32(x, 31);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi32(x, sign));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 2), _mm_unpackhi_epi32(x, sign));
+    }
+    return i;
+}
+__attribute__((target("avx2"))) static std::size_t convertAVX2(const jint* src, jlong* dst, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_cvtepi32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), x);
+    }
+    return i;
+}
+__attribute__((target("avx512f"))) static std::size_t convertAVX512(const jint* src, jlong* dst, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm512_storeu_si512(dst + i, _mm512_cvtepi32_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i))));
+    }
+    return i;
+}
+
+#define CJAY_SIMD_CONVERT(From, To) \
+template <> void convertArray(const From* src, To* dst, std::size_t n) { \
+    std::size_t i = 0; \
+    switch (simdLevel()) \
+    { \
+    case SIMD_AVX512 : i = convertAVX512(src, dst, n); break; \
+    case SIMD_AVX2 : i = convertAVX2(src, dst, n); break; \
+    case SIMD_SSE2 : i = convertSSE2(src, dst, n); break; \
+    default : break; \
+    } \
+    for (; i < n; i++) { dst[i] = javaCast<To>(src[i]); } \
+}
+CJAY_SIMD_CONVERT(jfloat, jdouble)
+CJAY_SIMD_CONVERT(jdouble, jfloat)
+CJAY_SIMD_CONVERT(jint, jdouble)
+CJAY_SIMD_CONVERT(jint, jfloat)
+CJAY_SIMD_CONVERT(jint, jlong)
+#undef CJAY_SIMD_CONVERT
+
+// Pack 0/1 bytes into bits
+static std::size_t packBitsSSE2(const jboolean* src, std::uint64_t* words, std::size_t n) {
+    std::size_t i = 0;
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 64 <= n; i += 64) {
+        std::uint64_t w = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16 * k));
+            std::uint64_t bits = (~_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero))) & 0xFFFF;
+            w |= bits << (16 * k);
+        }
+        words[i / 64] = w;
+    }
+    return i;
+}
+__attribute__((target("avx2"))) static std::size_t packBitsAVX2(const jboolean* src, std::uint64_t* words, std::size_t n) {
+    std::size_t i = 0;
+    const __m256i zero = _mm256_setzero_si256();
+    for (; i + 64 <= n; i += 64) {
+        __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32));
+        std::uint64_t bitsLo = (std::uint32_t) ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, zero));
+        std::uint64_t bitsHi = (std::uint32_t) ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, zero));
+        words[i / 64] = bitsLo | (bitsHi << 32);
+    }
+    return i;
+}
+#endif
+
+static void packBits(const jboolean* src, std::uint64_t* words, std::size_t n) {
+    std::size_t i = 0;
+#ifdef CJAY_X86_SIMD
+    switch (simdLevel())
+    {
+    case SIMD_AVX512 :
+    case SIMD_AVX2 : i = packBitsAVX2(src, words, n); break;
+    case SIMD_SSE2 : i = packBitsSSE2(src, words, n); break;
+    default : break;
+    }
+#endif
+    for (; i < n; i++) {
+        if (src[i]) { words[i / 64] |= std::uint64_t(1) << (i % 64); }
+    }
+}
+
+// Unpack bits into 0/1 bytes, 8 at a time through a table
+static void unpackBits(const std::uint64_t* words, jboolean* dst, std::size_t n) {
+    static std::uint64_t table[256];
+    static std::once_flag tableReady;
+    std::call_once(tableReady, []() {
+        for (int b = 0; b < 256; b++) {
+            std::uint64_t bytes = 0;
+            for (int k = 0; k < 8; k++) { if (b & (1 << k)) { bytes |= std::uint64_t(1) << (8 * k); } }
+            table[b] = bytes; // little endian: element k is byte k
+        }
+    });
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        std::uint64_t bytes = table[(words[i / 64] >> (i % 64)) & 0xFF];
+        std::memcpy(dst + i, &bytes, 8);
+    }
+    for (; i < n; i++) { dst[i] = (words[i / 64] >> (i % 64)) & 1; }
+}
+
+/**
+ ** String transcoding implementation
+ **/
+
+#ifdef CJAY_X86_SIMD
+// Leading ASCII units copied 16 at a time; returns how many
+static std::size_t asciiToUtf8SSE2(const jchar* src, std::size_t n, char* dst) {
+    std::size_t i = 0;
+    const __m128i high = _mm_set1_epi16((short) 0xFF80);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+        __m128i nonAscii = _mm_and_si128(_mm_or_si128(a, b), high);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(nonAscii, zero)) != 0xFFFF) { break; }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(a, b));
+    }
+    return i;
+}
+__attribute__((target("avx2"))) static std::size_t asciiToUtf8AVX2(const jchar* src, std::size_t n, char* dst) {
+    std::size_t i = 0;
+    const __m256i high = _mm256_set1_epi16((short) 0xFF80);
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 16));
+        if (!_mm256_testz_si256(_mm256_or_si256(a, b), high)) { break; }
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8); // undo lane interleaving
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+    }
+    return i;
+}
+static std::size_t asciiToUtf16SSE2(const char* src, std::size_t n, jchar* dst) {
+    std::size_t i = 0;
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if (_mm_movemask_epi8(x) != 0) { break; }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi8(x, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpackhi_epi8(x, zero));
+    }
+    return i;
+}
+__attribute__((target("avx2"))) static std::size_t asciiToUtf16AVX2(const char* src, std::size_t n, jchar* dst) {
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        if (_mm256_movemask_epi8(x) != 0) { break; }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(x)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(x, 1)));
+    }
+    return i;
+}
+#endif
+
+static std::size_t asciiToUtf8(const jchar* src, std::size_t n, char* dst) {
+#ifdef CJAY_X86_SIMD
+    switch (simdLevel())
+    {
+    case SIMD_AVX512 :
+    case SIMD_AVX2 : return asciiToUtf8AVX2(src, n, dst);
+    case SIMD_SSE2 : return asciiToUtf8SSE2(src, n, dst);
+    default : break;
+    }
+#endif
+    return 0;
+}
+
+static std::size_t asciiToUtf16(const char* src, std::size_t n, jchar* dst) {
+#ifdef CJAY_X86_SIMD
+    switch (simdLevel())
+    {
+    case SIMD_AVX512 :
+    case SIMD_AVX2 : return asciiToUtf16AVX2(src, n, dst);
+    case SIMD_SSE2 : return asciiToUtf16SSE2(src, n, dst);
+    default : break;
+    }
+#endif
+    return 0;
+}
+
+// Unpaired surrogates become U+FFFD
+std::size_t utf16ToUtf8(const jchar* src, std::size_t n, char* dst) {
+    std::size_t i = 0;
+    char* out = dst;
+    while (i < n) {
+        std::size_t ascii = asciiToUtf8(src + i, n - i, out);
+        i += ascii;
+        out += ascii;
+        // scalar for at least a block, so that non-ASCII text does not retry SIMD on every unit
+        for (std::size_t end = std::min(n, i + 32); i < end; i++) {
+            std::uint32_t c = src[i];
+            if (c < 0x80) {
+                *out++ = (char) c;
+            } else if (c < 0x800) {
+                *out++ = (char) (0xC0 | (c >> 6));
+                *out++ = (char) (0x80 | (c & 0x3F));
+            } else if (c >= 0xD800 && c <= 0xDBFF && i + 1 < n && src[i + 1] >= 0xDC00 && src[i + 1] <= 0xDFFF) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (src[i + 1] - 0xDC00);
+                *out++ = (char) (0xF0 | (c >> 18));
+                *out++ = (char) (0x80 | ((c >> 12) & 0x3F));
+                *out++ = (char) (0x80 | ((c >> 6) & 0x3F));
+                *out++ = (char) (0x80 | (c & 0x3F));
+                i++;
+            } else {
+                if (c >= 0xD800 && c <= 0xDFFF) { c = 0xFFFD; }
+                *out++ = (char) (0xE0 | (c >> 12));
+                *out++ = (char) (0x80 | ((c >> 6) & 0x3F));
+                *out++ = (char) (0x80 | (c & 0x3F));
+            }
+        }
+    }
+    return out - dst;
+}
+
+// Invalid or truncated sequences become U+FFFD, one per byte
+std::size_t utf8ToUtf16(const char* src, std::size_t n, jchar* dst) {
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(src);
+    std::size_t i = 0;
+    jchar* out = dst;
+    while (i < n) {
+        std::size_t ascii = asciiToUtf16(src + i, n - i, out);
+        i += ascii;
+        out += ascii;
+        for (std::size_t end = std::min(n, i + 32); i < end; ) {
+            std::uint32_t c = s[i];
+            std::size_t len = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 0;
+            bool valid = len > 0 && i + len <= n;
+            for (std::size_t k = 1; valid && k < len; k++) { valid = (s[i + k] & 0xC0) == 0x80; }
+            if (valid && len > 1) {
+                c &= (0x7F >> len);
+                for (std::size_t k = 1; k < len; k++) { c = (c << 6) | (s[i + k] & 0x3F); }
+                // overlong forms, surrogates and values above U+10FFFF
+                static const std::uint32_t minimum[] = { 0, 0, 0x80, 0x800, 0x10000 };
+                valid = c >= minimum[len] && c <= 0x10FFFF && (c < 0xD800 || c > 0xDFFF);
+            }
+            if (!valid) {
+                *out++ = 0xFFFD;
+                i++;
+            } else if (c >= 0x10000) {
+                c -= 0x10000;
+                *out++ = (jchar) (0xD800 + (c >> 10));
+                *out++ = (jchar) (0xDC00 + (c & 0x3FF));
+                i += len;
+            } else {
+                *out++ = (jchar) c;
+                i += len;
+            }
+        }
+    }
+    return out - dst;
+}
+
+std::string toUTF8(jstring str) {
+    std::string out;
+    toUTF8(str, out);
+    return out;
+}
+
+jstring newJavaString(const char* str, std::size_t size) {
+    if (size <= 256) {
+        jchar units[256];
+        return env->NewString(units, (jsize) utf8ToUtf16(str, size, units));
+    }
+    std::vector<jchar> units(size);
+    return env->NewString(&units[0], (jsize) utf8ToUtf16(str, size, &units[0]));
+}
+
+/**
+ ** String cache implementation
+ **/
+struct InternedString {
+    std::string text;
+    std::uint64_t hash;
+    jstring ref; // global reference
+};
+
+struct StringStripe {
+    std::mutex mutex;
+    std::list<InternedString> lru; // most recently used first
+    std::unordered_multimap<std::uint64_t, std::list<InternedString>::iterator> index;
+    std::unordered_multimap<std::uint64_t, InternedString> statics;
+};
+
+static const int stringStripes = 16;
+static const std::size_t maxInternedBytes = 1024;
+static StringStripe stringCache[stringStripes];
+static std::atomic<std::size_t> stringCacheCapacity(4096);
+
+// FNV-1a; the top bits pick the stripe
+static std::uint64_t stringHash(const char* str, std::size_t size) {
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (std::size_t i = 0; i < size; i++) { hash = (hash ^ (unsigned char) str[i]) * 1099511628211ULL; }
+    return hash;
+}
+
+static StringStripe& stringStripe(std::uint64_t hash) {
+    return stringCache[hash >> 60];
+}
+
+static bool sameText(const std::string& text, const char* str, std::size_t size) {
+    return text.size() == size && std::memcmp(text.data(), str, size) == 0;
+}
+
+static jstring newGlobalString(const char* str, std::size_t size) {
+    jstring local = newJavaString(str, size);
+    if (local == NULL) {
+        checkJavaException(); // OutOfMemoryError
+        throw HandlerExc("JNI: Cannot allocate a Java string.");
+    }
+    jstring global = (jstring) env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    return global;
+}
+
+// Under the stripe lock; a local reference, as the entry may be evicted by another thread
+static jstring findString(StringStripe& stripe, std::uint64_t hash, const char* str, std::size_t size) {
+    auto statics = stripe.statics.equal_range(hash);
+    for (auto it = statics.first; it != statics.second; ++it) {
+        if (sameText(it->second.text, str, size)) { return (jstring) env->NewLocalRef(it->second.ref); }
+    }
+    auto cached = stripe.index.equal_range(hash);
+    for (auto it = cached.first; it != cached.second; ++it) {
+        if (sameText(it->second->text, str, size)) {
+            stripe.lru.splice(stripe.lru.begin(), stripe.lru, it->second);
+            return (jstring) env->NewLocalRef(it->second->ref);
+        }
+    }
+    return NULL;
+}
+
+jstring internString(const char* str, std::size_t size) {
+    if (size > maxInternedBytes) { return newJavaString(str, size); }
+    std::uint64_t hash = stringHash(str, size);
+    StringStripe& stripe = stringStripe(hash);
+    {
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        jstring found = findString(stripe, hash, str, size);
+        if (found != NULL) { return found; }
+    }
+
+    jstring global = newGlobalString(str, size); // outside the lock
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    jstring found = findString(stripe, hash, str, size);
+    if (found != NULL) { // interned meanwhile by another thread
+        env->DeleteGlobalRef(global);
+        return found;
+    }
+    stripe.lru.push_front(InternedString());
+    stripe.lru.front().text.assign(str, size);
+    stripe.lru.front().hash = hash;
+    stripe.lru.front().ref = global;
+    stripe.index.insert(std::make_pair(hash, stripe.lru.begin()));
+    jstring rtn = (jstring) env->NewLocalRef(global);
+
+    std::size_t capacity = std::max<std::size_t>(stringCacheCapacity.load() / stringStripes, 1);
+    while (stripe.lru.size() > capacity) {
+        std::list<InternedString>::iterator last = std::prev(stripe.lru.end());
+        auto range = stripe.index.equal_range(last->hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == last) { stripe.index.erase(it); break; }
+        }
+        env->DeleteGlobalRef(last->ref);
+        stripe.lru.erase(last);
+    }
+    return rtn;
+}
+
+jstring internString(const std::string& str) {
+    return internString(str.data(), str.size());
+}
+
+jstring registerStaticString(const std::string& str) {
+    std::uint64_t hash = stringHash(str.data(), str.size());
+    StringStripe& stripe = stringStripe(hash);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto statics = stripe.statics.equal_range(hash);
+    for (auto it = statics.first; it != statics.second; ++it) {
+        if (it->second.text == str) { return it->second.ref; }
+    }
+    InternedString entry;
+    entry.text = str;
+    entry.hash = hash;
+    entry.ref = newGlobalString(str.data(), str.size());
+    stripe.statics.insert(std::make_pair(hash, entry));
+    return entry.ref;
+}
+
+void setStringCacheCapacity(std::size_t capacity) {
+    stringCacheCapacity = capacity; // applied as the stripes fill up
+}
+
+std::size_t getStringCacheSize() {
+    std::size_t size = 0;
+    for (StringStripe& stripe : stringCache) {
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        size += stripe.lru.size() + stripe.statics.size();
+    }
+    return size;
+}
+
+void clearStringCache() {
+    for (StringStripe& stripe : stringCache) {
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        if (env != NULL) {
+            for (InternedString& entry : stripe.lru) { env->DeleteGlobalRef(entry.ref); }
+            for (auto& kv : stripe.statics) { env->DeleteGlobalRef(kv.second.ref); }
+        }
+        stripe.lru.clear();
+        stripe.index.clear();
+        stripe.statics.clear();
+    }
+}
+
+/**
+ ** ArrayPool implementation
+ **/
+template <typename Array> ArrayPool<Array>::ArrayPool()
+    : classes(MAX_CLASS_BITS - MIN_CLASS_BITS + 1), maxPerClass(8), hits(0), misses(0) {}
+
+// Never destroyed: global references can only be deleted while the JVM is up (see clear)
+template <typename Array> ArrayPool<Array>& ArrayPool<Array>::instance() {
+    static ArrayPool* pool = new ArrayPool();
+    return *pool;
+}
+
+template <typename Array> int ArrayPool<Array>::sizeClass(jsize length) {
+    if (length > ((jsize) 1 << MAX_CLASS_BITS)) { return -1; }
+    int bits = MIN_CLASS_BITS;
+    while (((jsize) 1 << bits) < length) { bits++; }
+    return bits - MIN_CLASS_BITS;
+}
+
+template <typename Array> PooledArray<Array> ArrayPool<Array>::acquire(jsize length) {
+    if (length < 0) {
+        throw HandlerExc("CJay: Negative array length.");
+    }
+    int sizeClass = ArrayPool::sizeClass(length);
+    if (sizeClass >= 0) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        std::vector<Array>& free = this->classes[sizeClass];
+        if (!free.empty()) {
+            Array array = free.back();
+            free.pop_back();
+            this->hits++;
+            return PooledArray<Array>(array, length, sizeClass);
+        }
+    }
+    this->misses++;
+    Array local = JavaArray<Array>::newArray((sizeClass < 0) ? length : (jsize) 1 << (sizeClass + MIN_CLASS_BITS));
+    if (local == NULL) {
+        checkJavaException(); // OutOfMemoryError
+        throw HandlerExc("JNI: Cannot allocate a Java array.");
+    }
+    Array array = (Array) env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    return PooledArray<Array>(array, length, sizeClass);
+}
+
+template <typename Array> void ArrayPool<Array>::release(Array array, int sizeClass) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        std::vector<Array>& free = this->classes[sizeClass];
+        if (free.size() < this->maxPerClass) {
+            free.push_back(array);
+            return;
+        }
+    }
+    env->DeleteGlobalRef(array);
+}
+
+template <typename Array> void ArrayPool<Array>::setMaxPerClass(std::size_t maxPerClass) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->maxPerClass = maxPerClass;
+}
+
+template <typename Array> std::size_t ArrayPool<Array>::pooledCount() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::size_t n = 0;
+    for (auto& free : this->classes) { n += free.size(); }
+    return n;
+}
+
+template <typename Array> void ArrayPool<Array>::clear() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (auto& free : this->classes) {
+        if (env != NULL) {
+            for (Array array : free) { env->DeleteGlobalRef(array); }
+        }
+        free.clear();
+    }
+}
+
+template class ArrayPool<jbooleanArray>;
+template class ArrayPool<jbyteArray>;
+template class ArrayPool<jcharArray>;
+template class ArrayPool<jshortArray>;
+template class ArrayPool<jintArray>;
+template class ArrayPool<jlongArray>;
+template class ArrayPool<jfloatArray>;
+template class ArrayPool<jdoubleArray>;
+
+static void clearArrayPools() {
+    ArrayPool<jbooleanArray>::instance().clear();
+    ArrayPool<jbyteArray>::instance().clear();
+    ArrayPool<jcharArray>::instance().clear();
+    ArrayPool<jshortArray>::instance().clear();
+    ArrayPool<jintArray>::instance().clear();
+    ArrayPool<jlongArray>::instance().clear();
+    ArrayPool<jfloatArray>::instance().clear();
+    ArrayPool<jdoubleArray>::instance().clear();
+}
+
+/**
+ ** RecordBatch implementation
+ **/
+static const std::size_t recordHeaderBytes = 32;
+static const std::size_t recordDescriptorBytes = 56;
+
+template <typename T> static T recordRead(const std::uint8_t* base, std::size_t offset) {
+    T value;
+    std::memcpy(&value, base + offset, sizeof(T));
+    return value;
+}
+
+template <typename T> static void recordWrite(std::uint8_t* base, std::size_t offset, T value) {
+    std::memcpy(base + offset, &value, sizeof(T));
+}
+
+static std::size_t recordAlign(std::size_t n) {
+    return (n + 7) & ~(std::size_t) 7;
+}
+
+static std::size_t recordWidth(char type) {
+    switch (type) {
+        case 'Z': case 'B': return 1;
+        case 'C': case 'S': return 2;
+        case 'I': case 'F': case 'T': return 4;
+        case 'J': case 'D': return 8;
+        default: throw HandlerExc(std::string("CJay: Unknown record batch column type ") + type + ".");
+    }
+}
+
+RecordColumn::RecordColumn() : type(0), nullCount(0), validity(NULL), data(NULL), text(NULL) {}
+
+RecordBatch::RecordBatch() : base(NULL), size(0), owned(false), buffer(NULL), rows(0) {}
+
+RecordBatch::RecordBatch(const void* data, std::size_t size, jobject owner)
+        : base((std::uint8_t*) const_cast<void*>(data)), size(size), owned(false), buffer(NULL), rows(0) {
+    this->parse();
+    if (owner != NULL) { this->buffer = env->NewGlobalRef(owner); }
+}
+
+RecordBatch::RecordBatch(RecordBatch&& other)
+        : base(other.base), size(other.size), owned(other.owned), buffer(other.buffer), rows(other.rows) {
+    this->columns.swap(other.columns);
+    other.base = NULL;
+    other.size = 0;
+    other.owned = false;
+    other.buffer = NULL;
+    other.rows = 0;
+}
+
+RecordBatch::~RecordBatch() {
+    if (this->owned) { std::free(this->base); }
+    if (this->buffer != NULL && env != NULL) { env->DeleteGlobalRef(this->buffer); }
+}
+
+// Checks every offset against the buffer before anything is read through it
+void RecordBatch::parse() {
+    const std::uint8_t* p = this->base;
+    std::size_t size = this->size;
+    if (p == NULL || size < recordHeaderBytes || recordRead<std::int32_t>(p, 0) != MAGIC) {
+        throw HandlerExc("CJay: Not a record batch.");
+    }
+    if (recordRead<std::int32_t>(p, 4) != VERSION) {
+        throw HandlerExc("CJay: Unsupported record batch version.");
+    }
+    std::int32_t n = recordRead<std::int32_t>(p, 8);
+    jlong rows = recordRead<std::int64_t>(p, 16);
+    std::uint64_t total = recordRead<std::int64_t>(p, 24);
+    if (n < 0 || rows < 0 || total > size || recordHeaderBytes + (std::uint64_t) n * recordDescriptorBytes > total) {
+        throw HandlerExc("CJay: Malformed record batch.");
+    }
+    auto fits = [total](std::uint64_t offset, std::uint64_t bytes) { return offset <= total && bytes <= total - offset; };
+    // count elements of width bytes, divided rather than multiplied: no overflow for a huge rows
+    auto fitsArray = [total](std::uint64_t offset, std::uint64_t count, std::uint64_t width) {
+        return offset <= total && count <= (total - offset) / width;
+    };
+
+    std::vector<RecordColumn> columns(n);
+    for (std::int32_t c = 0; c < n; c++) {
+        std::size_t d = recordHeaderBytes + c * recordDescriptorBytes;
+        RecordColumn& column = columns[c];
+        column.type = (char) recordRead<std::int32_t>(p, d);
+        column.nullCount = recordRead<std::int64_t>(p, d + 8);
+        std::uint64_t name = recordRead<std::int64_t>(p, d + 16);
+        std::uint64_t validity = recordRead<std::int64_t>(p, d + 24);
+        std::uint64_t values = recordRead<std::int64_t>(p, d + 32);
+        std::uint64_t text = recordRead<std::int64_t>(p, d + 40);
+        std::uint64_t nameLength = recordRead<std::int64_t>(p, d + 48);
+
+        std::uint64_t count = (std::uint64_t) rows + ((column.type == 'T') ? 1 : 0);
+        if (!fits(name, nameLength) || (validity != 0 && !fits(validity, (std::uint64_t) rows / 8 + (rows % 8 != 0)))
+                || !fitsArray(values, count, recordWidth(column.type)) || (values & (recordWidth(column.type) - 1)) != 0) {
+            throw HandlerExc("CJay: Malformed record batch.");
+        }
+        column.name.assign((const char*) p + name, nameLength);
+        column.validity = (validity != 0) ? p + validity : NULL;
+        column.data = p + values;
+        if (column.type == 'T') {
+            const std::int32_t* offsets = (const std::int32_t*) column.data;
+            for (jlong r = 0; r < rows; r++) {
+                if (offsets[r] < 0 || offsets[r] > offsets[r + 1]) { throw HandlerExc("CJay: Malformed record batch."); }
+            }
+            if ((rows > 0 && offsets[0] != 0) || !fits(text, offsets[rows])) { throw HandlerExc("CJay: Malformed record batch."); }
+            column.text = (const char*) p + text;
+        }
+    }
+    this->rows = rows;
+    this->columns.swap(columns);
+}
+
+const RecordColumn& RecordBatch::column(int c) const {
+    if (c < 0 || c >= (int) this->columns.size()) {
+        throw HandlerExc("CJay: Record batch column out of range.");
+    }
+    return this->columns[c];
+}
+
+int RecordBatch::columnIndex(const std::string& name) const {
+    for (std::size_t c = 0; c < this->columns.size(); c++) {
+        if (this->columns[c].name == name) { return (int) c; }
+    }
+    return -1;
+}
+
+template <typename T> const T* RecordBatch::values(int c) const {
+    typedef typename JavaArrayOf<T>::type Array;
+    const RecordColumn& column = this->column(c);
+    if (column.type != JavaArray<Array>::code()) {
+        throw HandlerExc("CJay: Column " + column.name + " holds " + column.type + ", not " + JavaArray<Array>::code() + ".");
+    }
+    return (const T*) column.data;
+}
+
+template const jboolean* RecordBatch::values(int) const;
+template const jbyte* RecordBatch::values(int) const;
+template const jchar* RecordBatch::values(int) const;
+template const jshort* RecordBatch::values(int) const;
+template const jint* RecordBatch::values(int) const;
+template const jlong* RecordBatch::values(int) const;
+template const jfloat* RecordBatch::values(int) const;
+template const jdouble* RecordBatch::values(int) const;
+
+std::string RecordBatch::getString(int c, jlong row) const {
+    const RecordColumn& column = this->column(c);
+    if (column.type != 'T') {
+        throw HandlerExc("CJay: Column " + column.name + " does not hold strings.");
+    }
+    if (row < 0 || row >= this->rows) {
+        throw HandlerExc("CJay: Record batch row out of range.");
+    }
+    if (column.isNull(row)) { return std::string(); }
+    const std::int32_t* offsets = (const std::int32_t*) column.data;
+    return std::string(column.text + offsets[row], offsets[row + 1] - offsets[row]);
+}
+
+RecordBatchBuilder::RecordBatchBuilder() : rows(0) {}
+
+RecordBatchBuilder::Column& RecordBatchBuilder::addColumn(const std::string& name, char type, std::size_t rows, const std::vector<bool>& valid) {
+    if (!this->columns.empty() && (jlong) rows != this->rows) {
+        throw HandlerExc("CJay: Column " + name + " has a different number of rows.");
+    }
+    if (!valid.empty() && valid.size() != rows) {
+        throw HandlerExc("CJay: Validity of column " + name + " has a different number of rows.");
+    }
+    this->rows = (jlong) rows;
+    this->columns.push_back(Column());
+    Column& column = this->columns.back();
+    column.name = name;
+    column.type = type;
+    if (std::find(valid.begin(), valid.end(), false) != valid.end()) { column.valid = valid; }
+    return column;
+}
+
+template <typename T> RecordBatchBuilder& RecordBatchBuilder::add(std::string name, const std::vector<T>& values, const std::vector<bool>& valid) {
+    typedef typename JavaArrayOf<T>::type Array;
+    Column& column = this->addColumn(name, JavaArray<Array>::code(), values.size(), valid);
+    column.values.resize(values.size() * sizeof(T));
+    if (!values.empty()) { std::memcpy(&column.values[0], &values[0], column.values.size()); }
+    return *this;
+}
+
+template RecordBatchBuilder& RecordBatchBuilder::add(std::string, const std::vector<jboolean>&, const std::vector<bool>&);
+template RecordBatchBuilder& RecordBatchBuilder::add(std::string, const std::vector<jbyte>&, const std::vector<bool>&);
+template RecordBatchBuilder& RecordBatchBuilder::add(std::string, const std::vector<jchar>&, const std::vector<bool>&);
+template RecordBatchBuilder& RecordBatchBuilder::add(std::string, const std::vector<jshort>&, const std::vector<bool>&);
+template RecordBatchBuilder& RecordBatchBuilder::add(std::string, const std::vector<jint>&, const std::vector<bool>&);
+template RecordBatchBuilder& RecordBatchBuilder::add(std::string, const std::vector<jlong>&, const std::vector<bool>&);
+template RecordBatchBuilder& RecordBatchBuilder::add(std::string, const std::vector<jfloat>&, const std::vector<bool>&);
+template RecordBatchBuilder& RecordBatchBuilder::add(std::string, const std::vector<jdouble>&, const std::vector<bool>&);
+
+RecordBatchBuilder& RecordBatchBuilder::add(std::string name, const std::vector<std::string>& values, const std::vector<bool>& valid) {
+    Column& column = this->addColumn(name, 'T', values.size(), valid);
+    column.offsets.reserve(values.size() + 1);
+    column.offsets.push_back(0);
+    for (std::size_t r = 0; r < values.size(); r++) {
+        if (column.valid.empty() || column.valid[r]) { column.text += values[r]; }
+        if (column.text.size() > 0x7fffffff) {
+            throw HandlerExc("CJay: Text of column " + name + " exceeds 2 GiB.");
+        }
+        column.offsets.push_back((std::int32_t) column.text.size());
+    }
+    return *this;
+}
+
+RecordBatch RecordBatchBuilder::build() {
+    std::size_t n = this->columns.size();
+    std::size_t rows = (std::size_t) this->rows;
+    std::size_t size = recordHeaderBytes + n * recordDescriptorBytes;
+    for (const Column& column : this->columns) {
+        size += recordAlign(column.name.size());
+        if (!column.valid.empty()) { size += recordAlign((rows + 7) / 8); }
+        size += recordAlign((column.type == 'T') ? column.offsets.size() * sizeof(std::int32_t) : column.values.size());
+        size += recordAlign(column.text.size());
+    }
+
+    std::uint8_t* p = (std::uint8_t*) std::calloc(size, 1); // 8-byte aligned, bitmaps start cleared
+    if (p == NULL) { throw HandlerExc("CJay: Cannot allocate record batch."); }
+    RecordBatch batch;
+    batch.base = p;
+    batch.size = size;
+    batch.owned = true;
+
+    recordWrite<std::int32_t>(p, 0, RecordBatch::MAGIC);
+    recordWrite<std::int32_t>(p, 4, RecordBatch::VERSION);
+    recordWrite<std::int32_t>(p, 8, (std::int32_t) n);
+    recordWrite<std::int64_t>(p, 16, (std::int64_t) rows);
+    recordWrite<std::int64_t>(p, 24, (std::int64_t) size);
+    std::size_t position = recordHeaderBytes + n * recordDescriptorBytes;
+    for (std::size_t c = 0; c < n; c++) {
+        const Column& column = this->columns[c];
+        std::size_t d = recordHeaderBytes + c * recordDescriptorBytes;
+        recordWrite<std::int32_t>(p, d, column.type);
+        recordWrite<std::int64_t>(p, d + 8, std::count(column.valid.begin(), column.valid.end(), false));
+        recordWrite<std::int64_t>(p, d + 48, column.name.size());
+
+        recordWrite<std::int64_t>(p, d + 16, position);
+        std::memcpy(p + position, column.name.data(), column.name.size());
+        position += recordAlign(column.name.size());
+
+        if (!column.valid.empty()) {
+            recordWrite<std::int64_t>(p, d + 24, position);
+            for (std::size_t r = 0; r < rows; r++) {
+                if (column.valid[r]) { p[position + (r >> 3)] |= (std::uint8_t) (1 << (r & 7)); }
+            }
+            position += recordAlign((rows + 7) / 8);
+        }
+
+        recordWrite<std::int64_t>(p, d + 32, position);
+        if (column.type == 'T') {
+            std::memcpy(p + position, &column.offsets[0], column.offsets.size() * sizeof(std::int32_t));
+            position += recordAlign(column.offsets.size() * sizeof(std::int32_t));
+            recordWrite<std::int64_t>(p, d + 40, position);
+            std::memcpy(p + position, column.text.data(), column.text.size());
+            position += recordAlign(column.text.size());
+        } else {
+            if (!column.values.empty()) { std::memcpy(p + position, &column.values[0], column.values.size()); }
+            position += recordAlign(column.values.size());
+        }
+    }
+    batch.parse();
+    return batch;
+}
+
+/**
+ ** PackedReader implementation
+ **/
+
+jsize PackedReader::count() {
+    jint n = this->value<jint>();
+    if (n < 0) {
+        throw HandlerExc("CJay: Malformed packed structure (negative count).");
+    }
+    return n;
+}
+
+const char* PackedReader::take(std::size_t n) {
+    if ((std::size_t) (this->end - this->pos) < n) {
+        throw HandlerExc("CJay: Malformed packed structure (truncated).");
+    }
+    const char* at = this->pos;
+    this->pos += n;
+    return at;
+}
+
+HandlerExc PackedReader::mismatch(char tag, const char* expected) {
+    std::string found = (tag == 'N') ? "null" : std::string("tag ") + tag;
+    return HandlerExc("CJay: Packed value is " + found + ", expected " + expected + ".");
+}
+
+/**
+ ** Converter implementation
+ **/
+Converter::Converter(): ConverterBase() {
+#ifdef CJAY_TRACING
+    TraceSpan span("Converter", "startup");
+#endif
+    for (auto& clazz : this->arrayClasses) { clazz = NULL; }
+    this->init();
+}
+
+Converter::~Converter() {
+    if (env == NULL) { return; }
+    for (auto& clazz : this->arrayClasses) {
+        if (clazz != NULL) { env->DeleteGlobalRef(clazz); }
+    }
+}
+
+void Converter::initUTIL() {
+    UTIL.setClass("cjay/converter/Util");
+}
+
+void Converter::initARRAYLIST() {
+    ARRAYLIST.setClass("java/util/ArrayList");
+}
+
+void Converter::initSET() {
+    SET.setClass("java/util/Set");
+}
+
+void Converter::initCOLLECTION() {
+    COLLECTION.setClass("java/util/Collection");
+}
+
+void Converter::initMAP() {
+    MAP.setClass("java/util/Map");
+}
+
+void Converter::initNUMBER() {
+    NUMBER.setClass("java/lang/Number");
+}
+
+void Converter::initBOOLEAN() {
+    BOOLEAN.setClass("java/lang/Boolean");
 }
 
 void Converter::initBYTE() {
@@ -833,11 +2915,11 @@ template <> jobject Converter::j_cast(jchar x) {
 }
 
 template <> jstring Converter::j_cast(std::string str) {
-    return env->NewStringUTF(str.c_str());
+    return newJavaString(str.data(), str.size());
 }
 
 template <> jstring Converter::j_cast(const char* str) {
-    return env->NewStringUTF(str);
+    return newJavaString(str, std::strlen(str));
 }
 
 template <> jbooleanArray Converter::j_cast(std::vector<jboolean> x) {
@@ -888,6 +2970,14 @@ template <> jfloatArray Converter::j_cast(std::vector<jfloat> x) {
     return jArray;
 }
 
+template <> jdoubleArray Converter::j_cast(std::vector<jdouble> x) {
+    size_t size = x.size();
+    jdoubleArray jArray = env->NewDoubleArray(size);
+    jdouble* cArray = &x[0];
+    env->SetDoubleArrayRegion(jArray, 0, size, cArray);
+    return jArray;
+}
+
 template <> jcharArray Converter::j_cast(std::vector<jchar> x) {
     size_t size = x.size();
     jcharArray jArray = env->NewCharArray(size);
@@ -951,105 +3041,573 @@ template <> jchar Converter::c_cast(jobject jobj) {
     return env->CallCharMethod(jobj, mid, NULL);
 }
 
+template <> jmethodID Converter::unboxMethod<jboolean>() { return BOOLEAN.getSignatureObj("booleanValue")->mid; }
+template <> jmethodID Converter::unboxMethod<bool>() { return BOOLEAN.getSignatureObj("booleanValue")->mid; }
+template <> jmethodID Converter::unboxMethod<jbyte>() { return BYTE.getSignatureObj("byteValue")->mid; }
+template <> jmethodID Converter::unboxMethod<jchar>() { return CHARACTER.getSignatureObj("charValue")->mid; }
+template <> jmethodID Converter::unboxMethod<jshort>() { return SHORT.getSignatureObj("shortValue")->mid; }
+template <> jmethodID Converter::unboxMethod<jint>() { return INTEGER.getSignatureObj("intValue")->mid; }
+template <> jmethodID Converter::unboxMethod<jlong>() { return LONG.getSignatureObj("longValue")->mid; }
+template <> jmethodID Converter::unboxMethod<jfloat>() { return FLOAT.getSignatureObj("floatValue")->mid; }
+template <> jmethodID Converter::unboxMethod<jdouble>() { return DOUBLE.getSignatureObj("doubleValue")->mid; }
+
 template <> std::string Converter::c_cast(jobject jobj) {
-    return std::string(env->GetStringUTFChars((jstring) jobj, JNI_FALSE));
+    return toUTF8((jstring) jobj);
 }
 
 template <> jobject Converter::c_cast(jobject jobj) {
     return jobj;
 }
 
+/* jconvert<> of the primitives, boxed */
+#define CJAY_JCONVERT_PRIMITIVE(JType) \
+JType jconvert<JType>::from_java(Converter& cnv, jobject x) { return cnv.c_cast<JType>(x); } \
+jobject jconvert<JType>::to_java(Converter& cnv, const JType& x) { return cnv.j_cast<jobject>(x); }
+CJAY_JCONVERT_PRIMITIVE(jboolean)
+CJAY_JCONVERT_PRIMITIVE(jbyte)
+CJAY_JCONVERT_PRIMITIVE(jchar)
+CJAY_JCONVERT_PRIMITIVE(jshort)
+CJAY_JCONVERT_PRIMITIVE(jint)
+CJAY_JCONVERT_PRIMITIVE(jlong)
+CJAY_JCONVERT_PRIMITIVE(jfloat)
+CJAY_JCONVERT_PRIMITIVE(jdouble)
+#undef CJAY_JCONVERT_PRIMITIVE
+
 template <> std::vector<jboolean> Converter::c_cast_array(jbooleanArray x) {
-    jsize size = env->GetArrayLength(x);
-    jboolean* cArray = env->GetBooleanArrayElements(x, 0);
-    std::vector<jboolean> cVec;
-    for(jsize i = 0; i < size; i++) { cVec.push_back(*(cArray+i)); }
+    std::vector<jboolean> cVec(env->GetArrayLength(x));
+    if (!cVec.empty()) { env->GetBooleanArrayRegion(x, 0, (jsize) cVec.size(), &cVec[0]); } // single copy, nothing pinned
     return cVec;
 }
 
 template <> std::vector<jbyte> Converter::c_cast_array(jbyteArray x) {
-    jsize size = env->GetArrayLength(x);
-    jbyte* cArray = env->GetByteArrayElements(x, 0);
-    std::vector<jbyte> cVec;
-    for(jsize i = 0; i < size; i++) { cVec.push_back(*(cArray+i)); }
+    std::vector<jbyte> cVec(env->GetArrayLength(x));
+    if (!cVec.empty()) { env->GetByteArrayRegion(x, 0, (jsize) cVec.size(), &cVec[0]); } // single copy, nothing pinned
     return cVec;
 }
 
 template <> std::vector<jint> Converter::c_cast_array(jintArray x) {
-    jsize size = env->GetArrayLength(x);
-    jint* cArray = env->GetIntArrayElements(x, 0);
-    std::vector<jint> cVec;
-    for(jsize i = 0; i < size; i++) { cVec.push_back(*(cArray+i)); }
+    std::vector<jint> cVec(env->GetArrayLength(x));
+    if (!cVec.empty()) { env->GetIntArrayRegion(x, 0, (jsize) cVec.size(), &cVec[0]); } // single copy, nothing pinned
     return cVec;
 }
 
 template <> std::vector<jlong> Converter::c_cast_array(jlongArray x) {
-    jsize size = env->GetArrayLength(x);
-    jlong* cArray = env->GetLongArrayElements(x, 0);
-    std::vector<jlong> cVec;
-    for(jsize i = 0; i < size; i++) { cVec.push_back(*(cArray+i)); }
+    std::vector<jlong> cVec(env->GetArrayLength(x));
+    if (!cVec.empty()) { env->GetLongArrayRegion(x, 0, (jsize) cVec.size(), &cVec[0]); } // single copy, nothing pinned
     return cVec;
 }
 
 template <> std::vector<jshort> Converter::c_cast_array(jshortArray x) {
-    jsize size = env->GetArrayLength(x);
-    jshort* cArray = env->GetShortArrayElements(x, 0);
-    std::vector<jshort> cVec;
-    for(jsize i = 0; i < size; i++) { cVec.push_back(*(cArray+i)); }
+    std::vector<jshort> cVec(env->GetArrayLength(x));
+    if (!cVec.empty()) { env->GetShortArrayRegion(x, 0, (jsize) cVec.size(), &cVec[0]); } // single copy, nothing pinned
     return cVec;
 }
 
 template <> std::vector<jfloat> Converter::c_cast_array(jfloatArray x) {
-    jsize size = env->GetArrayLength(x);
-    jfloat* cArray = env->GetFloatArrayElements(x, 0);
-    std::vector<jfloat> cVec;
-    for(jsize i = 0; i < size; i++) { cVec.push_back(*(cArray+i)); }
+    std::vector<jfloat> cVec(env->GetArrayLength(x));
+    if (!cVec.empty()) { env->GetFloatArrayRegion(x, 0, (jsize) cVec.size(), &cVec[0]); } // single copy, nothing pinned
     return cVec;
 }
 
 template <> std::vector<jdouble> Converter::c_cast_array(jdoubleArray x) {
-    jsize size = env->GetArrayLength(x);
-    jdouble* cArray = env->GetDoubleArrayElements(x, 0);
-    std::vector<jdouble> cVec;
-    for(jsize i = 0; i < size; i++) { cVec.push_back(*(cArray+i)); }
+    std::vector<jdouble> cVec(env->GetArrayLength(x));
+    if (!cVec.empty()) { env->GetDoubleArrayRegion(x, 0, (jsize) cVec.size(), &cVec[0]); } // single copy, nothing pinned
     return cVec;
 }
 
 template <> std::vector<jchar> Converter::c_cast_array(jcharArray x) {
-    jsize size = env->GetArrayLength(x);
-    jchar* cArray = env->GetCharArrayElements(x, 0);
-    std::vector<jchar> cVec;
-    for(jsize i = 0; i < size; i++) { cVec.push_back(*(cArray+i)); }
+    std::vector<jchar> cVec(env->GetArrayLength(x));
+    if (!cVec.empty()) { env->GetCharArrayRegion(x, 0, (jsize) cVec.size(), &cVec[0]); } // single copy, nothing pinned
     return cVec;
 }
 
 template <> std::vector<jobject> Converter::c_cast_array(jobjectArray x) {
     jsize size = env->GetArrayLength(x);
     std::vector<jobject> cVec;
+    cVec.reserve(size);
     for(jsize i = 0; i < size; i++) { cVec.push_back(env->GetObjectArrayElement(x, i)); }
     return cVec;
 }
 
-int Converter::sizeVector(jobject jobj) {
-    VM::SignatureBase* sig = ARRAYLIST.getSignatureObj("size");
-
-    return env->CallIntMethod(jobj, sig->mid, NULL);
+// Arrays converted element-wise (widening or narrowing), straight from the
+// Java array: no intermediate vector
+template <typename To, typename From> std::vector<To> Converter::c_cast_array(From x) {
+    std::vector<To> cVec(env->GetArrayLength(x));
+    if (!cVec.empty()) { copyArrayRegion(this, x, (jsize) cVec.size(), &cVec[0]); }
+    return cVec;
 }
 
-int Converter::sizeMap(jobject jobj) {
-    VM::SignatureBase* sig = MAP.getSignatureObj("size");
+template <typename To, typename From> To Converter::j_cast(From x) {
+    typedef typename JavaArray<To>::element_type T;
+    jsize size = (jsize) x.size();
+    To jArray = JavaArray<To>::newArray(size);
+    if (size > 0) {
+        T* dst;
+        try {
+            dst = static_cast<T*>(criticalArray(jArray));
+        } catch (...) {
+            env->DeleteLocalRef(jArray);
+            throw;
+        }
+        convertArray(&x[0], dst, size);
+        env->ReleasePrimitiveArrayCritical(jArray, dst, 0);
+    }
+    return jArray;
+}
 
-    return env->CallIntMethod(jobj, sig->mid, NULL);
+template void convertArray(const jbyte*, jchar*, std::size_t);
+template void convertArray(const jbyte*, jshort*, std::size_t);
+template void convertArray(const jbyte*, jint*, std::size_t);
+template void convertArray(const jbyte*, jlong*, std::size_t);
+template void convertArray(const jbyte*, jfloat*, std::size_t);
+template void convertArray(const jbyte*, jdouble*, std::size_t);
+template void convertArray(const jchar*, jbyte*, std::size_t);
+template void convertArray(const jchar*, jshort*, std::size_t);
+template void convertArray(const jchar*, jint*, std::size_t);
+template void convertArray(const jchar*, jlong*, std::size_t);
+template void convertArray(const jchar*, jfloat*, std::size_t);
+template void convertArray(const jchar*, jdouble*, std::size_t);
+template void convertArray(const jshort*, jbyte*, std::size_t);
+template void convertArray(const jshort*, jchar*, std::size_t);
+template void convertArray(const jshort*, jint*, std::size_t);
+template void convertArray(const jshort*, jlong*, std::size_t);
+template void convertArray(const jshort*, jfloat*, std::size_t);
+template void convertArray(const jshort*, jdouble*, std::size_t);
+template void convertArray(const jint*, jbyte*, std::size_t);
+template void convertArray(const jint*, jchar*, std::size_t);
+template void convertArray(const jint*, jshort*, std::size_t);
+template void convertArray(const jlong*, jbyte*, std::size_t);
+template void convertArray(const jlong*, jchar*, std::size_t);
+template void convertArray(const jlong*, jshort*, std::size_t);
+template void convertArray(const jlong*, jint*, std::size_t);
+template void convertArray(const jlong*, jfloat*, std::size_t);
+template void convertArray(const jlong*, jdouble*, std::size_t);
+template void convertArray(const jfloat*, jbyte*, std::size_t);
+template void convertArray(const jfloat*, jchar*, std::size_t);
+template void convertArray(const jfloat*, jshort*, std::size_t);
+template void convertArray(const jfloat*, jint*, std::size_t);
+template void convertArray(const jfloat*, jlong*, std::size_t);
+template void convertArray(const jdouble*, jbyte*, std::size_t);
+template void convertArray(const jdouble*, jchar*, std::size_t);
+template void convertArray(const jdouble*, jshort*, std::size_t);
+template void convertArray(const jdouble*, jint*, std::size_t);
+template void convertArray(const jdouble*, jlong*, std::size_t);
+
+template std::vector<jchar> Converter::c_cast_array(jbyteArray);
+template std::vector<jshort> Converter::c_cast_array(jbyteArray);
+template std::vector<jint> Converter::c_cast_array(jbyteArray);
+template std::vector<jlong> Converter::c_cast_array(jbyteArray);
+template std::vector<jfloat> Converter::c_cast_array(jbyteArray);
+template std::vector<jdouble> Converter::c_cast_array(jbyteArray);
+template std::vector<jbyte> Converter::c_cast_array(jcharArray);
+template std::vector<jshort> Converter::c_cast_array(jcharArray);
+template std::vector<jint> Converter::c_cast_array(jcharArray);
+template std::vector<jlong> Converter::c_cast_array(jcharArray);
+template std::vector<jfloat> Converter::c_cast_array(jcharArray);
+template std::vector<jdouble> Converter::c_cast_array(jcharArray);
+template std::vector<jbyte> Converter::c_cast_array(jshortArray);
+template std::vector<jchar> Converter::c_cast_array(jshortArray);
+template std::vector<jint> Converter::c_cast_array(jshortArray);
+template std::vector<jlong> Converter::c_cast_array(jshortArray);
+template std::vector<jfloat> Converter::c_cast_array(jshortArray);
+template std::vector<jdouble> Converter::c_cast_array(jshortArray);
+template std::vector<jbyte> Converter::c_cast_array(jintArray);
+template std::vector<jchar> Converter::c_cast_array(jintArray);
+template std::vector<jshort> Converter::c_cast_array(jintArray);
+template std::vector<jlong> Converter::c_cast_array(jintArray);
+template std::vector<jfloat> Converter::c_cast_array(jintArray);
+template std::vector<jdouble> Converter::c_cast_array(jintArray);
+template std::vector<jbyte> Converter::c_cast_array(jlongArray);
+template std::vector<jchar> Converter::c_cast_array(jlongArray);
+template std::vector<jshort> Converter::c_cast_array(jlongArray);
+template std::vector<jint> Converter::c_cast_array(jlongArray);
+template std::vector<jfloat> Converter::c_cast_array(jlongArray);
+template std::vector<jdouble> Converter::c_cast_array(jlongArray);
+template std::vector<jbyte> Converter::c_cast_array(jfloatArray);
+template std::vector<jchar> Converter::c_cast_array(jfloatArray);
+template std::vector<jshort> Converter::c_cast_array(jfloatArray);
+template std::vector<jint> Converter::c_cast_array(jfloatArray);
+template std::vector<jlong> Converter::c_cast_array(jfloatArray);
+template std::vector<jdouble> Converter::c_cast_array(jfloatArray);
+template std::vector<jbyte> Converter::c_cast_array(jdoubleArray);
+template std::vector<jchar> Converter::c_cast_array(jdoubleArray);
+template std::vector<jshort> Converter::c_cast_array(jdoubleArray);
+template std::vector<jint> Converter::c_cast_array(jdoubleArray);
+template std::vector<jlong> Converter::c_cast_array(jdoubleArray);
+template std::vector<jfloat> Converter::c_cast_array(jdoubleArray);
+
+template jcharArray Converter::j_cast(std::vector<jbyte>);
+template jshortArray Converter::j_cast(std::vector<jbyte>);
+template jintArray Converter::j_cast(std::vector<jbyte>);
+template jlongArray Converter::j_cast(std::vector<jbyte>);
+template jfloatArray Converter::j_cast(std::vector<jbyte>);
+template jdoubleArray Converter::j_cast(std::vector<jbyte>);
+template jbyteArray Converter::j_cast(std::vector<jchar>);
+template jshortArray Converter::j_cast(std::vector<jchar>);
+template jintArray Converter::j_cast(std::vector<jchar>);
+template jlongArray Converter::j_cast(std::vector<jchar>);
+template jfloatArray Converter::j_cast(std::vector<jchar>);
+template jdoubleArray Converter::j_cast(std::vector<jchar>);
+template jbyteArray Converter::j_cast(std::vector<jshort>);
+template jcharArray Converter::j_cast(std::vector<jshort>);
+template jintArray Converter::j_cast(std::vector<jshort>);
+template jlongArray Converter::j_cast(std::vector<jshort>);
+template jfloatArray Converter::j_cast(std::vector<jshort>);
+template jdoubleArray Converter::j_cast(std::vector<jshort>);
+template jbyteArray Converter::j_cast(std::vector<jint>);
+template jcharArray Converter::j_cast(std::vector<jint>);
+template jshortArray Converter::j_cast(std::vector<jint>);
+template jlongArray Converter::j_cast(std::vector<jint>);
+template jfloatArray Converter::j_cast(std::vector<jint>);
+template jdoubleArray Converter::j_cast(std::vector<jint>);
+template jbyteArray Converter::j_cast(std::vector<jlong>);
+template jcharArray Converter::j_cast(std::vector<jlong>);
+template jshortArray Converter::j_cast(std::vector<jlong>);
+template jintArray Converter::j_cast(std::vector<jlong>);
+template jfloatArray Converter::j_cast(std::vector<jlong>);
+template jdoubleArray Converter::j_cast(std::vector<jlong>);
+template jbyteArray Converter::j_cast(std::vector<jfloat>);
+template jcharArray Converter::j_cast(std::vector<jfloat>);
+template jshortArray Converter::j_cast(std::vector<jfloat>);
+template jintArray Converter::j_cast(std::vector<jfloat>);
+template jlongArray Converter::j_cast(std::vector<jfloat>);
+template jdoubleArray Converter::j_cast(std::vector<jfloat>);
+template jbyteArray Converter::j_cast(std::vector<jdouble>);
+template jcharArray Converter::j_cast(std::vector<jdouble>);
+template jshortArray Converter::j_cast(std::vector<jdouble>);
+template jintArray Converter::j_cast(std::vector<jdouble>);
+template jlongArray Converter::j_cast(std::vector<jdouble>);
+template jfloatArray Converter::j_cast(std::vector<jdouble>);
+
+std::vector<std::uint64_t> Converter::c_cast_bits(jbooleanArray x) {
+    jsize size = env->GetArrayLength(x);
+    std::vector<std::uint64_t> words((size + 63) / 64, 0);
+    if (size > 0) {
+        const jboolean* src = static_cast<const jboolean*>(criticalArray(x));
+        packBits(src, &words[0], size);
+        env->ReleasePrimitiveArrayCritical(x, const_cast<jboolean*>(src), JNI_ABORT);
+    }
+    return words;
 }
 
-template <typename To> std::vector<To> Converter::c_cast_vector(jobject jobj, int size) {
+jbooleanArray Converter::j_cast_bits(const std::vector<std::uint64_t>& words, jsize size) {
+    if ((std::size_t) size > words.size() * 64) {
+        throw HandlerExc("CJay: Bitset holds fewer bits than the requested boolean[] size.");
+    }
+    jbooleanArray jArray = env->NewBooleanArray(size);
+    if (size > 0) {
+        jboolean* dst;
+        try {
+            dst = static_cast<jboolean*>(criticalArray(jArray));
+        } catch (...) {
+            env->DeleteLocalRef(jArray);
+            throw;
+        }
+        unpackBits(&words[0], dst, size);
+        env->ReleasePrimitiveArrayCritical(jArray, dst, 0);
+    }
+    return jArray;
+}
+
+// Rank and element descriptor of an array class, from its name ("[[D": 2, 'D')
+static int arrayRank(jobject x, char& code) {
+    static const jmethodID midGetName = []() {
+        jclass CLASS = env->FindClass("java/lang/Class");
+        jmethodID mid = env->GetMethodID(CLASS, "getName", "()Ljava/lang/String;");
+        env->DeleteLocalRef(CLASS);
+        return mid;
+    }();
+    jclass clazz = env->GetObjectClass(x);
+    jstring jname = (jstring) env->CallObjectMethod(clazz, midGetName);
+    std::string name = toUTF8(jname);
+    env->DeleteLocalRef(jname);
+    env->DeleteLocalRef(clazz);
+    int rank = (int) name.find_first_not_of('[');
+    code = name[rank];
+    return rank;
+}
+
+// First pass: largest extent of every dimension, and every array length
+static void ndShape(jobject array, int depth, int rank, std::vector<jsize>& shape, std::vector<std::vector<jsize> >& lengths) {
+    jsize len = array == NULL ? 0 : env->GetArrayLength((jarray) array);
+    lengths[depth].push_back(len);
+    shape[depth] = std::max(shape[depth], len);
+    if (depth + 1 == rank) { return; }
+    for (jsize i = 0; i < len; i++) {
+        jobject row = env->GetObjectArrayElement((jobjectArray) array, i);
+        ndShape(row, depth + 1, rank, shape, lengths);
+        env->DeleteLocalRef(row);
+    }
+}
+
+// Second pass: rows copied with region access at their padded offset
+template <typename T> static void ndCopy(jobject array, int depth, std::size_t offset, NDArray<T>& nd) {
+    if (array == NULL) { return; }
+    jsize len = env->GetArrayLength((jarray) array);
+    if (depth + 1 == nd.rank()) {
+        typedef typename JavaArrayOf<T>::type Array;
+        if (len > 0) { JavaArray<Array>::getRegion((Array) array, 0, len, &nd.data[offset]); }
+        return;
+    }
+    for (jsize i = 0; i < len; i++) {
+        jobject row = env->GetObjectArrayElement((jobjectArray) array, i);
+        ndCopy(row, depth + 1, offset + i * nd.strides[depth], nd);
+        env->DeleteLocalRef(row);
+    }
+}
+
+template <typename T> NDArray<T> Converter::c_cast_ndarray(jobjectArray x, bool flattenInJava) {
+    typedef typename JavaArrayOf<T>::type Array;
+    char code;
+    int rank = arrayRank(x, code);
+    if (rank < 2 || code != JavaArray<Array>::code()) {
+        throw HandlerExc(std::string("CJay: Not an N-dimensional array of ") + JavaArray<Array>::code() + ".");
+    }
+
+    NDArray<T> nd;
+    if (flattenInJava) {
+        jintArray jshape = (jintArray) env->CallStaticObjectMethod(UTIL.getClass(), UTIL.getSignatureObj("shapeOf")->mid, x, (jint) rank);
+        checkJavaException();
+        if (jshape != NULL) { // rectangular
+            nd.reshape(this->c_cast_array<jint>(jshape));
+            Array flat = (Array) env->CallStaticObjectMethod(UTIL.getClass(), UTIL.getSignatureObj("flatten")->mid, x, jshape);
+            env->DeleteLocalRef(jshape);
+            checkJavaException(); // e.g. ArithmeticException: more than 2^31-1 elements
+            if (!nd.data.empty()) { JavaArray<Array>::getRegion(flat, 0, (jsize) nd.data.size(), &nd.data[0]); }
+            env->DeleteLocalRef(flat);
+            return nd;
+        }
+    }
+
+    std::vector<jsize> shape(rank, 0);
+    std::vector<std::vector<jsize> > lengths(rank);
+    ndShape(x, 0, rank, shape, lengths);
+    nd.reshape(shape);
+    for (int d = 0; d < rank; d++) {
+        for (jsize len : lengths[d]) {
+            if (len != shape[d]) { nd.lengths.swap(lengths); break; }
+        }
+        if (nd.isJagged()) { break; }
+    }
+    ndCopy(x, 0, 0, nd);
+    return nd;
+}
+
+template <typename T> static jobject ndBuild(const NDArray<T>& nd, int depth, std::size_t offset,
+        std::vector<std::size_t>& cursor, const std::vector<jclass>& classes) {
+    jsize len = nd.isJagged() ? nd.lengths[depth].at(cursor[depth]++) : nd.shape[depth];
+    if (depth + 1 == nd.rank()) {
+        typedef typename JavaArrayOf<T>::type Array;
+        Array row = JavaArray<Array>::newArray(len);
+        if (len > 0) { JavaArray<Array>::setRegion(row, 0, len, &nd.data[offset]); }
+        return row;
+    }
+    jobjectArray array = env->NewObjectArray(len, classes[depth + 1], NULL);
+    for (jsize i = 0; i < len; i++) {
+        jobject row = ndBuild(nd, depth + 1, offset + i * nd.strides[depth], cursor, classes);
+        env->SetObjectArrayElement(array, i, row);
+        env->DeleteLocalRef(row);
+    }
+    return array;
+}
+
+template <typename T> jobjectArray Converter::j_cast_ndarray(const NDArray<T>& nd) {
+    typedef typename JavaArrayOf<T>::type Array;
+    int rank = nd.rank();
+    if (rank < 2 || nd.strides.size() != nd.shape.size() || nd.data.size() != nd.strides[0] * nd.shape[0]
+            || (nd.isJagged() && (int) nd.lengths.size() != rank)) {
+        throw HandlerExc("CJay: Inconsistent NDArray. Use NDArray::reshape to set shape and strides.");
+    }
+    std::vector<jclass> classes(rank); // classes[d]: type of the arrays at depth d
+    for (int d = 0; d < rank; d++) {
+        classes[d] = env->FindClass((std::string(rank - d, '[') + JavaArray<Array>::code()).c_str());
+    }
+    std::vector<std::size_t> cursor(rank, 0);
+    jobjectArray array = (jobjectArray) ndBuild(nd, 0, 0, cursor, classes);
+    for (int d = 0; d < rank; d++) { env->DeleteLocalRef(classes[d]); }
+    return array;
+}
+
+template NDArray<jboolean> Converter::c_cast_ndarray(jobjectArray, bool);
+template NDArray<jbyte> Converter::c_cast_ndarray(jobjectArray, bool);
+template NDArray<jchar> Converter::c_cast_ndarray(jobjectArray, bool);
+template NDArray<jshort> Converter::c_cast_ndarray(jobjectArray, bool);
+template NDArray<jint> Converter::c_cast_ndarray(jobjectArray, bool);
+template NDArray<jlong> Converter::c_cast_ndarray(jobjectArray, bool);
+template NDArray<jfloat> Converter::c_cast_ndarray(jobjectArray, bool);
+template NDArray<jdouble> Converter::c_cast_ndarray(jobjectArray, bool);
+
+template jobjectArray Converter::j_cast_ndarray(const NDArray<jboolean>&);
+template jobjectArray Converter::j_cast_ndarray(const NDArray<jbyte>&);
+template jobjectArray Converter::j_cast_ndarray(const NDArray<jchar>&);
+template jobjectArray Converter::j_cast_ndarray(const NDArray<jshort>&);
+template jobjectArray Converter::j_cast_ndarray(const NDArray<jint>&);
+template jobjectArray Converter::j_cast_ndarray(const NDArray<jlong>&);
+template jobjectArray Converter::j_cast_ndarray(const NDArray<jfloat>&);
+template jobjectArray Converter::j_cast_ndarray(const NDArray<jdouble>&);
+
+template <typename T> PooledArray<typename JavaArrayOf<T>::type> Converter::j_cast_pooled(const T* x, jsize n) {
+    typedef typename JavaArrayOf<T>::type Array;
+    PooledArray<Array> pooled = ArrayPool<Array>::instance().acquire(n);
+    if (n > 0) { JavaArray<Array>::setRegion(pooled.get(), 0, n, x); }
+    return pooled;
+}
+
+template <typename T> PooledArray<typename JavaArrayOf<T>::type> Converter::j_cast_pooled(const std::vector<T>& x) {
+    return this->j_cast_pooled(x.data(), (jsize) x.size());
+}
+
+template PooledArray<jbooleanArray> Converter::j_cast_pooled(const jboolean*, jsize);
+template PooledArray<jbyteArray> Converter::j_cast_pooled(const jbyte*, jsize);
+template PooledArray<jcharArray> Converter::j_cast_pooled(const jchar*, jsize);
+template PooledArray<jshortArray> Converter::j_cast_pooled(const jshort*, jsize);
+template PooledArray<jintArray> Converter::j_cast_pooled(const jint*, jsize);
+template PooledArray<jlongArray> Converter::j_cast_pooled(const jlong*, jsize);
+template PooledArray<jfloatArray> Converter::j_cast_pooled(const jfloat*, jsize);
+template PooledArray<jdoubleArray> Converter::j_cast_pooled(const jdouble*, jsize);
+
+template PooledArray<jbooleanArray> Converter::j_cast_pooled(const std::vector<jboolean>&);
+template PooledArray<jbyteArray> Converter::j_cast_pooled(const std::vector<jbyte>&);
+template PooledArray<jcharArray> Converter::j_cast_pooled(const std::vector<jchar>&);
+template PooledArray<jshortArray> Converter::j_cast_pooled(const std::vector<jshort>&);
+template PooledArray<jintArray> Converter::j_cast_pooled(const std::vector<jint>&);
+template PooledArray<jlongArray> Converter::j_cast_pooled(const std::vector<jlong>&);
+template PooledArray<jfloatArray> Converter::j_cast_pooled(const std::vector<jfloat>&);
+template PooledArray<jdoubleArray> Converter::j_cast_pooled(const std::vector<jdouble>&);
+
+static CJ* recordBatchClass = NULL;
+static std::once_flag recordBatchOnce;
+
+static CJ& recordBatchBinding() {
+    std::call_once(recordBatchOnce, []() {
+        recordBatchClass = new CJ(); // lives as long as the library
+        recordBatchClass->setClass("cjay/converter/RecordBatch");
+    });
+    return *recordBatchClass;
+}
+
+RecordBatch Converter::c_cast_batch(jobject x) {
+    CJ& binding = recordBatchBinding();
+    jobject buffer = x;
+    if (x != NULL && env->IsInstanceOf(x, binding.getClass())) {
+        buffer = env->CallObjectMethod(x, binding.getSignatureObj("buffer")->mid);
+        checkJavaException();
+    }
+    void* address = (buffer != NULL) ? env->GetDirectBufferAddress(buffer) : NULL;
+    jlong capacity = (buffer != NULL) ? env->GetDirectBufferCapacity(buffer) : -1;
+    if (address == NULL || capacity < 0) {
+        if (buffer != x) { env->DeleteLocalRef(buffer); }
+        throw HandlerExc("CJay: Neither a cjay.converter.RecordBatch nor a direct ByteBuffer.");
+    }
+    try {
+        RecordBatch batch(address, (std::size_t) capacity, buffer);
+        if (buffer != x) { env->DeleteLocalRef(buffer); }
+        return batch;
+    } catch (...) {
+        if (buffer != x) { env->DeleteLocalRef(buffer); }
+        throw;
+    }
+}
+
+jobject Converter::j_cast_batch(const RecordBatch& batch) {
+    if (batch.data() == NULL) {
+        throw HandlerExc("CJay: Empty record batch.");
+    }
+    CJ& binding = recordBatchBinding();
+    jobject buffer = (batch.getBuffer() != NULL) ? env->NewLocalRef(batch.getBuffer())
+        : env->NewDirectByteBuffer(const_cast<void*>(batch.data()), (jlong) batch.byteSize());
+    jobject rtn = env->NewObject(binding.getClass(), binding.getMid("<init>"), buffer);
+    env->DeleteLocalRef(buffer);
+    checkJavaException();
+    return rtn;
+}
+
+static CJ* packerClass = NULL;
+static std::once_flag packerOnce;
+
+std::vector<char> Converter::packNested(jobject x) {
+    std::call_once(packerOnce, []() {
+        packerClass = new CJ(); // lives as long as the library
+        packerClass->setClass("cjay/converter/Packer");
+    });
+    jbyteArray packed = (jbyteArray) env->CallStaticObjectMethod(packerClass->getClass(), packerClass->getSignatureObj("pack")->mid, x);
+    checkJavaException();
+    std::vector<char> bytes(env->GetArrayLength(packed));
+    if (!bytes.empty()) { env->GetByteArrayRegion(packed, 0, (jsize) bytes.size(), (jbyte*) &bytes[0]); } // single copy
+    env->DeleteLocalRef(packed);
+    return bytes;
+}
+
+jobjectArray Converter::toObjectArray(jobject x) {
+    jobjectArray rtn = (jobjectArray) env->CallStaticObjectMethod(UTIL.getClass(), UTIL.getSignatureObj("toArray")->mid, x);
+    checkJavaException();
+    return rtn;
+}
+
+jobjectArray Converter::mapEntries(jobject x) {
+    jobjectArray rtn = (jobjectArray) env->CallStaticObjectMethod(UTIL.getClass(), UTIL.getSignatureObj("entries")->mid, x);
+    checkJavaException();
+    return rtn;
+}
+
+jobjectArray Converter::newObjectArray(jsize n) {
+    return env->NewObjectArray(n, this->arrayClass('L'), NULL);
+}
+
+jobject Converter::newList(jobjectArray elements) {
+    jobject rtn = env->CallStaticObjectMethod(UTIL.getClass(), UTIL.getSignatureObj("listOf")->mid, elements);
+    checkJavaException();
+    return rtn;
+}
+
+jobject Converter::newMap(jobjectArray keysAndValues) {
+    jobject rtn = env->CallStaticObjectMethod(UTIL.getClass(), UTIL.getSignatureObj("mapOf")->mid, keysAndValues);
+    checkJavaException();
+    return rtn;
+}
+
+// Class of the primitive array of a JNI code, or java/lang/Object (the
+// element class of Object[]) for 'L'
+jclass Converter::arrayClass(char code) {
+    static const char codes[] = "LZBCSIJFD";
+    const char* at = std::strchr(codes, code);
+    if (code == '\0' || at == NULL) {
+        throw HandlerExc(std::string("CJay: No array class for ") + code + ".");
+    }
+    jclass& clazz = this->arrayClasses[at - codes];
+    if (clazz == NULL) {
+        jclass local = env->FindClass((code == 'L') ? "java/lang/Object" : (std::string("[") + code).c_str());
+        clazz = (jclass) env->NewGlobalRef(local);
+        env->DeleteLocalRef(local);
+    }
+    return clazz;
+}
+
+int Converter::sizeVector(jobject jobj) {
+    VM::SignatureBase* sig = ARRAYLIST.getSignatureObj("size");
+
+    return env->CallIntMethod(jobj, sig->mid, NULL);
+}
+
+int Converter::sizeMap(jobject jobj) {
+    VM::SignatureBase* sig = MAP.getSignatureObj("size");
+
+    return env->CallIntMethod(jobj, sig->mid, NULL);
+}
+
+template <typename To> std::vector<To> Converter::c_cast_vector(jobject jobj, int size) {
+#ifdef CJAY_TRACING
+    TraceSpan span("c_cast_vector", "convert", Tracer::tracingCalls());
+#endif
     jmethodID mid = ARRAYLIST.getSignatureObj("get")->mid;
     jobject e;
     std::vector<To> v;
+    v.reserve(size);
 
     for (int i = 0 ; i < size ; i++) {
         e = env->CallObjectMethod(jobj, mid, (jint) i); // get element
         v.push_back( this->c_cast<To>(e) ); // convert to primitive
+        if (!std::is_same<To, jobject>::value) { env->DeleteLocalRef(e); }
     }
 
     return v;
@@ -1084,6 +3642,171 @@ template std::vector<jchar> Converter::c_cast_vector(jobject);
 template std::vector<jobject> Converter::c_cast_vector(jobject);
 template std::vector<std::string> Converter::c_cast_vector(jobject);
 
+jobject Converter::getIterator(jobject jobj) {
+    jmethodID mid = UTIL.getSignatureObj("toIterator")->mid;
+    jobject iterator = env->CallStaticObjectMethod(UTIL.getClass(), mid, jobj);
+    if (env->ExceptionCheck()) {
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+        throw HandlerExc("CJay: Object is neither a java.lang.Iterable nor a java.util.Iterator.");
+    }
+    return iterator;
+}
+
+template <typename To> jobject Converter::newRangeBuffer(jsize size) {
+    jclass OBJECT = env->FindClass("java/lang/Object");
+    jobject local = env->NewObjectArray(size, OBJECT, NULL);
+    jobject buffer = env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    env->DeleteLocalRef(OBJECT);
+    return buffer;
+}
+
+template <typename To> jsize Converter::fillRange(jobject iterator, jobject buffer, std::vector<To>& out) {
+    jmethodID mid = UTIL.getSignatureObj("fillObjects")->mid;
+    jsize n = env->CallStaticIntMethod(UTIL.getClass(), mid, iterator, buffer);
+    checkJavaException(); // thrown by the iterator: n is meaningless
+    for (jsize i = 0; i < n; i++) {
+        jobject e = env->GetObjectArrayElement((jobjectArray) buffer, i);
+        out.push_back(this->c_cast<To>(e));
+        if (!std::is_same<To, jobject>::value) { env->DeleteLocalRef(e); }
+    }
+    return n;
+}
+
+template jobject Converter::newRangeBuffer<jobject>(jsize);
+template jobject Converter::newRangeBuffer<std::string>(jsize);
+template jsize Converter::fillRange(jobject, jobject, std::vector<jobject>&);
+template jsize Converter::fillRange(jobject, jobject, std::vector<std::string>&);
+
+template <> jobject Converter::newRangeBuffer<jboolean>(jsize size) {
+    jobject local = env->NewBooleanArray(size);
+    jobject buffer = env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    return buffer;
+}
+
+template <> jsize Converter::fillRange(jobject iterator, jobject buffer, std::vector<jboolean>& out) {
+    jmethodID mid = UTIL.getSignatureObj("fillBooleans")->mid;
+    jsize n = env->CallStaticIntMethod(UTIL.getClass(), mid, iterator, buffer);
+    checkJavaException();
+    out.resize(n);
+    if (n > 0) { env->GetBooleanArrayRegion((jbooleanArray) buffer, 0, n, &out[0]); }
+    return n;
+}
+
+template <> jobject Converter::newRangeBuffer<jbyte>(jsize size) {
+    jobject local = env->NewByteArray(size);
+    jobject buffer = env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    return buffer;
+}
+
+template <> jsize Converter::fillRange(jobject iterator, jobject buffer, std::vector<jbyte>& out) {
+    jmethodID mid = UTIL.getSignatureObj("fillBytes")->mid;
+    jsize n = env->CallStaticIntMethod(UTIL.getClass(), mid, iterator, buffer);
+    checkJavaException();
+    out.resize(n);
+    if (n > 0) { env->GetByteArrayRegion((jbyteArray) buffer, 0, n, &out[0]); }
+    return n;
+}
+
+template <> jobject Converter::newRangeBuffer<jchar>(jsize size) {
+    jobject local = env->NewCharArray(size);
+    jobject buffer = env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    return buffer;
+}
+
+template <> jsize Converter::fillRange(jobject iterator, jobject buffer, std::vector<jchar>& out) {
+    jmethodID mid = UTIL.getSignatureObj("fillChars")->mid;
+    jsize n = env->CallStaticIntMethod(UTIL.getClass(), mid, iterator, buffer);
+    checkJavaException();
+    out.resize(n);
+    if (n > 0) { env->GetCharArrayRegion((jcharArray) buffer, 0, n, &out[0]); }
+    return n;
+}
+
+template <> jobject Converter::newRangeBuffer<jshort>(jsize size) {
+    jobject local = env->NewShortArray(size);
+    jobject buffer = env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    return buffer;
+}
+
+template <> jsize Converter::fillRange(jobject iterator, jobject buffer, std::vector<jshort>& out) {
+    jmethodID mid = UTIL.getSignatureObj("fillShorts")->mid;
+    jsize n = env->CallStaticIntMethod(UTIL.getClass(), mid, iterator, buffer);
+    checkJavaException();
+    out.resize(n);
+    if (n > 0) { env->GetShortArrayRegion((jshortArray) buffer, 0, n, &out[0]); }
+    return n;
+}
+
+template <> jobject Converter::newRangeBuffer<jint>(jsize size) {
+    jobject local = env->NewIntArray(size);
+    jobject buffer = env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    return buffer;
+}
+
+template <> jsize Converter::fillRange(jobject iterator, jobject buffer, std::vector<jint>& out) {
+    jmethodID mid = UTIL.getSignatureObj("fillInts")->mid;
+    jsize n = env->CallStaticIntMethod(UTIL.getClass(), mid, iterator, buffer);
+    checkJavaException();
+    out.resize(n);
+    if (n > 0) { env->GetIntArrayRegion((jintArray) buffer, 0, n, &out[0]); }
+    return n;
+}
+
+template <> jobject Converter::newRangeBuffer<jlong>(jsize size) {
+    jobject local = env->NewLongArray(size);
+    jobject buffer = env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    return buffer;
+}
+
+template <> jsize Converter::fillRange(jobject iterator, jobject buffer, std::vector<jlong>& out) {
+    jmethodID mid = UTIL.getSignatureObj("fillLongs")->mid;
+    jsize n = env->CallStaticIntMethod(UTIL.getClass(), mid, iterator, buffer);
+    checkJavaException();
+    out.resize(n);
+    if (n > 0) { env->GetLongArrayRegion((jlongArray) buffer, 0, n, &out[0]); }
+    return n;
+}
+
+template <> jobject Converter::newRangeBuffer<jfloat>(jsize size) {
+    jobject local = env->NewFloatArray(size);
+    jobject buffer = env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    return buffer;
+}
+
+template <> jsize Converter::fillRange(jobject iterator, jobject buffer, std::vector<jfloat>& out) {
+    jmethodID mid = UTIL.getSignatureObj("fillFloats")->mid;
+    jsize n = env->CallStaticIntMethod(UTIL.getClass(), mid, iterator, buffer);
+    checkJavaException();
+    out.resize(n);
+    if (n > 0) { env->GetFloatArrayRegion((jfloatArray) buffer, 0, n, &out[0]); }
+    return n;
+}
+
+template <> jobject Converter::newRangeBuffer<jdouble>(jsize size) {
+    jobject local = env->NewDoubleArray(size);
+    jobject buffer = env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    return buffer;
+}
+
+template <> jsize Converter::fillRange(jobject iterator, jobject buffer, std::vector<jdouble>& out) {
+    jmethodID mid = UTIL.getSignatureObj("fillDoubles")->mid;
+    jsize n = env->CallStaticIntMethod(UTIL.getClass(), mid, iterator, buffer);
+    checkJavaException();
+    out.resize(n);
+    if (n > 0) { env->GetDoubleArrayRegion((jdoubleArray) buffer, 0, n, &out[0]); }
+    return n;
+}
+
 jobject Converter::getKeysOfMap(jobject jmap) {
     jmethodID mid = UTIL.getSignatureObj("FromMapToArrayListOfKeys")->mid;
     jobject arrayListOfKeys = env->CallStaticObjectMethod(UTIL.getClass(), mid, jmap);
@@ -1099,6 +3822,9 @@ jobject Converter::getValuesOfMap(jobject jmap) {
 }
 
 template <typename K, typename V> std::map<K, V> Converter::c_cast_map(jobject jmap) {
+#ifdef CJAY_TRACING
+    TraceSpan span("c_cast_map", "convert", Tracer::tracingCalls());
+#endif
     std::map<K, V> cmap;
     std::vector<K> vKeys = this->c_cast_vector<K>(this->getKeysOfMap(jmap));
     std::vector<V> vValues = this->c_cast_vector<V>(this->getValuesOfMap(jmap));
@@ -1236,6 +3962,1127 @@ void Converter::deleteRef(jobject jobj) {
     env->DeleteLocalRef(jobj);
 }
 
+/**
+ ** CallExecutor implementation
+ **/
+CallExecutor::CallExecutor(std::size_t nThreads, std::size_t capacity) :
+    capacity(capacity), pending(0), nextWorker(0), blockedSubmitters(0), stopping(false) {
+    if (nThreads == 0 || capacity == 0) {
+        throw HandlerExc("CJay: CallExecutor needs at least one thread and a non-empty queue.");
+    }
+    if (jvm == NULL) {
+        throw HandlerExc("CJay: No Java Virtual Machine instance. Please, call VM::createVM beforehand.");
+    }
+    for (std::size_t i = 0; i < nThreads; i++) {
+        this->workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+    for (std::size_t i = 0; i < nThreads; i++) {
+        this->threads.push_back(std::thread(&CallExecutor::workerLoop, this, i));
+    }
+}
+
+CallExecutor::~CallExecutor() {
+    {
+        std::lock_guard<std::mutex> lock(this->stateMutex);
+        this->stopping = true;
+    }
+    this->hasWork.notify_all();
+    this->hasRoom.notify_all();
+    for (auto& t : this->threads) { t.join(); } // queued calls are drained first
+}
+
+std::size_t CallExecutor::size() {
+    return this->workers.size();
+}
+
+std::size_t CallExecutor::queued() {
+    return this->pending.load();
+}
+
+void CallExecutor::guard(const std::function<void()>& fn) {
+    env->PushLocalFrame(16);
+    try {
+        fn();
+    } catch (std::exception& exc) {
+        std::cerr << "CJay: Uncaught exception in executor callback: " << exc.what() << std::endl;
+    } catch (...) {
+        std::cerr << "CJay: Uncaught exception in executor callback" << std::endl;
+    }
+    if (env->ExceptionCheck()) {
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+    }
+    env->PopLocalFrame(NULL);
+}
+
+void CallExecutor::post(std::function<void()> fn) {
+    Task task;
+    task.run = [fn]() { guard(fn); };
+    task.expire = task.run;
+    task.deadline = noDeadline();
+    this->push(task, true);
+}
+
+bool CallExecutor::push(Task& task, bool block) {
+    std::size_t n = this->workers.size();
+    while (true) {
+        if (this->stopping) {
+            throw HandlerExc("CJay: CallExecutor is shutting down.");
+        }
+        // round-robin, skipping full queues
+        std::size_t first = this->nextWorker.fetch_add(1, std::memory_order_relaxed);
+        for (std::size_t k = 0; k < n; k++) {
+            Worker& w = *this->workers[(first + k) % n];
+            std::lock_guard<std::mutex> lock(w.mutex);
+            if (w.queue.size() < this->capacity) {
+                w.queue.push_back(std::move(task));
+                this->pending++;
+                {
+                    std::lock_guard<std::mutex> state(this->stateMutex);
+                }
+                this->hasWork.notify_one();
+                return true;
+            }
+        }
+        if (!block) { return false; }
+        // backpressure: wait until a worker takes something off a queue
+        std::unique_lock<std::mutex> state(this->stateMutex);
+        this->blockedSubmitters++;
+        this->hasRoom.wait(state, [this, n]() {
+            return this->stopping || this->pending < this->capacity * n;
+        });
+        this->blockedSubmitters--;
+    }
+}
+
+bool CallExecutor::pop(std::size_t self, Task& task) {
+    std::size_t n = this->workers.size();
+    for (std::size_t k = 0; k < n; k++) {
+        Worker& w = *this->workers[(self + k) % n];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (w.queue.empty()) { continue; }
+        if (k == 0) { // own queue: FIFO
+            task = std::move(w.queue.front());
+            w.queue.pop_front();
+        } else { // steal the most recently queued call of another worker
+            task = std::move(w.queue.back());
+            w.queue.pop_back();
+        }
+        this->pending--;
+        return true;
+    }
+    return false;
+}
+
+void CallExecutor::workerLoop(std::size_t self) {
+    std::ostringstream name;
+    name << "cjay-executor-" << self;
+    attachCurrentThread(name.str(), true);
+
+    Task task;
+    while (true) {
+        if (this->pop(self, task)) {
+            if (this->blockedSubmitters > 0) {
+                std::lock_guard<std::mutex> state(this->stateMutex);
+                this->hasRoom.notify_one();
+            }
+            if (std::chrono::steady_clock::now() > task.deadline) {
+                task.expire();
+            } else {
+                task.run();
+            }
+            task = Task();
+            continue;
+        }
+        std::unique_lock<std::mutex> state(this->stateMutex);
+        if (this->stopping && this->pending == 0) { break; }
+        this->hasWork.wait(state, [this]() { return this->stopping || this->pending > 0; });
+    }
+    detachCurrentThread();
+}
+
+/**
+ ** JavaCompletion implementation
+ **/
+static CJ* nativeCompletion = NULL;
+static jmethodID midThrowableToString = NULL;
+static std::once_flag nativeCompletionOnce;
+
+static void JNICALL nativeComplete(JNIEnv* e, jclass, jlong handle, jobject value, jthrowable error) {
+    if (env == NULL) { env = e; } // Java thread unknown to CJay so far
+
+    JavaCompletion::Callback* callback = reinterpret_cast<JavaCompletion::Callback*>(handle);
+    if (callback == NULL) { return; }
+    jobject result = (value == NULL) ? NULL : env->NewGlobalRef(value);
+    std::string message;
+    if (error != NULL) {
+        jobject str = env->CallObjectMethod(error, midThrowableToString);
+        if (env->ExceptionCheck()) { env->ExceptionClear(); }
+        // the callback still runs, with the class name only, if the text cannot be read
+        message = "java.lang.Throwable";
+        try {
+            if (str != NULL) { message = FromJavaObjectToCpp<std::string>(str); }
+        } catch (...) {
+            if (env->ExceptionCheck()) { env->ExceptionClear(); }
+        }
+        if (str != NULL) { env->DeleteLocalRef(str); }
+    }
+    // a C++ exception must not unwind into the JVM
+    try {
+        (*callback)(result, message);
+    } catch (std::exception& exc) {
+        std::cerr << "CJay: Uncaught exception in completion callback: " << exc.what() << std::endl;
+    } catch (...) {
+        std::cerr << "CJay: Uncaught exception in completion callback" << std::endl;
+    }
+    delete callback;
+}
+
+void JavaCompletion::listen(jobject stage, Callback callback) {
+    std::call_once(nativeCompletionOnce, []() {
+        nativeCompletion = new CJ(); // lives as long as the library
+        nativeCompletion->setClass("cjay/concurrent/NativeCompletion");
+
+        JNINativeMethod method;
+        method.name = const_cast<char*>("complete");
+        method.signature = const_cast<char*>("(JLjava/lang/Object;Ljava/lang/Throwable;)V");
+        method.fnPtr = (void*) &nativeComplete;
+        if (env->RegisterNatives(nativeCompletion->getClass(), &method, 1) != JNI_OK) {
+            throw HandlerExc("JNI: Unable to register natives of cjay/concurrent/NativeCompletion.");
+        }
+
+        jclass THROWABLE = env->FindClass("java/lang/Throwable");
+        midThrowableToString = env->GetMethodID(THROWABLE, "toString", "()Ljava/lang/String;");
+        env->DeleteLocalRef(THROWABLE);
+    });
+
+    // Ownership of the callback passes to nativeComplete
+    Callback* handle = new Callback(callback);
+    nativeCompletion->call<void>("listen", stage, (jlong) reinterpret_cast<intptr_t>(handle));
+    if (env->ExceptionCheck()) {
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+        delete handle;
+        throw HandlerExc("JNI: Unable to listen to completion. Is the object a java.util.concurrent.CompletionStage?");
+    }
+}
+
+/**
+ ** NativeSink implementation
+ **/
+static CJ* nativeSinkClass = NULL;
+static std::once_flag nativeSinkOnce;
+// Live sinks by handle. Handles are never reused, so a push racing the
+// destructor of its sink finds nothing instead of freed memory.
+static std::mutex nativeSinksMutex;
+static std::condition_variable nativeSinksIdle;
+static std::unordered_map<jlong, NativeSink*> nativeSinks;
+static jlong nativeSinkHandles = 0;
+
+// Turns a C++ exception thrown by a handler into a Java RuntimeException
+inline void throwToJava(JNIEnv* e, const char* message) {
+    jclass RUNTIMEEXCEPTION = e->FindClass("java/lang/RuntimeException");
+    e->ThrowNew(RUNTIMEEXCEPTION, message);
+    e->DeleteLocalRef(RUNTIMEEXCEPTION);
+}
+
+// Runs a handler: no C++ exception may unwind into the JVM
+template <typename F> inline void runHandler(JNIEnv* e, F f) {
+    try {
+        f();
+    } catch (std::exception& exc) {
+        throwToJava(e, exc.what());
+    } catch (...) {
+        throwToJava(e, "NativeSink handler threw a non-standard C++ exception");
+    }
+}
+
+struct NativeSinkDispatch {
+    // The live sink of a handle, counted in flight until release
+    static NativeSink* acquire(JNIEnv* e, jlong handle) {
+        if (env == NULL) { env = e; } // Java thread unknown to CJay so far
+        {
+            std::lock_guard<std::mutex> lock(nativeSinksMutex);
+            std::unordered_map<jlong, NativeSink*>::iterator it = nativeSinks.find(handle);
+            if (it != nativeSinks.end()) {
+                it->second->inFlight++;
+                return it->second;
+            }
+        }
+        jclass ILLEGALSTATE = e->FindClass("java/lang/IllegalStateException");
+        e->ThrowNew(ILLEGALSTATE, "NativeSink was destroyed on the C++ side");
+        e->DeleteLocalRef(ILLEGALSTATE);
+        return NULL;
+    }
+
+    static void release(NativeSink* sink) {
+        std::lock_guard<std::mutex> lock(nativeSinksMutex);
+        if (--sink->inFlight == 0) { nativeSinksIdle.notify_all(); }
+    }
+
+    // Keeps the sink alive until the push returns
+    struct Pin {
+        NativeSink* sink;
+        Pin(JNIEnv* e, jlong handle) : sink(NativeSinkDispatch::acquire(e, handle)) { }
+        ~Pin() { if (this->sink != NULL) { NativeSinkDispatch::release(this->sink); } }
+    };
+
+    static bool inBounds(JNIEnv* e, jlong offset, jlong length, jlong size) {
+        if (offset >= 0 && length >= 0 && offset + length <= size) { return true; }
+        jclass OUTOFBOUNDS = e->FindClass("java/lang/IndexOutOfBoundsException");
+        e->ThrowNew(OUTOFBOUNDS, "NativeSink slice out of bounds");
+        e->DeleteLocalRef(OUTOFBOUNDS);
+        return false;
+    }
+
+    static bool notNull(JNIEnv* e, jobject x) {
+        if (x != NULL) { return true; }
+        jclass NULLPOINTER = e->FindClass("java/lang/NullPointerException");
+        e->ThrowNew(NULLPOINTER, "NativeSink cannot push null");
+        e->DeleteLocalRef(NULLPOINTER);
+        return false;
+    }
+
+    template <typename T> static void JNICALL pushValue(JNIEnv* e, jclass, jlong handle, T x) {
+        Pin pin(e, handle);
+        NativeSink* sink = pin.sink;
+        if (sink == NULL || !sink->valueHandler<T>()) { return; }
+        runHandler(e, [&]() { sink->valueHandler<T>()(x); });
+    }
+
+    // The slice is copied out first, so that the handler runs outside of any
+    // critical region and may call JNI, block or throw
+    template <typename T> static void JNICALL pushArray(JNIEnv* e, jclass, jlong handle, jarray x, jint offset, jint length) {
+        typedef typename JavaArrayOf<T>::type Array;
+        Pin pin(e, handle);
+        NativeSink* sink = pin.sink;
+        if (sink == NULL || !sink->arrayHandler<T>() || !notNull(e, x)) { return; }
+        // The natives are public to JNI: never size the copy from unchecked arguments
+        if (!inBounds(e, offset, length, e->GetArrayLength(x))) { return; }
+        std::vector<T> data(length);
+        if (length > 0) { JavaArray<Array>::getRegion((Array) x, offset, length, &data[0]); }
+        if (e->ExceptionCheck()) { return; }
+        runHandler(e, [&]() { sink->arrayHandler<T>()(data.data(), length); });
+    }
+
+    static void JNICALL pushString(JNIEnv* e, jclass, jlong handle, jstring x) {
+        Pin pin(e, handle);
+        NativeSink* sink = pin.sink;
+        if (sink == NULL || !sink->stringHandler || !notNull(e, x)) { return; }
+        runHandler(e, [&]() { sink->stringHandler(FromJavaObjectToCpp<std::string>(x)); });
+    }
+
+    static void JNICALL pushBuffer(JNIEnv* e, jclass, jlong handle, jobject x, jint position, jint remaining) {
+        Pin pin(e, handle);
+        NativeSink* sink = pin.sink;
+        if (sink == NULL || !sink->bufferHandler || !notNull(e, x)) { return; }
+        char* address = static_cast<char*>(e->GetDirectBufferAddress(x));
+        if (address == NULL) {
+            jclass ILLEGALARGUMENT = e->FindClass("java/lang/IllegalArgumentException");
+            e->ThrowNew(ILLEGALARGUMENT, "NativeSink accepts direct buffers only");
+            e->DeleteLocalRef(ILLEGALARGUMENT);
+            return;
+        }
+        if (!inBounds(e, position, remaining, e->GetDirectBufferCapacity(x))) { return; }
+        runHandler(e, [&]() { sink->bufferHandler(address + position, remaining); });
+    }
+
+    static void JNICALL pushObject(JNIEnv* e, jclass, jlong handle, jobject x) {
+        Pin pin(e, handle);
+        NativeSink* sink = pin.sink;
+        if (sink == NULL || !sink->objectHandler) { return; }
+        runHandler(e, [&]() { sink->objectHandler(x); });
+    }
+
+    static void JNICALL closeSink(JNIEnv* e, jclass, jlong handle) {
+        Pin pin(e, handle);
+        NativeSink* sink = pin.sink;
+        if (sink == NULL || !sink->closeHandler) { return; }
+        runHandler(e, [&]() { sink->closeHandler(); });
+    }
+};
+
+static JNINativeMethod nativeSinkMethod(const char* name, const char* signature, void* fnPtr) {
+    JNINativeMethod method;
+    method.name = const_cast<char*>(name);
+    method.signature = const_cast<char*>(signature);
+    method.fnPtr = fnPtr;
+    return method;
+}
+
+NativeSink::NativeSink() : sink(NULL), handle(0), inFlight(0) {
+    std::call_once(nativeSinkOnce, []() {
+        nativeSinkClass = new CJ(); // lives as long as the library
+        nativeSinkClass->setClass("cjay/callback/NativeSink");
+
+        JNINativeMethod methods[] = {
+            nativeSinkMethod("pushBoolean", "(JZ)V", (void*) &NativeSinkDispatch::pushValue<jboolean>),
+            nativeSinkMethod("pushByte", "(JB)V", (void*) &NativeSinkDispatch::pushValue<jbyte>),
+            nativeSinkMethod("pushChar", "(JC)V", (void*) &NativeSinkDispatch::pushValue<jchar>),
+            nativeSinkMethod("pushShort", "(JS)V", (void*) &NativeSinkDispatch::pushValue<jshort>),
+            nativeSinkMethod("pushInt", "(JI)V", (void*) &NativeSinkDispatch::pushValue<jint>),
+            nativeSinkMethod("pushLong", "(JJ)V", (void*) &NativeSinkDispatch::pushValue<jlong>),
+            nativeSinkMethod("pushFloat", "(JF)V", (void*) &NativeSinkDispatch::pushValue<jfloat>),
+            nativeSinkMethod("pushDouble", "(JD)V", (void*) &NativeSinkDispatch::pushValue<jdouble>),
+            nativeSinkMethod("pushBooleanArray", "(J[ZII)V", (void*) &NativeSinkDispatch::pushArray<jboolean>),
+            nativeSinkMethod("pushByteArray", "(J[BII)V", (void*) &NativeSinkDispatch::pushArray<jbyte>),
+            nativeSinkMethod("pushCharArray", "(J[CII)V", (void*) &NativeSinkDispatch::pushArray<jchar>),
+            nativeSinkMethod("pushShortArray", "(J[SII)V", (void*) &NativeSinkDispatch::pushArray<jshort>),
+            nativeSinkMethod("pushIntArray", "(J[III)V", (void*) &NativeSinkDispatch::pushArray<jint>),
+            nativeSinkMethod("pushLongArray", "(J[JII)V", (void*) &NativeSinkDispatch::pushArray<jlong>),
+            nativeSinkMethod("pushFloatArray", "(J[FII)V", (void*) &NativeSinkDispatch::pushArray<jfloat>),
+            nativeSinkMethod("pushDoubleArray", "(J[DII)V", (void*) &NativeSinkDispatch::pushArray<jdouble>),
+            nativeSinkMethod("pushString", "(JLjava/lang/String;)V", (void*) &NativeSinkDispatch::pushString),
+            nativeSinkMethod("pushBuffer", "(JLjava/nio/ByteBuffer;II)V", (void*) &NativeSinkDispatch::pushBuffer),
+            nativeSinkMethod("pushObject", "(JLjava/lang/Object;)V", (void*) &NativeSinkDispatch::pushObject),
+            nativeSinkMethod("closeSink", "(J)V", (void*) &NativeSinkDispatch::closeSink)
+        };
+        jint n = sizeof(methods) / sizeof(methods[0]);
+        if (env->RegisterNatives(nativeSinkClass->getClass(), methods, n) != JNI_OK) {
+            throw HandlerExc("JNI: Unable to register natives of cjay/callback/NativeSink.");
+        }
+    });
+
+    {
+        std::lock_guard<std::mutex> lock(nativeSinksMutex);
+        this->handle = ++nativeSinkHandles;
+        nativeSinks[this->handle] = this;
+    }
+    jobject local = env->NewObject(
+            nativeSinkClass->getClass(),
+            nativeSinkClass->getMid("<init>"),
+            this->handle
+            );
+    this->sink = env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+}
+
+NativeSink::~NativeSink() {
+    {
+        // Unreachable for new pushes, then wait for the handlers in flight
+        std::unique_lock<std::mutex> lock(nativeSinksMutex);
+        nativeSinks.erase(this->handle);
+        nativeSinksIdle.wait(lock, [this]() { return this->inFlight == 0; });
+    }
+    if (env != NULL && this->sink != NULL) {
+        // Java may still hold the sink: make further pushes fail instead of crash
+        env->CallVoidMethod(this->sink, nativeSinkClass->getMid("detach"));
+        env->DeleteGlobalRef(this->sink);
+    }
+}
+
+jobject NativeSink::getObj() {
+    return this->sink;
+}
+
+NativeSink& NativeSink::onString(std::function<void(std::string)> f) {
+    this->stringHandler = f;
+    return *this;
+}
+
+NativeSink& NativeSink::onBuffer(std::function<void(void*, jlong)> f) {
+    this->bufferHandler = f;
+    return *this;
+}
+
+NativeSink& NativeSink::onObject(std::function<void(jobject)> f) {
+    this->objectHandler = f;
+    return *this;
+}
+
+NativeSink& NativeSink::onClose(std::function<void()> f) {
+    this->closeHandler = f;
+    return *this;
+}
+
+/**
+ ** CommandBuffer implementation
+ **/
+static CJ* commandInterpreterClass = NULL;
+static std::once_flag commandInterpreterOnce;
+
+CommandBuffer::CommandBuffer() : count(0), methodArray(NULL), objectArray(NULL), values(NULL) {
+    this->put<std::int32_t>(0); // count, written by execute
+}
+
+CommandBuffer::~CommandBuffer() {
+    this->clear();
+}
+
+template <typename T> void CommandBuffer::put(T x) {
+    std::size_t at = this->commands.size();
+    this->commands.resize(at + sizeof(T));
+    std::memcpy(&this->commands[at], &x, sizeof(T));
+}
+
+void CommandBuffer::putTag(char tag) {
+    this->put<std::int32_t>(tag);
+}
+
+void CommandBuffer::putObject(jobject x) {
+    this->putTag('L');
+    this->put<std::int32_t>((std::int32_t) this->objects.size());
+    this->objects.push_back(env->NewGlobalRef(x));
+}
+
+void CommandBuffer::putOperand(jboolean x) { this->putTag('Z'); this->put<std::int32_t>(x); }
+void CommandBuffer::putOperand(jbyte x) { this->putTag('B'); this->put<std::int32_t>(x); }
+void CommandBuffer::putOperand(jchar x) { this->putTag('C'); this->put<std::int32_t>(x); }
+void CommandBuffer::putOperand(jshort x) { this->putTag('S'); this->put<std::int32_t>(x); }
+void CommandBuffer::putOperand(jint x) { this->putTag('I'); this->put<std::int32_t>(x); }
+void CommandBuffer::putOperand(jlong x) { this->putTag('J'); this->put<std::int64_t>(x); }
+void CommandBuffer::putOperand(jfloat x) { this->putTag('F'); this->put<jfloat>(x); }
+void CommandBuffer::putOperand(jdouble x) { this->putTag('D'); this->put<jdouble>(x); }
+
+void CommandBuffer::putOperand(const std::string& x) {
+    this->putTag('T');
+    this->put<std::int32_t>((std::int32_t) x.size());
+    this->commands.insert(this->commands.end(), x.begin(), x.end());
+}
+
+void CommandBuffer::putOperand(const char* x) {
+    if (x == NULL) { this->putTag('N'); return; }
+    this->putOperand(std::string(x));
+}
+
+void CommandBuffer::putOperand(jobject x) {
+    if (x == NULL) { this->putTag('N'); return; }
+    this->putObject(x);
+}
+
+void CommandBuffer::putOperand(std::nullptr_t) {
+    this->putTag('N');
+}
+
+void CommandBuffer::putOperand(Ref x) {
+    if (x.index < 0 || x.index >= this->count) {
+        throw HandlerExc("CJay: CommandBuffer argument does not refer to an earlier command.");
+    }
+    this->putTag('R');
+    this->put<std::int32_t>(x.index);
+}
+
+void CommandBuffer::begin(CJ& cj, const std::string& key, int argc) {
+    CJ::Snapshot snap(cj);
+    SignatureBase* sig = snap.getSignatureObj(key);
+    if (sig->name == "<init>") {
+        throw HandlerExc("CJay: CommandBuffer cannot record constructor " + key + ".");
+    }
+    std::map<jmethodID, int>::iterator it = this->methodIndex.find(sig->mid);
+    int index;
+    if (it != this->methodIndex.end()) {
+        index = it->second;
+    } else {
+        jobject method = env->ToReflectedMethod(snap->clazz, sig->mid, sig->isStatic);
+        checkJavaException();
+        index = (int) this->methods.size();
+        this->methods.push_back(env->NewGlobalRef(method));
+        env->DeleteLocalRef(method);
+        this->methodIndex[sig->mid] = index;
+    }
+    this->put<std::int32_t>(index);
+    if (sig->isStatic) {
+        this->putTag('N');
+    } else if (cj.getObj() == NULL) {
+        throw HandlerExc("CJay: No instance to call " + key + " on. Call Constructor beforehand.");
+    } else {
+        this->putObject(cj.getObj());
+    }
+    this->put<std::int32_t>(argc);
+}
+
+// Drops a partly recorded command; the methods it resolved stay cached
+void CommandBuffer::rollback(std::size_t commandBytes, std::size_t objectCount) {
+    this->commands.resize(commandBytes);
+    for (std::size_t i = objectCount; i < this->objects.size(); i++) {
+        if (this->objects[i] != NULL) { env->DeleteGlobalRef(this->objects[i]); }
+    }
+    this->objects.resize(objectCount);
+}
+
+static jobjectArray toObjectArray(const std::vector<jobject>& x) {
+    jclass OBJECT = env->FindClass("java/lang/Object");
+    jobjectArray local = env->NewObjectArray((jsize) x.size(), OBJECT, NULL);
+    env->DeleteLocalRef(OBJECT);
+    for (std::size_t i = 0; i < x.size(); i++) { env->SetObjectArrayElement(local, (jsize) i, x[i]); }
+    jobjectArray global = (jobjectArray) env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    return global;
+}
+
+void CommandBuffer::execute() {
+    std::call_once(commandInterpreterOnce, []() {
+        commandInterpreterClass = new CJ(); // lives as long as the library
+        commandInterpreterClass->setClass("cjay/batch/CommandInterpreter");
+    });
+    if (this->values != NULL) {
+        env->DeleteGlobalRef(this->values);
+        this->values = NULL;
+    }
+    this->results.assign(16 * (std::size_t) this->count, 0);
+    if (this->count == 0) { return; }
+    std::int32_t count = this->count;
+    std::memcpy(&this->commands[0], &count, sizeof(count));
+
+    // Arguments are appended only: a longer array means new elements
+    if (this->methodArray == NULL || env->GetArrayLength(this->methodArray) != (jsize) this->methods.size()) {
+        if (this->methodArray != NULL) { env->DeleteGlobalRef(this->methodArray); }
+        this->methodArray = toObjectArray(this->methods);
+    }
+    if (this->objectArray == NULL || env->GetArrayLength(this->objectArray) != (jsize) this->objects.size()) {
+        if (this->objectArray != NULL) { env->DeleteGlobalRef(this->objectArray); }
+        this->objectArray = toObjectArray(this->objects);
+    }
+
+    jobject commands = env->NewDirectByteBuffer(&this->commands[0], (jlong) this->commands.size());
+    jobject results = env->NewDirectByteBuffer(&this->results[0], (jlong) this->results.size());
+    jobject values = env->CallStaticObjectMethod(commandInterpreterClass->getClass(), commandInterpreterClass->getMid("execute"),
+        commands, this->methodArray, this->objectArray, results);
+    env->DeleteLocalRef(commands);
+    env->DeleteLocalRef(results);
+    if (env->ExceptionCheck()) {
+        this->results.clear(); // not executed
+        checkJavaException();
+    }
+    this->values = (jobjectArray) env->NewGlobalRef(values);
+    env->DeleteLocalRef(values);
+}
+
+char CommandBuffer::resultTag(Ref x) const {
+    if (x.index < 0 || x.index >= this->count || 16 * (std::size_t) x.index >= this->results.size()) {
+        throw HandlerExc("CJay: CommandBuffer result not available. Call execute beforehand.");
+    }
+    std::int32_t tag;
+    std::memcpy(&tag, &this->results[16 * (std::size_t) x.index], sizeof(tag));
+    return (char) tag;
+}
+
+template <typename T> T CommandBuffer::get(Ref x) const {
+    char tag = this->resultTag(x);
+    std::int64_t bits;
+    std::memcpy(&bits, &this->results[16 * (std::size_t) x.index + 8], sizeof(bits));
+    switch (tag) {
+        case 'V': case 'L':
+            throw HandlerExc(std::string("CJay: CommandBuffer result is not a primitive (") + tag + ").");
+        case 'F': {
+            std::int32_t low = (std::int32_t) bits;
+            jfloat f;
+            std::memcpy(&f, &low, sizeof(f));
+            return javaCast<T>(f);
+        }
+        case 'D': {
+            jdouble d;
+            std::memcpy(&d, &bits, sizeof(d));
+            return javaCast<T>(d);
+        }
+        default:
+            return static_cast<T>(bits);
+    }
+}
+
+template jboolean CommandBuffer::get(Ref) const;
+template jbyte CommandBuffer::get(Ref) const;
+template jchar CommandBuffer::get(Ref) const;
+template jshort CommandBuffer::get(Ref) const;
+template jint CommandBuffer::get(Ref) const;
+template jlong CommandBuffer::get(Ref) const;
+template jfloat CommandBuffer::get(Ref) const;
+template jdouble CommandBuffer::get(Ref) const;
+
+jobject CommandBuffer::getObject(Ref x) const {
+    char tag = this->resultTag(x);
+    if (tag != 'L') {
+        throw HandlerExc(std::string("CJay: CommandBuffer result is not a reference (") + tag + ").");
+    }
+    return env->GetObjectArrayElement(this->values, x.index);
+}
+
+std::string CommandBuffer::getString(Ref x) const {
+    return proxyString(this->getObject(x));
+}
+
+void CommandBuffer::releaseArrays() {
+    if (env == NULL) { return; }
+    if (this->methodArray != NULL) { env->DeleteGlobalRef(this->methodArray); }
+    if (this->objectArray != NULL) { env->DeleteGlobalRef(this->objectArray); }
+    if (this->values != NULL) { env->DeleteGlobalRef(this->values); }
+}
+
+void CommandBuffer::clear() {
+    this->releaseArrays();
+    if (env != NULL) {
+        for (jobject method : this->methods) { env->DeleteGlobalRef(method); }
+        for (jobject obj : this->objects) { env->DeleteGlobalRef(obj); }
+    }
+    this->methodArray = NULL;
+    this->objectArray = NULL;
+    this->values = NULL;
+    this->methods.clear();
+    this->methodIndex.clear();
+    this->objects.clear();
+    this->results.clear();
+    this->commands.assign(sizeof(std::int32_t), 0);
+    this->count = 0;
+}
+
+/**
+ ** Warmup implementation
+ **/
+WarmupReport::WarmupReport() : converged(false), rounds(0) { }
+
+std::string WarmupReport::toText() const {
+    std::ostringstream out;
+    out << "<Warm-up converged: " << this->converged << ", Rounds: " << this->rounds << ">" << std::endl;
+    for (std::size_t i = 0; i < this->roundNanos.size(); i++) {
+        out << "<Round: " << i + 1 << ", Time(ns): " << this->roundNanos[i] << ">" << std::endl;
+    }
+    for (auto& name : this->failed) {
+        out << "<Dropped: " << name << ">" << std::endl;
+    }
+    if (!this->error.empty()) {
+        out << "<Error: " << this->error << ">" << std::endl;
+    }
+    return out.str();
+}
+
+Warmup::Warmup() :
+    minRounds(5), maxRounds(200), callsPerRound(1000), window(5), tolerance(0.05),
+    converged(false), running(false) { }
+
+Warmup& Warmup::add(CJ& cj) {
+    this->classes.push_back(&cj);
+    return *this;
+}
+
+Warmup& Warmup::add(std::string name, std::function<void()> call) {
+    this->calls.push_back(std::make_pair(name, call));
+    return *this;
+}
+
+// Zero arguments for a descriptor with primitive parameters only
+static bool zeroArguments(std::string descriptor, std::vector<jvalue>& args) {
+    std::size_t end = descriptor.find(')');
+    for (std::size_t i = 1; i < end; i++) {
+        if (std::string("ZBCSIJFD").find(descriptor[i]) == std::string::npos) { return false; }
+        jvalue zero;
+        zero.j = 0;
+        args.push_back(zero);
+    }
+    return true;
+}
+
+Warmup& Warmup::addSynthesized(CJ& cj, const std::vector<std::string>& keys) {
+    CJ* target = &cj;
+    // Checked all together: nothing is added if one key is rejected
+    std::vector<std::pair<std::string, std::function<void()> > > synthesized;
+    for (auto& key : keys) {
+        SignatureBase* sig = cj.getSignatureObj(key);
+        std::vector<jvalue> args;
+        if (sig->name == CONSTRUCTOR_METHOD_NAME) {
+            throw HandlerExc("Warmup: " + key + " is a constructor, not a method.");
+        }
+        if (!sig->isStatic && cj.getObj() == NULL) {
+            throw HandlerExc("Warmup: " + key + " is an instance method. Use CJ::Constructor beforehand.");
+        }
+        if (!zeroArguments(sig->descriptor, args)) {
+            throw HandlerExc("Warmup: " + key + " takes non-primitive arguments. Use add(name, call) instead.");
+        }
+
+        bool isObject = std::string("ZBCSIJFDV").find(sig->descriptor[sig->descriptor.find(')') + 1]) == std::string::npos;
+        synthesized.push_back(std::make_pair(cj.getClassName() + "." + key, [target, key, isObject, args]() {
+            jvalue result = target->callA(key, args.empty() ? NULL : &args[0]);
+            if (isObject) { env->DeleteLocalRef(result.l); }
+        }));
+    }
+    this->add(cj);
+    this->calls.insert(this->calls.end(), synthesized.begin(), synthesized.end());
+    return *this;
+}
+
+Warmup& Warmup::setRounds(int minRounds, int maxRounds) {
+    this->minRounds = minRounds;
+    this->maxRounds = maxRounds;
+    return *this;
+}
+
+Warmup& Warmup::setCallsPerRound(int callsPerRound) {
+    this->callsPerRound = callsPerRound;
+    return *this;
+}
+
+Warmup& Warmup::setConvergence(int window, double tolerance) {
+    this->window = window;
+    this->tolerance = tolerance;
+    return *this;
+}
+
+bool Warmup::isStable(const std::vector<std::uint64_t>& rounds) const {
+    if ((int) rounds.size() < this->minRounds || (int) rounds.size() < this->window) { return false; }
+    std::uint64_t lo = rounds.back();
+    std::uint64_t hi = rounds.back();
+    for (std::size_t i = rounds.size() - this->window; i < rounds.size(); i++) {
+        lo = std::min(lo, rounds[i]);
+        hi = std::max(hi, rounds[i]);
+    }
+    return (double) (hi - lo) <= this->tolerance * (double) lo;
+}
+
+WarmupReport Warmup::run() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->running = true;
+    }
+    WarmupReport result;
+    std::exception_ptr error;
+    try {
+        for (CJ* cj : this->classes) { cj->initializeClass(); }
+
+        std::vector<bool> dropped(this->calls.size(), false);
+        while (result.rounds < this->maxRounds && !result.converged) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int n = 0; n < this->callsPerRound; n++) {
+                env->PushLocalFrame(16);
+                for (std::size_t i = 0; i < this->calls.size(); i++) {
+                    if (dropped[i]) { continue; }
+                    try {
+                        this->calls[i].second();
+                    } catch (...) {
+                        dropped[i] = true;
+                    }
+                    if (env->ExceptionCheck()) {
+                        env->ExceptionClear();
+                        dropped[i] = true;
+                    }
+                    if (dropped[i]) { result.failed.push_back(this->calls[i].first); }
+                }
+                env->PopLocalFrame(NULL);
+            }
+            result.roundNanos.push_back((std::uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+            result.rounds++;
+            result.converged = this->isStable(result.roundNanos);
+        }
+    } catch (std::exception& e) {
+        error = std::current_exception();
+        result.error = e.what();
+    } catch (...) {
+        error = std::current_exception();
+        result.error = "Unknown exception.";
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->report = result;
+        this->running = false;
+    }
+    this->converged = result.converged;
+    this->finished.notify_all();
+    if (error) { std::rethrow_exception(error); }
+    return result;
+}
+
+void Warmup::start(CallExecutor& executor) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->running = true;
+    }
+    executor.post([this]() {
+        try {
+            this->run();
+        } catch (...) {
+            // recorded in the report; must not escape the worker
+        }
+    });
+}
+
+bool Warmup::isConverged() {
+    return this->converged;
+}
+
+bool Warmup::waitUntilFinished(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return this->finished.wait_for(lock, timeout, [this]() { return !this->running; });
+}
+
+WarmupReport Warmup::getReport() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->report;
+}
+
+/**
+ ** JNITrace implementation
+ **/
+
+// JNI functions taking a va_list or a jvalue array. The "..." entries of the
+// table are not hooked: the C++ JNIEnv wrappers forward them to the "V" ones.
+#define CJAY_JNI_CALL_FAMILY(X, prefix, suffix) \
+    X(prefix##Object##suffix##V) X(prefix##Object##suffix##A) \
+    X(prefix##Boolean##suffix##V) X(prefix##Boolean##suffix##A) \
+    X(prefix##Byte##suffix##V) X(prefix##Byte##suffix##A) \
+    X(prefix##Char##suffix##V) X(prefix##Char##suffix##A) \
+    X(prefix##Short##suffix##V) X(prefix##Short##suffix##A) \
+    X(prefix##Int##suffix##V) X(prefix##Int##suffix##A) \
+    X(prefix##Long##suffix##V) X(prefix##Long##suffix##A) \
+    X(prefix##Float##suffix##V) X(prefix##Float##suffix##A) \
+    X(prefix##Double##suffix##V) X(prefix##Double##suffix##A) \
+    X(prefix##Void##suffix##V) X(prefix##Void##suffix##A)
+
+#define CJAY_JNI_PRIMITIVE_FAMILY(X, prefix, suffix) \
+    X(prefix##Boolean##suffix) X(prefix##Byte##suffix) X(prefix##Char##suffix) X(prefix##Short##suffix) \
+    X(prefix##Int##suffix) X(prefix##Long##suffix) X(prefix##Float##suffix) X(prefix##Double##suffix)
+
+#define CJAY_JNI_FIELD_FAMILY(X, prefix, suffix) \
+    X(prefix##Object##suffix) CJAY_JNI_PRIMITIVE_FAMILY(X, prefix, suffix)
+
+#define CJAY_JNI_FUNCTIONS(X) \
+    X(GetVersion) X(DefineClass) X(FindClass) X(ToReflectedMethod) X(GetSuperclass) X(IsAssignableFrom) \
+    X(Throw) X(ThrowNew) X(ExceptionOccurred) X(ExceptionDescribe) X(ExceptionClear) X(FatalError) \
+    X(PushLocalFrame) X(PopLocalFrame) X(NewGlobalRef) X(DeleteGlobalRef) X(DeleteLocalRef) \
+    X(IsSameObject) X(NewLocalRef) X(EnsureLocalCapacity) X(AllocObject) X(NewObjectV) X(NewObjectA) \
+    X(GetObjectClass) X(IsInstanceOf) X(GetMethodID) \
+    CJAY_JNI_CALL_FAMILY(X, Call, Method) \
+    CJAY_JNI_CALL_FAMILY(X, CallNonvirtual, Method) \
+    X(GetFieldID) CJAY_JNI_FIELD_FAMILY(X, Get, Field) CJAY_JNI_FIELD_FAMILY(X, Set, Field) \
+    X(GetStaticMethodID) \
+    CJAY_JNI_CALL_FAMILY(X, CallStatic, Method) \
+    X(GetStaticFieldID) CJAY_JNI_FIELD_FAMILY(X, GetStatic, Field) CJAY_JNI_FIELD_FAMILY(X, SetStatic, Field) \
+    X(NewString) X(GetStringLength) X(GetStringChars) X(ReleaseStringChars) \
+    X(NewStringUTF) X(GetStringUTFLength) X(GetStringUTFChars) X(ReleaseStringUTFChars) \
+    X(GetArrayLength) X(NewObjectArray) X(GetObjectArrayElement) X(SetObjectArrayElement) \
+    CJAY_JNI_PRIMITIVE_FAMILY(X, New, Array) \
+    CJAY_JNI_PRIMITIVE_FAMILY(X, Get, ArrayElements) CJAY_JNI_PRIMITIVE_FAMILY(X, Release, ArrayElements) \
+    CJAY_JNI_PRIMITIVE_FAMILY(X, Get, ArrayRegion) CJAY_JNI_PRIMITIVE_FAMILY(X, Set, ArrayRegion) \
+    X(RegisterNatives) X(UnregisterNatives) X(MonitorEnter) X(MonitorExit) X(GetJavaVM) \
+    X(GetStringRegion) X(GetStringUTFRegion) X(GetPrimitiveArrayCritical) X(ReleasePrimitiveArrayCritical) \
+    X(GetStringCritical) X(ReleaseStringCritical) X(NewWeakGlobalRef) X(DeleteWeakGlobalRef) \
+    X(ExceptionCheck) X(NewDirectByteBuffer) X(GetDirectBufferAddress) X(GetDirectBufferCapacity) \
+    X(GetObjectRefType)
+
+#define CJAY_JNI_ID(name) JNI_FN_##name,
+enum JNIFunctionId { CJAY_JNI_FUNCTIONS(CJAY_JNI_ID) JNI_FN_COUNT };
+#undef CJAY_JNI_ID
+
+#define CJAY_JNI_NAME(name) #name,
+static const char* jniFunctionNames[] = { CJAY_JNI_FUNCTIONS(CJAY_JNI_NAME) };
+#undef CJAY_JNI_NAME
+
+// Counters of the calling thread
+struct JNIThreadCounters {
+    jlong calls[JNI_FN_COUNT];
+    jlong localRefsCreated;
+    jlong localRefsDeleted;
+    jlong globalRefsCreated;
+    jlong globalRefsDeleted;
+};
+
+static thread_local JNIThreadCounters jniThreadCounters = JNIThreadCounters();
+static thread_local std::vector<jlong> jniFrameMarks; // live local refs at each PushLocalFrame
+static std::atomic<jlong> jniGlobalRefsOutstanding(0);
+static const JNINativeInterface_* jniOriginalFunctions = NULL;
+static JNINativeInterface_ jniCountingFunctions;
+static std::once_flag jniCountingFunctionsOnce;
+
+// References returned by JNI functions are new local references,
+// except for the ones returned by NewGlobalRef and NewWeakGlobalRef.
+template <typename R>
+inline typename std::enable_if<std::is_convertible<R, jobject>::value>::type jniCountResult(std::size_t id, R result) {
+    if (result == NULL || id == JNI_FN_NewWeakGlobalRef) { return; }
+    if (id == JNI_FN_NewGlobalRef) {
+        jniThreadCounters.globalRefsCreated++;
+        jniGlobalRefsOutstanding.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        jniThreadCounters.localRefsCreated++;
+    }
+}
+
+template <typename R>
+inline typename std::enable_if<!std::is_convertible<R, jobject>::value>::type jniCountResult(std::size_t, R) { }
+
+template <typename F> struct JNITraceHook;
+
+template <typename R, typename... A> struct JNITraceHook<R (JNICALL *)(JNIEnv*, A...)> {
+    template <R (JNICALL * JNINativeInterface_::*Field)(JNIEnv*, A...), std::size_t Id>
+    static R JNICALL hook(JNIEnv* e, A... args) {
+        jniThreadCounters.calls[Id]++;
+        R result = (jniOriginalFunctions->*Field)(e, args...);
+        jniCountResult<R>(Id, result);
+        return result;
+    }
+};
+
+template <typename... A> struct JNITraceHook<void (JNICALL *)(JNIEnv*, A...)> {
+    template <void (JNICALL * JNINativeInterface_::*Field)(JNIEnv*, A...), std::size_t Id>
+    static void JNICALL hook(JNIEnv* e, A... args) {
+        jniThreadCounters.calls[Id]++;
+        (jniOriginalFunctions->*Field)(e, args...);
+    }
+};
+
+static void JNICALL jniTraceDeleteLocalRef(JNIEnv* e, jobject ref) {
+    jniThreadCounters.calls[JNI_FN_DeleteLocalRef]++;
+    if (ref != NULL) { jniThreadCounters.localRefsDeleted++; }
+    jniOriginalFunctions->DeleteLocalRef(e, ref);
+}
+
+// PopLocalFrame frees the references still alive in the frame: they are
+// counted as deleted. The reference it returns is a new one (jniCountResult).
+static jint JNICALL jniTracePushLocalFrame(JNIEnv* e, jint capacity) {
+    jniThreadCounters.calls[JNI_FN_PushLocalFrame]++;
+    jint result = jniOriginalFunctions->PushLocalFrame(e, capacity);
+    if (result == 0) {
+        jniFrameMarks.push_back(jniThreadCounters.localRefsCreated - jniThreadCounters.localRefsDeleted);
+    }
+    return result;
+}
+
+static jobject JNICALL jniTracePopLocalFrame(JNIEnv* e, jobject result) {
+    jniThreadCounters.calls[JNI_FN_PopLocalFrame]++;
+    if (!jniFrameMarks.empty()) { // frames pushed before install are not known
+        jlong live = jniThreadCounters.localRefsCreated - jniThreadCounters.localRefsDeleted;
+        if (live > jniFrameMarks.back()) { jniThreadCounters.localRefsDeleted += live - jniFrameMarks.back(); }
+        jniFrameMarks.pop_back();
+    }
+    jobject outer = jniOriginalFunctions->PopLocalFrame(e, result);
+    jniCountResult<jobject>(JNI_FN_PopLocalFrame, outer);
+    return outer;
+}
+
+static void JNICALL jniTraceDeleteGlobalRef(JNIEnv* e, jobject ref) {
+    jniThreadCounters.calls[JNI_FN_DeleteGlobalRef]++;
+    if (ref != NULL) {
+        jniThreadCounters.globalRefsDeleted++;
+        jniGlobalRefsOutstanding.fetch_sub(1, std::memory_order_relaxed);
+    }
+    jniOriginalFunctions->DeleteGlobalRef(e, ref);
+}
+
+static void buildCountingFunctions() {
+    jniCountingFunctions = *jniOriginalFunctions;
+#define CJAY_JNI_HOOK(name) \
+    jniCountingFunctions.name = \
+        &JNITraceHook<decltype(jniCountingFunctions.name)>::template hook<&JNINativeInterface_::name, JNI_FN_##name>;
+    CJAY_JNI_FUNCTIONS(CJAY_JNI_HOOK)
+#undef CJAY_JNI_HOOK
+    jniCountingFunctions.DeleteLocalRef = &jniTraceDeleteLocalRef;
+    jniCountingFunctions.PushLocalFrame = &jniTracePushLocalFrame;
+    jniCountingFunctions.PopLocalFrame = &jniTracePopLocalFrame;
+    jniCountingFunctions.DeleteGlobalRef = &jniTraceDeleteGlobalRef;
+}
+
+void JNITrace::install() {
+    if (jvm == NULL) {
+        throw HandlerExc("CJay: No Java Virtual Machine instance. Please, call VM::createVM beforehand.");
+    }
+    if (env == NULL) { attachCurrentThread(); }
+    if (env->functions == &jniCountingFunctions) { return; }
+    // Only this thread's JNIEnv is patched: the original table is the same
+    // for every thread, so it is saved once
+    std::call_once(jniCountingFunctionsOnce, [] {
+        jniOriginalFunctions = env->functions;
+        buildCountingFunctions();
+    });
+    env->functions = &jniCountingFunctions;
+}
+
+void JNITrace::uninstall() {
+    if (JNITrace::isInstalled()) {
+        env->functions = jniOriginalFunctions;
+    }
+}
+
+bool JNITrace::isInstalled() {
+    return env != NULL && env->functions == &jniCountingFunctions;
+}
+
+JNICounters JNITrace::counters() {
+    JNICounters c;
+    c.calls.assign(jniThreadCounters.calls, jniThreadCounters.calls + JNI_FN_COUNT);
+    c.localRefsCreated = jniThreadCounters.localRefsCreated;
+    c.localRefsDeleted = jniThreadCounters.localRefsDeleted;
+    c.globalRefsCreated = jniThreadCounters.globalRefsCreated;
+    c.globalRefsDeleted = jniThreadCounters.globalRefsDeleted;
+    return c;
+}
+
+jlong JNITrace::globalRefsOutstanding() {
+    return jniGlobalRefsOutstanding.load(std::memory_order_relaxed);
+}
+
+std::size_t JNITrace::numFunctions() {
+    return JNI_FN_COUNT;
+}
+
+std::string JNITrace::functionName(std::size_t id) {
+    if (id >= JNI_FN_COUNT) {
+        throw HandlerExc("CJay: JNI function id out of range.");
+    }
+    return jniFunctionNames[id];
+}
+
+/**
+ ** JNICounters implementation
+ **/
+JNICounters::JNICounters() :
+    calls(JNI_FN_COUNT, 0), localRefsCreated(0), localRefsDeleted(0), globalRefsCreated(0), globalRefsDeleted(0) { }
+
+jlong JNICounters::totalCalls() const {
+    jlong total = 0;
+    for (jlong n : this->calls) { total += n; }
+    return total;
+}
+
+jlong JNICounters::callsTo(std::string name) const {
+    for (std::size_t i = 0; i < JNI_FN_COUNT; i++) {
+        if (name == jniFunctionNames[i]) { return this->calls[i]; }
+    }
+    throw HandlerExc("CJay: Unknown JNI function " + name);
+}
+
+jlong JNICounters::localRefsLeaked() const {
+    return this->localRefsCreated - this->localRefsDeleted;
+}
+
+std::string JNICounters::toText() const {
+    std::vector<std::pair<jlong, std::size_t> > used;
+    for (std::size_t i = 0; i < JNI_FN_COUNT; i++) {
+        if (this->calls[i] != 0) { used.push_back(std::make_pair(this->calls[i], i)); }
+    }
+    std::sort(used.rbegin(), used.rend()); // most called first
+
+    std::ostringstream out;
+    out << "<JNI calls: " << this->totalCalls() <<
+            ", Local refs created: " << this->localRefsCreated <<
+            ", Local refs deleted: " << this->localRefsDeleted <<
+            ", Global refs created: " << this->globalRefsCreated <<
+            ", Global refs deleted: " << this->globalRefsDeleted <<
+            ">" << std::endl;
+    for (auto& it : used) {
+        out << "<Function: " << jniFunctionNames[it.second] << ", Calls: " << it.first << ">" << std::endl;
+    }
+    return out.str();
+}
+
+JNICounters JNICounters::operator-(const JNICounters& other) const {
+    JNICounters c;
+    for (std::size_t i = 0; i < JNI_FN_COUNT; i++) {
+        c.calls[i] = this->calls[i] - other.calls[i];
+    }
+    c.localRefsCreated = this->localRefsCreated - other.localRefsCreated;
+    c.localRefsDeleted = this->localRefsDeleted - other.localRefsDeleted;
+    c.globalRefsCreated = this->globalRefsCreated - other.globalRefsCreated;
+    c.globalRefsDeleted = this->globalRefsDeleted - other.globalRefsDeleted;
+    return c;
+}
+
+/**
+ ** JNITraceScope implementation
+ **/
+JNITraceScope::JNITraceScope() : begin(JNITrace::counters()) { }
+
+JNICounters JNITraceScope::delta() const {
+    return JNITrace::counters() - this->begin;
+}
+
 /**
  ** Handler implementation
  **/
@@ -1250,4 +5097,124 @@ void Handler::init() {
     hdl.setClass(this->className);
 }
 
+/**
+ ** Generated proxies implementation
+ **/
+jclass proxyClass(const char* className) {
+    if (jvm == NULL) {
+        throw HandlerExc("CJay: No Java Virtual Machine instance. Please, call VM::createVM beforehand.");
+    }
+    if (env == NULL) { attachCurrentThread(); }
+    jclass clazz = findClass(className);
+    // proxies are used from any attached thread
+    jclass global = (jclass) env->NewGlobalRef(clazz);
+    env->DeleteLocalRef(clazz);
+    return global;
+}
+
+jmethodID proxyMethod(jclass clazz, const char* name, const char* descriptor, bool isStatic) {
+    jmethodID mid = isStatic ? env->GetStaticMethodID(clazz, name, descriptor) : env->GetMethodID(clazz, name, descriptor);
+    if (mid == NULL) {
+        env->ExceptionClear();
+        throw HandlerExc(std::string("JNI: Failed to get method ID of ") + name + " with descriptor: " + descriptor
+                + ". Is the proxy out of date?");
+    }
+    return mid;
+}
+
+void checkJavaException() {
+    if (env->ExceptionCheck()) {
+        throw HandlerExc("JNI: " + takeJavaException());
+    }
+}
+
+std::string proxyString(jobject str) {
+    if (str == NULL) { return std::string(); }
+    std::string rtn = toUTF8((jstring) str);
+    env->DeleteLocalRef(str);
+    return rtn;
+}
+
+ProxyTable::ProxyTable(const char* className, std::initializer_list<Method> methods) :
+    className(className), methods(methods), current(NULL) { }
+
+ProxyTable::~ProxyTable() {
+    if (env == NULL || jvm == NULL) { return; }
+    for (auto& entry : this->entries) { env->DeleteGlobalRef(entry->clazz); }
+}
+
+const ProxyTable::Entry& ProxyTable::get() {
+    std::uint64_t generation = bindingGeneration();
+    Entry* entry = this->current.load(std::memory_order_acquire);
+    if (entry != NULL && entry->generation == generation) { return *entry; }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    entry = this->current.load(std::memory_order_relaxed);
+    if (entry != NULL && entry->generation == generation) { return *entry; }
+    std::unique_ptr<Entry> fresh(new Entry());
+    fresh->clazz = proxyClass(this->className);
+    fresh->generation = generation;
+    fresh->mids.reset(new std::atomic<jmethodID>[this->methods.size()]);
+    for (std::size_t i = 0; i < this->methods.size(); i++) { fresh->mids[i].store(NULL); }
+    entry = fresh.get();
+    this->entries.push_back(std::move(fresh));
+    this->current.store(entry, std::memory_order_release);
+    return *entry;
+}
+
+jmethodID ProxyTable::getMid(const Entry& entry, std::size_t index) {
+    jmethodID mid = entry.mids[index].load(std::memory_order_relaxed);
+    if (mid == NULL) {
+        const Method& method = this->methods[index];
+        mid = proxyMethod(entry.clazz, method.name, method.descriptor, method.isStatic);
+        entry.mids[index].store(mid, std::memory_order_relaxed);
+    }
+    return mid;
+}
+
+ProxyString::ProxyString(const std::string& str) : str(newJavaString(str.data(), str.size())) { }
+
+ProxyString::~ProxyString() {
+    if (env != NULL && this->str != NULL) { env->DeleteLocalRef(this->str); }
+}
+
+ProxyBase::ProxyBase(jobject obj, bool adopt) : obj(NULL) {
+    if (obj == NULL) { return; }
+    this->obj = env->NewGlobalRef(obj);
+    if (adopt) { env->DeleteLocalRef(obj); }
+}
+
+ProxyBase::ProxyBase(const ProxyBase& other) : obj(NULL) {
+    if (other.obj != NULL) { this->obj = env->NewGlobalRef(other.obj); }
+}
+
+ProxyBase& ProxyBase::operator=(const ProxyBase& other) {
+    if (this != &other) {
+        jobject previous = this->obj;
+        this->obj = (other.obj == NULL) ? NULL : env->NewGlobalRef(other.obj);
+        if (previous != NULL) { env->DeleteGlobalRef(previous); }
+    }
+    return *this;
+}
+
+ProxyBase::~ProxyBase() {
+    if (env != NULL && this->obj != NULL) { env->DeleteGlobalRef(this->obj); }
+}
+
 } /* namespace VM */
+
+#ifdef CJAY_EMBEDDED
+// CJay as (part of) a native library loaded by System.loadLibrary
+extern "C" JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void*) {
+    try {
+        return VM::onLoad(vm);
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return JNI_ERR;
+    }
+}
+
+extern "C" JNIEXPORT void JNICALL JNI_OnUnload(JavaVM*, void*) {
+    VM::onUnload();
+}
+#endif
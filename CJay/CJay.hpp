@@ -27,6 +27,35 @@
 #include <map>
 #include <exception>
 #include <cstdarg>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <list>
+#include <iterator>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+#if defined(__has_include)
+#if __cplusplus >= 201703L && __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#endif
+#endif
 
 #include <jni.h>
 
@@ -45,19 +74,117 @@ enum class RV {
     VV // VOID
 };
 
-extern JNIEnv* env;
+// One JNIEnv per thread: set by createVM on the creating thread and by
+// attachCurrentThread on any other thread.
+extern thread_local JNIEnv* env;
 extern JavaVM* jvm;
 
 inline char* TOCHAR (std::string);
 
+// Typed JVM options for createVM
+class VMConfig {
+public:
+    enum class GC { DEFAULT, SERIAL, PARALLEL, G1, Z, SHENANDOAH, EPSILON };
+protected:
+    std::vector<std::string> options;
+    std::string classPath; // empty: CLASSPATH environment variable
+    std::string initialHeap;
+    std::string maxHeap;
+    GC gc;
+    std::string sharedArchive;
+    std::string dumpArchive;
+    std::string classList;
+    std::vector<std::string> preloadClasses;
+    std::vector<std::string> jars;
+public:
+    VMConfig& addOption(std::string);
+    VMConfig& setClassPath(std::string);
+    VMConfig& setInitialHeap(std::string); // e.g. "512m"
+    VMConfig& setMaxHeap(std::string);
+    VMConfig& setGC(GC);
+    // Class data sharing: map an existing archive at startup ...
+    VMConfig& useSharedArchive(std::string);
+    // ... or dump one when the JVM is destroyed (-XX:ArchiveClassesAtExit, JDK 13+).
+    // It holds every class loaded in this run, not only the classes bound by CJay.
+    VMConfig& dumpSharedArchive(std::string);
+    // Write the classes bound by CJay in this run on destroyVM. The JVM does not
+    // read it: it is the -XX:SharedClassListFile of a separate `java -Xshare:dump`
+    // run that builds an archive of those classes only.
+    VMConfig& writeClassList(std::string);
+    // Load and bind a class right after the JVM starts (see getPreloadedClass)
+    VMConfig& preload(std::string);
+    // Serve the classes of a jar from memory (see VM::addJar), before preloading
+    VMConfig& addJar(std::string);
+    std::vector<std::string> getOptions() const;
+    const std::vector<std::string>& getPreloadClasses() const;
+    const std::vector<std::string>& getJars() const;
+    std::string getClassList() const;
+    VMConfig();
+};
+
 jint createJavaVM(JavaVMInitArgs&);
+// Once the JVM exists, createVM only attaches the calling thread
 void createVM(std::vector<std::string>&);
 void createVM();
+void createVM(const VMConfig&);
 void destroyVM();
+std::vector<std::string> getBoundClasses();
+// attachCurrentThread adopts the JNIEnv of a thread already attached (a Java
+// thread), which detachCurrentThread then leaves attached
+JNIEnv* attachCurrentThread(std::string name = "", bool asDaemon = false);
+void detachCurrentThread();
+// JNIEnv received by a native method, for the calling thread
+void useEnv(JNIEnv*);
+
+// Embedded mode: CJay inside a native library loaded by a running JVM
+jint onLoad(JavaVM*);
+void onUnload();
+void attachVM();
+bool ownsVM();
+void prebindClasses(const std::vector<std::string>&);
+void clearBindingCache();
+// Changes whenever cached bindings are dropped (addJar, addClass, destroyVM)
+std::uint64_t bindingGeneration();
+std::vector<std::string> converterClasses();
+
+// Classes from memory. With -DCJAY_EMBED_CLASSES the helper classes of CJay
+// (cjay/...) are linked into the library and defined by createVM and onLoad,
+// so java/bin need not be on the class path.
+bool hasEmbeddedClasses();
+void defineEmbeddedClasses();
+// Defines a class in the system class loader (global reference)
+jclass defineClass(std::string, const void*, std::size_t);
+// Application classes served by a cjay.loader.MemoryClassLoader. They win
+// over the class path in setClass and findClass. The bytes are copied.
+std::vector<std::string> addJar(const void*, std::size_t); // class names
+std::vector<std::string> addJar(std::string path);          // memory-mapped file
+void addClass(std::string, const void*, std::size_t);
+// In-memory class, else FindClass (local reference). Throws if missing.
+jclass findClass(std::string);
 
 template <typename To> To FromJavaObjectToCpp(jobject);
 template <typename To> std::vector<To> FromALToVector(jobject);
 
+// Java strings as standard UTF-8. JNI's *StringUTF* functions use modified
+// UTF-8 instead, which encodes NUL and supplementary characters differently.
+std::size_t utf16ToUtf8(const jchar*, std::size_t, char*);   // output: up to 3 bytes per unit
+std::size_t utf8ToUtf16(const char*, std::size_t, jchar*);   // output: up to 1 unit per byte
+template <typename Str> void toUTF8(jstring, Str&);
+std::string toUTF8(jstring);
+jstring newJavaString(const char*, std::size_t);
+
+// Interned strings: one global reference per content, in a bounded LRU cache
+// split into 16 locked stripes. internString returns a new local reference:
+// a repeated argument costs a hash lookup, not an allocation and an encoding
+// pass. Strings over 1 KiB are not cached. A static string is never evicted,
+// and its global reference is valid until destroyVM.
+jstring internString(const char*, std::size_t);
+jstring internString(const std::string&);
+jstring registerStaticString(const std::string&);
+void setStringCacheCapacity(std::size_t); // strings, excluding static ones; default 4096
+std::size_t getStringCacheSize();
+void clearStringCache();
+
 class JavaMethodReflect {
 public:
     std::string name;
@@ -71,49 +198,244 @@ public:
 typedef std::map<std::string, VM::JavaMethodReflect> methodReflectCollection;
 typedef std::map<std::string, int> isNonUniqueCollection;
 
+// Per-method instrumentation (recorded when compiled with -DCJAY_METHOD_STATS).
+// The types are defined either way, so that a SignatureBase built without the
+// flag still frees statistics allocated by code built with it.
+// Latencies go to a log-linear (HDR-style) histogram: 8 linear
+// sub-buckets per power of two, i.e. at most 12.5% relative error.
+#define CJAY_STATS_SHARDS 4
+#define CJAY_STATS_SUB_BUCKET_BITS 3
+#define CJAY_STATS_MAX_MAGNITUDE 40 // 2^40 ns (~18 min); larger samples are clamped
+#define CJAY_STATS_BUCKETS ((CJAY_STATS_MAX_MAGNITUDE - CJAY_STATS_SUB_BUCKET_BITS + 1) << CJAY_STATS_SUB_BUCKET_BITS)
+
+class MethodStatsSnapshot {
+public:
+    std::uint64_t count;
+    std::uint64_t totalNanos;
+    std::uint64_t maxNanos;
+    std::vector<std::uint64_t> buckets;
+    std::uint64_t meanNanos() const;
+    std::uint64_t percentile(double) const;
+    MethodStatsSnapshot();
+};
+
+class MethodStats {
+protected:
+    // Threads are spread round-robin over the shards, so the hot path is a
+    // handful of relaxed atomic increments that concurrent callers mostly
+    // make on different shards. About 10 KB per method, allocated on its
+    // first recorded call.
+    struct Shard {
+        std::atomic<std::uint64_t> count;
+        std::atomic<std::uint64_t> totalNanos;
+        std::atomic<std::uint64_t> maxNanos;
+        std::atomic<std::uint64_t> buckets[CJAY_STATS_BUCKETS];
+    };
+    Shard shards[CJAY_STATS_SHARDS];
+    static std::size_t shardIndex();
+public:
+    static std::size_t bucketIndex(std::uint64_t);
+    static std::uint64_t bucketUpperBound(std::size_t);
+    void record(std::uint64_t);
+    MethodStatsSnapshot snapshot() const;
+    void reset();
+    MethodStats();
+};
+
+#ifdef CJAY_METHOD_STATS
+// Records the lifetime of the scope into a MethodStats
+class MethodStatsTimer {
+protected:
+    MethodStats& stats;
+    std::chrono::steady_clock::time_point start;
+public:
+    MethodStatsTimer(MethodStats& s) : stats(s), start(std::chrono::steady_clock::now()) { }
+    ~MethodStatsTimer() {
+        stats.record((std::uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+    }
+};
+#endif
+
+#ifdef CJAY_TRACING
+// Spans of CJay work (compile with -DCJAY_TRACING): createVM, setClass and
+// its phases, and Converter construction. Once traceCalls(true) is set, also
+// every call and collection conversion. Each thread appends to its own
+// buffer without locks. getChromeTrace renders the spans in the Chrome
+// trace JSON format, which chrome://tracing and ui.perfetto.dev open.
+class TraceEvent {
+public:
+    const char* name;     // string literal
+    const char* category; // string literal
+    char detail[48];      // class name or method key, truncated
+    std::uint64_t startNanos;
+    std::uint64_t durationNanos;
+};
+
+class Tracer {
+protected:
+    static std::atomic<bool> callsEnabled;
+public:
+    static const std::size_t CHUNK_EVENTS = 4096;
+    static const std::size_t MAX_CHUNKS = 256; // per thread; later spans are dropped until clear()
+    static void traceCalls(bool);
+    static bool tracingCalls() { return callsEnabled.load(std::memory_order_relaxed); }
+    static std::uint64_t now(); // nanoseconds since the first use
+    static void record(const char* name, const char* category, const char* detail, std::size_t detailSize,
+                       std::uint64_t startNanos, std::uint64_t endNanos);
+    static std::string getChromeTrace();
+    static void writeChromeTrace(std::string path);
+    static void clear(); // forgets the spans recorded so far; their memory is reused
+    static std::uint64_t getDropped();
+};
+
+// Records the lifetime of the scope, or up to end(), as a span
+class TraceSpan {
+protected:
+    const char* name;
+    const char* category;
+    const char* detail;
+    std::size_t detailSize;
+    bool active;
+    std::uint64_t start;
+private:
+    TraceSpan(const TraceSpan&);
+    TraceSpan& operator=(const TraceSpan&);
+public:
+    TraceSpan(const char* name, const char* category, bool active = true) :
+        name(name), category(category), detail(NULL), detailSize(0), active(active), start(active ? Tracer::now() : 0) { }
+    // detail must outlive the span
+    TraceSpan(const char* name, const char* category, const std::string& detail, bool active = true) :
+        name(name), category(category), detail(detail.data()), detailSize(detail.size()), active(active), start(active ? Tracer::now() : 0) { }
+    void end() {
+        if (!this->active) { return; }
+        this->active = false;
+        Tracer::record(this->name, this->category, this->detail, this->detailSize, this->start, Tracer::now());
+    }
+    ~TraceSpan() { this->end(); }
+};
+#endif
+
 class SignatureBase {
 public:
     std::string name;
     std::string descriptor;
     bool isStatic;
     jmethodID mid;
+    // Allocated on the first recorded call (see methodStatsOf). The member
+    // exists with or without CJAY_METHOD_STATS, so the layout never depends on it.
+    std::atomic<MethodStats*> stats;
     SignatureBase(std::string, std::string, bool);
     SignatureBase();
     virtual ~SignatureBase();
 };
 
+#ifdef CJAY_METHOD_STATS
+// Statistics of a signature, allocated by the first caller
+inline MethodStats& methodStatsOf(SignatureBase& sig) {
+    MethodStats* stats = sig.stats.load(std::memory_order_acquire);
+    if (stats == NULL) {
+        MethodStats* fresh = new MethodStats();
+        if (sig.stats.compare_exchange_strong(stats, fresh, std::memory_order_acq_rel)) {
+            stats = fresh;
+        } else {
+            delete fresh; // another thread won: stats holds its pointer
+        }
+    }
+    return *stats;
+}
+#endif
+
 typedef std::map<std::string, VM::SignatureBase*> methodLinkageCollection;
 
-class CJ {
-protected:
+// Immutable binding of a class: reflection, linkage and method IDs. CJ::setClass
+// builds a new one and publishes it; a published binding is never modified.
+class Binding {
+public:
+    std::string className;
+    jclass clazz; // global reference
     isNonUniqueCollection isNonUnique;
     methodReflectCollection methodReflect;
-    methodLinkageCollection methodLinkage;
+    methodLinkageCollection methodLinkage; // owns the signatures
+    mutable std::atomic<int> pins;         // snapshots using it
+    SignatureBase* find(const std::string&) const; // NULL if missing
+    Binding();
+    virtual ~Binding();
+private:
+    Binding(const Binding&);
+    Binding& operator=(const Binding&);
+};
 
-    std::string className;
+// A CJ can be shared between threads: calls read the current binding without
+// locks, and setClass (e.g. after a class loader reload) swaps in a new one.
+// Replaced bindings are freed once no call is using them.
+class CJ {
+protected:
+    std::atomic<Binding*> binding;
+    mutable std::atomic<int> pinning; // snapshots between loading and pinning a binding
+    std::mutex rebindMutex;
+    std::vector<Binding*> retired; // guarded by rebindMutex
+    std::atomic<bool> hasRetired;
+    void reclaim(); // with rebindMutex held
 
-    jclass clazz;
-    jobject obj;
-    void assignCollections();
-    void assignMethodReflectCollection();
-    void assignMethodLinkageCollection();
+    std::atomic<jobject> obj; // global reference, set by Constructor
+    void assignCollections(Binding*);
+    void assignMethodReflectCollection(Binding*);
+    void assignMethodLinkageCollection(Binding*);
+private:
+    CJ(const CJ&);
+    CJ& operator=(const CJ&);
 public:
+    // Pins the current binding for the lifetime of the scope
+    class Snapshot {
+    protected:
+        CJ& cj;
+        const Binding* current;
+    private:
+        Snapshot(const Snapshot&);
+        Snapshot& operator=(const Snapshot&);
+    public:
+        const Binding* get() const { return this->current; }
+        const Binding* operator->() const { return this->current; }
+        SignatureBase* getSignatureObj(const std::string&) const;
+        explicit Snapshot(CJ&);
+        ~Snapshot();
+    };
+
     static jint JNI_VERSION;
     //void setMSignature(std::string, std::string, bool);
     void printSignatures();
+#ifdef CJAY_METHOD_STATS
+    void printStats();
+    std::string getStatsText();
+    std::string getStatsJSON();
+    void resetStats();
+#endif
+    // Not pinned: getClass, getMap and getSignatureObj results are valid until
+    // the next setClass. Hold a Snapshot to use them across a concurrent rebind.
     jclass getClass();
     jobject getObj();
+    std::string getClassName();
     std::string getUniqueKey(std::string, std::string);
-    methodLinkageCollection getMap();
+    methodLinkageCollection getMap(); // valid until the next setClass
     std::string getDescriptor(std::string);
     jmethodID getMid(std::string);
     int getSizeSignatures();
+    // Binds the class, reusing the cached binding of a class bound before
+    // without checking it again: only addJar and addClass drop a cached
+    // binding, so that the next setClass reloads it.
     void setClass(std::string);
-    VM::SignatureBase* getSignatureObj(std::string);
+    void initializeClass();
+    VM::SignatureBase* getSignatureObj(std::string); // valid until the next setClass
+    // Creates the instance used by instance calls. The previous instance is
+    // released, so do not call it while other threads call through this CJ.
     void Constructor(std::string, ...);
     template <typename To> To call(std::string, ...);
-    template <typename To> To callStatic(jmethodID, va_list);
-    template <typename To> To callNonStatic(jmethodID, va_list);
+    jvalue callA(std::string, const jvalue*);
+    // target: the class (static) or the instance
+    template <typename To> To callStatic(jobject, jmethodID, va_list);
+    template <typename To> To callNonStatic(jobject, jmethodID, va_list);
+    int getRetiredCount();
     JNIEnv* getEnv();
     CJ();
     virtual ~CJ();
@@ -122,12 +444,16 @@ public:
 template <class To> class Signature : public SignatureBase {
 public:
     RV rv;
-    To (CJ::*pCall) (jmethodID, va_list);
+    To (CJ::*pCall) (jobject, jmethodID, va_list);
     Signature(std::string, std::string, bool, RV);
     Signature();
     virtual ~Signature();
 };
 
+// Bound by createVM(const VMConfig&) and freed by destroyVM; NULL if the
+// class was not preloaded. Thread-safe.
+CJ* getPreloadedClass(std::string);
+
 class ConverterBase {
 protected:
     CJ UTIL;
@@ -171,6 +497,112 @@ public:
 
 typedef std::vector<jobject> vec_jobj;
 
+template <typename To> class JavaRange;
+template <typename Array> class PooledArray;
+template <typename T> struct JavaArrayOf;
+class CallExecutor;
+
+// N-dimensional primitive array (T[][]..., rank >= 2) as one contiguous
+// row-major buffer. A jagged array is padded with zeros up to the longest
+// array of each dimension, and lengths keeps the actual length of every
+// array, per depth and in pre-order, so that the same structure can be
+// rebuilt. Null rows read as empty ones.
+template <typename T> class NDArray {
+public:
+    std::vector<T> data;
+    std::vector<jsize> shape;
+    std::vector<std::size_t> strides;          // in elements
+    std::vector<std::vector<jsize> > lengths;  // empty if rectangular
+
+    int rank() const { return (int) this->shape.size(); }
+    bool isJagged() const { return !this->lengths.empty(); }
+    void reshape(const std::vector<jsize>& shape) {
+        this->shape = shape;
+        this->strides.assign(shape.size(), 1);
+        for (int d = (int) shape.size() - 2; d >= 0; d--) { this->strides[d] = this->strides[d + 1] * shape[d + 1]; }
+        this->data.assign(shape.empty() ? 0 : this->strides[0] * shape[0], T());
+        this->lengths.clear();
+    }
+    template <typename... I> T& at(I... index) {
+        std::size_t idx[] = { (std::size_t) index... };
+        std::size_t offset = 0;
+        for (std::size_t d = 0; d < sizeof...(I); d++) { offset += idx[d] * this->strides[d]; }
+        return this->data[offset];
+    }
+};
+
+// Columnar table in one off-heap buffer, laid out as cjay.converter.RecordBatch
+// reads and writes it (native byte order, 8-byte aligned regions): a header,
+// one descriptor per column, then per column its name, a validity bitmap
+// (only if it has nulls), the values and, for strings, int32 offsets into
+// the UTF-8 text. Types are the JNI codes Z B C S I J F D, and T for strings.
+class RecordColumn {
+public:
+    std::string name;
+    char type;
+    jlong nullCount;
+    const std::uint8_t* validity; // bit i set: row i is not null; NULL without nulls
+    const void* data;             // values, or offsets[rows + 1] of a string column
+    const char* text;             // string columns only
+    bool isNull(jlong row) const {
+        return this->validity != NULL && !((this->validity[row >> 3] >> (row & 7)) & 1);
+    }
+    RecordColumn();
+};
+
+class RecordBatch {
+protected:
+    std::uint8_t* base;
+    std::size_t size;
+    bool owned;     // allocated by RecordBatchBuilder
+    jobject buffer; // Java owner of the memory (global reference), or NULL
+    jlong rows;
+    std::vector<RecordColumn> columns;
+    void parse();
+    friend class RecordBatchBuilder;
+private:
+    RecordBatch(const RecordBatch&);
+    RecordBatch& operator=(const RecordBatch&);
+public:
+    static const std::int32_t MAGIC = 0x42524A43; // "CJRB"
+    static const std::int32_t VERSION = 1;
+    jlong numRows() const { return this->rows; }
+    int numColumns() const { return (int) this->columns.size(); }
+    const RecordColumn& column(int) const;
+    int columnIndex(const std::string&) const; // -1 if missing
+    template <typename T> const T* values(int) const; // throws unless the column holds T
+    std::string getString(int, jlong) const;       // "" for a null row
+    const void* data() const { return this->base; }
+    std::size_t byteSize() const { return this->size; }
+    jobject getBuffer() const { return this->buffer; }
+    // View over memory in this layout; owner (a Java buffer) is kept alive
+    RecordBatch(const void*, std::size_t, jobject owner = NULL);
+    RecordBatch(RecordBatch&&);
+    RecordBatch();
+    virtual ~RecordBatch();
+};
+
+class RecordBatchBuilder {
+protected:
+    struct Column {
+        std::string name;
+        char type;
+        std::vector<std::uint8_t> values;
+        std::vector<std::int32_t> offsets; // string columns
+        std::string text;                  // string columns
+        std::vector<bool> valid;           // empty without nulls
+    };
+    std::vector<Column> columns;
+    jlong rows;
+    Column& addColumn(const std::string&, char, std::size_t, const std::vector<bool>&);
+public:
+    // valid[i] false: row i is null (empty: no nulls). All columns have the same length.
+    template <typename T> RecordBatchBuilder& add(std::string, const std::vector<T>&, const std::vector<bool>& valid = std::vector<bool>());
+    RecordBatchBuilder& add(std::string, const std::vector<std::string>&, const std::vector<bool>& valid = std::vector<bool>());
+    RecordBatch build(); // a single allocation
+    RecordBatchBuilder();
+};
+
 class Converter : public ConverterBase {
 protected:
     void initUTIL();
@@ -195,9 +627,14 @@ protected:
 
     jobject getKeysOfMap(jobject);
     jobject getValuesOfMap(jobject);
+
+    jclass arrayClasses[9]; // Object[] and the primitive arrays, global references bound on first use
 public:
     template <typename To, typename From> To j_cast(From);
     template <typename To> To c_cast(jobject);
+    // Method ID of the unboxing call of c_cast<To> (primitive To), resolved
+    // once for loops over many elements
+    template <typename To> jmethodID unboxMethod();
 
     template <typename To, typename From> std::vector<To> c_cast_array(From);
     template <typename To> std::vector<To> c_cast_vector(jobject);
@@ -205,6 +642,77 @@ public:
 
     template <typename K, typename V> std::map<K, V> c_cast_map(jobject);
 
+    // T[][]... as a row-major buffer; flattenInJava copies a rectangular
+    // array with a single call to cjay.converter.Util.flatten
+    template <typename T> NDArray<T> c_cast_ndarray(jobjectArray, bool flattenInJava = false);
+    template <typename T> jobjectArray j_cast_ndarray(const NDArray<T>&);
+
+    // Columnar batch sharing its memory with a cjay.converter.RecordBatch (or a
+    // direct ByteBuffer in that layout): no per-value JNI call, no boxing.
+    // The Java object of j_cast_batch must not outlive the batch.
+    RecordBatch c_cast_batch(jobject);
+    jobject j_cast_batch(const RecordBatch&);
+
+    // boolean[] as a bitset: bit i of word i / 64 is element i
+    std::vector<std::uint64_t> c_cast_bits(jbooleanArray);
+    jbooleanArray j_cast_bits(const std::vector<std::uint64_t>&, jsize);
+
+    // T[] taken from ArrayPool and filled with one region copy. The array may
+    // be longer than the data: pass size() along to the Java callee, which
+    // must not keep the array once the handle is gone.
+    template <typename T> PooledArray<typename JavaArrayOf<T>::type> j_cast_pooled(const T*, jsize);
+    template <typename T> PooledArray<typename JavaArrayOf<T>::type> j_cast_pooled(const std::vector<T>&);
+
+    // Conversions into memory owned by the caller: a pre-sized buffer, an
+    // output iterator or an existing container (whose allocator is used)
+    template <typename To, typename From> jsize c_cast_array_into(From, To*, jsize);
+    template <typename To, typename From, typename OutputIt> OutputIt c_cast_array_into(From, OutputIt);
+    template <typename To, typename OutputIt> OutputIt c_cast_vector_into(jobject, OutputIt);
+    template <typename Map> void c_cast_map_into(jobject, Map&);
+    template <typename Str> void c_cast_string_into(jobject, Str&);
+#if defined(__cpp_lib_span)
+    template <typename To, typename From> jsize c_cast_array_into(From, std::span<To>);
+#endif
+#if defined(__cpp_lib_memory_resource)
+    template <typename To, typename From> std::pmr::vector<To> c_cast_array(From, std::pmr::memory_resource*);
+    template <typename To> std::pmr::vector<To> c_cast_vector(jobject, std::pmr::memory_resource*);
+    template <typename K, typename V> std::pmr::map<K, V> c_cast_map(jobject, std::pmr::memory_resource*);
+#endif
+
+    // Object[] or Collection (copied once to an Object[]) converted in ranges
+    // of at least grain elements: the calling thread takes the first range and
+    // the workers of the executor the others, each in its own local frame and
+    // into its own part of the output. Not to be called from a worker of the
+    // same executor.
+    template <typename To> std::vector<To> c_cast_parallel(jobject, CallExecutor&, jsize grain = 65536);
+    template <typename To> jsize c_cast_parallel_into(jobject, To*, jsize, CallExecutor&, jsize grain = 65536);
+
+    // Lazy view of a java.lang.Iterable (List, Set, ...) or java.util.Iterator,
+    // fetched and converted chunkSize elements at a time
+    template <typename To> JavaRange<To> c_range(jobject, jsize chunkSize = 4096);
+    template <typename To> jobject newRangeBuffer(jsize);
+    template <typename To> jsize fillRange(jobject, jobject, std::vector<To>&);
+    jobject getIterator(jobject);
+
+    // Conversion through the jconvert<T> traits, e.g.
+    // c_convert<std::vector<std::map<std::string, jlong> > >(x)
+    // Nested Collection, Map, array and boxed values serialized by
+    // cjay.converter.Packer in one call, then decoded as T (see junpack)
+    // without any further JNI call. Types junpack cannot decode, such as
+    // a user type with only a jconvert, go through c_convert instead.
+    template <typename T> T c_cast_nested(jobject);
+    std::vector<char> packNested(jobject);
+
+    template <typename T> T c_convert(jobject);
+    template <typename T> jobject j_convert(const T&); // local reference
+    // Building blocks of the jconvert specializations: one JNI call each
+    jobjectArray toObjectArray(jobject);  // elements of a Collection, or the Object[] itself
+    jobjectArray mapEntries(jobject);     // [key0, value0, key1, value1, ...]
+    jobjectArray newObjectArray(jsize);
+    jobject newList(jobjectArray);        // java.util.ArrayList
+    jobject newMap(jobjectArray);         // java.util.HashMap from [key0, value0, ...]
+    jclass arrayClass(char);              // class of a primitive array, e.g. 'I' for int[]
+
     int sizeVector(jobject);
     int sizeMap(jobject);
     void deleteRef(jobject);
@@ -222,6 +730,47 @@ public:
     virtual ~Handler();
 };
 
+// JNI accounting. JNITrace::install() swaps the function table of the calling
+// thread's VM::env for one that counts every JNI function invoked through it,
+// together with the local and global references created and deleted. Other
+// threads keep the original table until they call install themselves, and
+// uninstall only restores the calling thread.
+class JNICounters {
+public:
+    std::vector<jlong> calls; // indexed by JNITrace function id
+    jlong localRefsCreated;
+    jlong localRefsDeleted;
+    jlong globalRefsCreated;
+    jlong globalRefsDeleted;
+    jlong totalCalls() const;
+    jlong callsTo(std::string) const;
+    jlong localRefsLeaked() const; // created minus deleted, PopLocalFrame included
+    std::string toText() const;
+    JNICounters operator-(const JNICounters&) const;
+    JNICounters();
+};
+
+class JNITrace {
+public:
+    static void install();
+    static void uninstall();
+    static bool isInstalled();
+    static JNICounters counters(); // calling thread, cumulative
+    static jlong globalRefsOutstanding(); // all threads
+    static std::size_t numFunctions();
+    static std::string functionName(std::size_t);
+};
+
+// JNI traffic of the calling thread during the lifetime of the scope,
+// typically wrapped around a single CJay API call.
+class JNITraceScope {
+protected:
+    JNICounters begin;
+public:
+    JNICounters delta() const;
+    JNITraceScope();
+};
+
 class HandlerExc: public std::exception {
 private:
     std::string msg;
@@ -231,6 +780,1303 @@ public:
     const char* what() const throw() { return msg.c_str(); }
 };
 
+// Input range over a Java Iterable or Iterator (see Converter::c_range).
+// Memory is bounded by the chunk size. Elements of type jobject are local
+// references owned by the caller. Use jboolean rather than bool.
+template <typename To> class JavaRange {
+protected:
+    Converter* cnv;
+    jobject iter;
+    jobject buffer;
+    jsize chunkSize;
+    std::vector<To> chunk;
+    std::size_t pos;
+    bool started;
+    bool exhausted;
+
+    bool fetch() {
+        this->chunk.clear();
+        this->pos = 0;
+        jsize n = this->cnv->template fillRange<To>(this->iter, this->buffer, this->chunk);
+        this->exhausted = (n < this->chunkSize);
+        return n > 0;
+    }
+
+    bool advance() {
+        if (++this->pos < this->chunk.size()) { return true; }
+        return !this->exhausted && this->fetch();
+    }
+private:
+    JavaRange(const JavaRange&);
+    JavaRange& operator=(const JavaRange&);
+public:
+    class iterator {
+    protected:
+        JavaRange* range;
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef To value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const To* pointer;
+        typedef const To& reference;
+
+        iterator(JavaRange* range = NULL) : range(range) { }
+        reference operator*() const { return this->range->chunk[this->range->pos]; }
+        pointer operator->() const { return &this->range->chunk[this->range->pos]; }
+        iterator& operator++() {
+            if (!this->range->advance()) { this->range = NULL; }
+            return *this;
+        }
+        void operator++(int) { ++(*this); }
+        bool operator==(const iterator& other) const { return this->range == other.range; }
+        bool operator!=(const iterator& other) const { return this->range != other.range; }
+    };
+
+    iterator begin() {
+        if (!this->started) {
+            this->started = true;
+            if (!this->fetch()) { return this->end(); }
+        }
+        return (this->pos < this->chunk.size()) ? iterator(this) : this->end();
+    }
+
+    iterator end() { return iterator(); }
+
+    JavaRange(Converter* cnv, jobject iterableOrIterator, jsize chunkSize) :
+        cnv(cnv), iter(NULL), buffer(NULL), chunkSize(chunkSize), pos(0), started(false), exhausted(false) {
+        if (chunkSize <= 0) {
+            throw HandlerExc("CJay: JavaRange chunk size must be positive.");
+        }
+        jobject local = cnv->getIterator(iterableOrIterator);
+        this->iter = env->NewGlobalRef(local);
+        env->DeleteLocalRef(local);
+        this->buffer = cnv->template newRangeBuffer<To>(chunkSize);
+        this->chunk.reserve(chunkSize);
+    }
+
+    JavaRange(JavaRange&& other) :
+        cnv(other.cnv), iter(other.iter), buffer(other.buffer), chunkSize(other.chunkSize),
+        chunk(std::move(other.chunk)), pos(other.pos), started(other.started), exhausted(other.exhausted) {
+        other.iter = NULL;
+        other.buffer = NULL;
+    }
+
+    virtual ~JavaRange() {
+        if (env != NULL) {
+            if (this->iter != NULL) { env->DeleteGlobalRef(this->iter); }
+            if (this->buffer != NULL) { env->DeleteGlobalRef(this->buffer); }
+        }
+    }
+};
+
+template <typename To> JavaRange<To> Converter::c_range(jobject jobj, jsize chunkSize) {
+    return JavaRange<To>(this, jobj, chunkSize);
+}
+
+/**
+ ** Conversions into caller-owned memory
+ **/
+
+// Element type, descriptor and region access of each primitive Java array type
+template <typename Array> struct JavaArray;
+template <typename T> struct JavaArrayOf;
+
+#define CJAY_JAVA_ARRAY(Type, JType, Code) \
+template <> struct JavaArray<JType##Array> { \
+    typedef JType element_type; \
+    static char code() { return Code; } \
+    static void getRegion(JType##Array x, jsize start, jsize n, JType* out) { env->Get##Type##ArrayRegion(x, start, n, out); } \
+    static void setRegion(JType##Array x, jsize start, jsize n, const JType* in) { env->Set##Type##ArrayRegion(x, start, n, in); } \
+    static JType##Array newArray(jsize n) { return env->New##Type##Array(n); } \
+}; \
+template <> struct JavaArrayOf<JType> { typedef JType##Array type; };
+CJAY_JAVA_ARRAY(Boolean, jboolean, 'Z')
+CJAY_JAVA_ARRAY(Byte, jbyte, 'B')
+CJAY_JAVA_ARRAY(Char, jchar, 'C')
+CJAY_JAVA_ARRAY(Short, jshort, 'S')
+CJAY_JAVA_ARRAY(Int, jint, 'I')
+CJAY_JAVA_ARRAY(Long, jlong, 'J')
+CJAY_JAVA_ARRAY(Float, jfloat, 'F')
+CJAY_JAVA_ARRAY(Double, jdouble, 'D')
+#undef CJAY_JAVA_ARRAY
+
+// Primitive Java arrays kept as global references and reused across calls,
+// one pool per array type. Lengths are rounded up to a power of two (16 to
+// 2^20 elements) and each size class keeps at most maxPerClass free arrays.
+// Longer arrays are allocated and freed as usual.
+template <typename Array> class ArrayPool {
+protected:
+    std::mutex mutex;
+    std::vector<std::vector<Array> > classes; // free arrays, by size class
+    std::size_t maxPerClass;
+    std::atomic<std::uint64_t> hits;
+    std::atomic<std::uint64_t> misses;
+    ArrayPool();
+public:
+    static const int MIN_CLASS_BITS = 4;
+    static const int MAX_CLASS_BITS = 20;
+    static ArrayPool& instance();
+    static int sizeClass(jsize); // -1 if not pooled
+    PooledArray<Array> acquire(jsize);
+    void release(Array, int sizeClass); // takes over the global reference
+    void setMaxPerClass(std::size_t);
+    std::size_t pooledCount();
+    std::uint64_t getHits() const { return this->hits.load(); }
+    std::uint64_t getMisses() const { return this->misses.load(); }
+    void clear(); // frees the pooled arrays; done by destroyVM
+};
+
+// Array lent by an ArrayPool; returned to it on destruction
+template <typename Array> class PooledArray {
+protected:
+    Array array; // global reference
+    jsize length;
+    int sizeClass;
+    friend class ArrayPool<Array>;
+    PooledArray(Array array, jsize length, int sizeClass) : array(array), length(length), sizeClass(sizeClass) { }
+private:
+    PooledArray(const PooledArray&);
+    PooledArray& operator=(const PooledArray&);
+public:
+    Array get() const { return this->array; }
+    jsize size() const { return this->length; } // elements in use
+    jsize capacity() const { return (this->sizeClass < 0) ? this->length : (jsize) 1 << (this->sizeClass + ArrayPool<Array>::MIN_CLASS_BITS); }
+
+    PooledArray(PooledArray&& other) : array(other.array), length(other.length), sizeClass(other.sizeClass) {
+        other.array = NULL;
+    }
+
+    virtual ~PooledArray() {
+        if (this->array == NULL || env == NULL) { return; }
+        if (this->sizeClass < 0) {
+            env->DeleteGlobalRef(this->array);
+        } else {
+            ArrayPool<Array>::instance().release(this->array, this->sizeClass);
+        }
+    }
+};
+
+// Assign a converted element; strings reuse the capacity and allocator of the slot
+template <typename To> inline void convertInto(Converter* cnv, jobject e, To& slot) {
+    slot = cnv->c_cast<To>(e);
+}
+
+template <typename C, typename T, typename A> inline void convertInto(Converter* cnv, jobject e, std::basic_string<C, T, A>& slot) {
+    cnv->c_cast_string_into(e, slot);
+}
+
+// Primitive conversion with Java semantics (JLS 5.1.3) where static_cast is
+// undefined: a floating value gives 0 for NaN and saturates at the range of
+// an integral To. Other conversions are a static_cast.
+template <typename To, typename From> inline To javaCast(From x, std::false_type) {
+    return static_cast<To>(x);
+}
+
+template <typename To, typename From> inline To javaCast(From x, std::true_type) {
+    if (x != x) { return 0; }
+    if (x <= (From) std::numeric_limits<To>::min()) { return std::numeric_limits<To>::min(); }
+    if (x >= (From) std::numeric_limits<To>::max()) { return std::numeric_limits<To>::max(); }
+    return static_cast<To>(x);
+}
+
+template <typename To, typename From> inline To javaCast(From x) {
+    return javaCast<To>(x, std::integral_constant<bool, std::is_floating_point<From>::value
+            && std::is_integral<To>::value && !std::is_same<To, bool>::value>());
+}
+
+// Element-wise javaCast, vectorized (SSE2/AVX2/AVX-512, picked at run time)
+// for the common numeric conversions
+template <typename To, typename From> void convertArray(const From*, To*, std::size_t);
+template <> void convertArray(const jfloat*, jdouble*, std::size_t);
+template <> void convertArray(const jdouble*, jfloat*, std::size_t);
+template <> void convertArray(const jint*, jdouble*, std::size_t);
+template <> void convertArray(const jint*, jfloat*, std::size_t);
+template <> void convertArray(const jint*, jlong*, std::size_t);
+const char* getSimdLevel();
+
+// GetPrimitiveArrayCritical result; throws (clearing the OutOfMemoryError) on NULL
+inline void* criticalArray(jarray x) {
+    void* p = env->GetPrimitiveArrayCritical(x, NULL);
+    if (p == NULL) {
+        env->ExceptionClear();
+        throw HandlerExc("JNI: GetPrimitiveArrayCritical failed.");
+    }
+    return p;
+}
+
+template <typename To, typename From> inline void copyArrayRegion(From x, jsize n, To* out, std::true_type) {
+    JavaArray<From>::getRegion(x, 0, n, out);
+}
+
+template <typename To, typename From> inline void copyArrayRegion(From x, jsize n, To* out, std::false_type) {
+    typedef typename JavaArray<From>::element_type T;
+    if (n == 0) { return; }
+    const T* src = static_cast<const T*>(criticalArray(x)); // no copy, no JNI call until released
+    convertArray(src, out, n);
+    env->ReleasePrimitiveArrayCritical(x, const_cast<T*>(src), JNI_ABORT);
+}
+
+template <typename To, typename From> inline void copyArrayRegion(Converter*, From x, jsize n, To* out) {
+    copyArrayRegion(x, n, out, std::is_same<To, typename JavaArray<From>::element_type>());
+}
+
+template <typename To> inline void copyArrayRegion(Converter* cnv, jobjectArray x, jsize n, To* out) {
+    for (jsize i = 0; i < n; i++) {
+        jobject e = env->GetObjectArrayElement(x, i);
+        convertInto(cnv, e, out[i]);
+        if (!std::is_same<To, jobject>::value) { env->DeleteLocalRef(e); }
+    }
+}
+
+template <typename To, typename From> jsize Converter::c_cast_array_into(From x, To* out, jsize capacity) {
+    jsize size = env->GetArrayLength(x);
+    copyArrayRegion(this, x, std::min(size, capacity), out);
+    return size; // larger than capacity if truncated
+}
+
+template <typename To, typename From, typename OutputIt>
+OutputIt copyArrayInto(Converter*, From x, OutputIt out) {
+    typedef typename JavaArray<From>::element_type T;
+    T chunk[512]; // copied through the stack: no allocation
+    jsize size = env->GetArrayLength(x);
+    for (jsize start = 0; start < size; start += 512) {
+        jsize n = std::min<jsize>(512, size - start);
+        JavaArray<From>::getRegion(x, start, n, chunk);
+        for (jsize i = 0; i < n; i++) { *out++ = javaCast<To>(chunk[i]); }
+    }
+    return out;
+}
+
+template <typename To, typename OutputIt>
+OutputIt copyArrayInto(Converter* cnv, jobjectArray x, OutputIt out) {
+    jsize size = env->GetArrayLength(x);
+    To value;
+    for (jsize i = 0; i < size; i++) {
+        jobject e = env->GetObjectArrayElement(x, i);
+        convertInto(cnv, e, value);
+        *out++ = value;
+        if (!std::is_same<To, jobject>::value) { env->DeleteLocalRef(e); }
+    }
+    return out;
+}
+
+template <typename To, typename From, typename OutputIt> OutputIt Converter::c_cast_array_into(From x, OutputIt out) {
+    return copyArrayInto<To>(this, x, out);
+}
+
+template <typename To, typename OutputIt> OutputIt Converter::c_cast_vector_into(jobject jobj, OutputIt out) {
+    jmethodID mid = this->ARRAYLIST.getSignatureObj("get")->mid;
+    int size = this->sizeVector(jobj);
+    To value; // reused for every element
+    for (int i = 0; i < size; i++) {
+        jobject e = env->CallObjectMethod(jobj, mid, (jint) i);
+        convertInto(this, e, value);
+        *out++ = value;
+        if (!std::is_same<To, jobject>::value) { env->DeleteLocalRef(e); }
+    }
+    return out;
+}
+
+template <typename Map> void Converter::c_cast_map_into(jobject jmap, Map& out) {
+    typename Map::key_type k;
+    typename Map::mapped_type v;
+    jmethodID mid = this->ARRAYLIST.getSignatureObj("get")->mid;
+    jobject keys = this->getKeysOfMap(jmap);
+    jobject values = this->getValuesOfMap(jmap);
+    int size = this->sizeVector(keys);
+    for (int i = 0; i < size; i++) {
+        jobject ek = env->CallObjectMethod(keys, mid, (jint) i);
+        jobject ev = env->CallObjectMethod(values, mid, (jint) i);
+        convertInto(this, ek, k);
+        convertInto(this, ev, v);
+        out.emplace(k, v);
+        if (!std::is_same<typename Map::key_type, jobject>::value) { env->DeleteLocalRef(ek); }
+        if (!std::is_same<typename Map::mapped_type, jobject>::value) { env->DeleteLocalRef(ev); }
+    }
+    env->DeleteLocalRef(keys);
+    env->DeleteLocalRef(values);
+}
+
+template <typename Str> void toUTF8(jstring str, Str& out) {
+    jsize length = env->GetStringLength(str);
+    out.resize(3 * (std::size_t) length); // worst case
+    if (length == 0) { return; }
+    std::size_t n;
+    if (length <= 256) { // short: copied to the stack
+        jchar units[256];
+        env->GetStringRegion(str, 0, length, units);
+        n = utf16ToUtf8(units, length, &out[0]);
+    } else { // long: transcoded in place, no JNI call until released
+        const jchar* units = env->GetStringCritical(str, NULL);
+        if (units == NULL) {
+            env->ExceptionClear(); // OutOfMemoryError
+            out.clear();
+            throw HandlerExc("JNI: GetStringCritical failed.");
+        }
+        n = utf16ToUtf8(units, length, &out[0]);
+        env->ReleaseStringCritical(str, units);
+    }
+    out.resize(n);
+}
+
+template <typename Str> void Converter::c_cast_string_into(jobject jobj, Str& out) {
+    toUTF8((jstring) jobj, out);
+}
+
+#if defined(__cpp_lib_span)
+template <typename To, typename From> jsize Converter::c_cast_array_into(From x, std::span<To> out) {
+    return this->c_cast_array_into<To>(x, out.data(), (jsize) out.size());
+}
+#endif
+
+#if defined(__cpp_lib_memory_resource)
+template <typename To, typename From> std::pmr::vector<To> Converter::c_cast_array(From x, std::pmr::memory_resource* mr) {
+    std::pmr::vector<To> v(env->GetArrayLength(x), mr);
+    if (!v.empty()) { this->c_cast_array_into<To>(x, v.data(), (jsize) v.size()); }
+    return v;
+}
+
+template <typename To> std::pmr::vector<To> Converter::c_cast_vector(jobject jobj, std::pmr::memory_resource* mr) {
+    std::pmr::vector<To> v(mr);
+    v.reserve(this->sizeVector(jobj));
+    this->c_cast_vector_into<To>(jobj, std::back_inserter(v));
+    return v;
+}
+
+template <typename K, typename V> std::pmr::map<K, V> Converter::c_cast_map(jobject jmap, std::pmr::memory_resource* mr) {
+    std::pmr::map<K, V> m(mr);
+    this->c_cast_map_into(jmap, m);
+    return m;
+}
+#endif
+
+/**
+ ** Conversion traits
+ **/
+
+// Extension point of Converter::c_convert and j_convert. Specialize
+// jconvert<T> for a C++ type T with
+//   static T from_java(Converter&, jobject);      // any reference; boxed for primitives
+//   static jobject to_java(Converter&, const T&); // new local reference
+// Specializations compose: std::vector<T> (from a Collection or an array, to
+// an ArrayList), std::map and std::unordered_map<K, V> (to a HashMap) use the
+// jconvert of their elements, so nested types resolve at compile time with
+// no virtual dispatch. Enable allows partial specializations with enable_if.
+template <typename T, typename Enable = void> struct jconvert;
+
+// Fast path of std::vector<T>: a primitive T[] is read with one region copy
+template <typename T> struct jconvertArray {
+    template <typename V> static bool read(Converter&, jobject, V&) { return false; }
+};
+
+// Boxed primitives, defined in CJay.cpp after the c_cast and j_cast specializations
+#define CJAY_JCONVERT_PRIMITIVE(JType) \
+template <> struct jconvert<JType> { \
+    static JType from_java(Converter&, jobject); \
+    static jobject to_java(Converter&, const JType&); \
+}; \
+template <> struct jconvertArray<JType> { \
+    template <typename V> static bool read(Converter& cnv, jobject x, V& out) { \
+        typedef JavaArrayOf<JType>::type Array; \
+        if (!env->IsInstanceOf(x, cnv.arrayClass(JavaArray<Array>::code()))) { return false; } \
+        out.resize(env->GetArrayLength((jarray) x)); \
+        if (!out.empty()) { JavaArray<Array>::getRegion((Array) x, 0, (jsize) out.size(), &out[0]); } \
+        return true; \
+    } \
+};
+CJAY_JCONVERT_PRIMITIVE(jboolean)
+CJAY_JCONVERT_PRIMITIVE(jbyte)
+CJAY_JCONVERT_PRIMITIVE(jchar)
+CJAY_JCONVERT_PRIMITIVE(jshort)
+CJAY_JCONVERT_PRIMITIVE(jint)
+CJAY_JCONVERT_PRIMITIVE(jlong)
+CJAY_JCONVERT_PRIMITIVE(jfloat)
+CJAY_JCONVERT_PRIMITIVE(jdouble)
+#undef CJAY_JCONVERT_PRIMITIVE
+
+template <> struct jconvert<bool> {
+    static bool from_java(Converter& cnv, jobject x) { return jconvert<jboolean>::from_java(cnv, x) != JNI_FALSE; }
+    static jobject to_java(Converter& cnv, const bool& x) { return jconvert<jboolean>::to_java(cnv, (jboolean) x); }
+};
+
+template <> struct jconvert<std::string> {
+    static std::string from_java(Converter&, jobject x) { return (x == NULL) ? std::string() : toUTF8((jstring) x); }
+    static jobject to_java(Converter&, const std::string& x) { return newJavaString(x.data(), x.size()); }
+};
+
+// Kept as is: the element references of a collection are not deleted
+template <> struct jconvert<jobject> {
+    static jobject from_java(Converter&, jobject x) { return x; }
+    static jobject to_java(Converter&, const jobject& x) { return env->NewLocalRef(x); }
+};
+
+template <typename T> inline void jconvertRelease(jobject x) {
+    if (!std::is_same<T, jobject>::value && x != NULL) { env->DeleteLocalRef(x); }
+}
+
+template <typename T, typename A> struct jconvert<std::vector<T, A> > {
+    static std::vector<T, A> from_java(Converter& cnv, jobject x) {
+        std::vector<T, A> v;
+        if (x == NULL || jconvertArray<T>::read(cnv, x, v)) { return v; }
+        jobjectArray elements = cnv.toObjectArray(x);
+        jsize n = env->GetArrayLength(elements);
+        v.reserve(n);
+        for (jsize i = 0; i < n; i++) {
+            jobject e = env->GetObjectArrayElement(elements, i);
+            v.push_back(jconvert<T>::from_java(cnv, e));
+            jconvertRelease<T>(e);
+        }
+        env->DeleteLocalRef(elements);
+        return v;
+    }
+
+    static jobject to_java(Converter& cnv, const std::vector<T, A>& x) {
+        jobjectArray elements = cnv.newObjectArray((jsize) x.size());
+        for (std::size_t i = 0; i < x.size(); i++) {
+            jobject e = jconvert<T>::to_java(cnv, x[i]);
+            env->SetObjectArrayElement(elements, (jsize) i, e);
+            if (e != NULL) { env->DeleteLocalRef(e); }
+        }
+        jobject list = cnv.newList(elements);
+        env->DeleteLocalRef(elements);
+        return list;
+    }
+};
+
+// Shared by the map types
+template <typename Map> struct jconvertMap {
+    typedef typename Map::key_type K;
+    typedef typename Map::mapped_type V;
+
+    static Map from_java(Converter& cnv, jobject x) {
+        Map m;
+        if (x == NULL) { return m; }
+        jobjectArray entries = cnv.mapEntries(x);
+        jsize n = env->GetArrayLength(entries);
+        for (jsize i = 0; i + 1 < n; i += 2) {
+            jobject k = env->GetObjectArrayElement(entries, i);
+            jobject v = env->GetObjectArrayElement(entries, i + 1);
+            m.insert(std::make_pair(jconvert<K>::from_java(cnv, k), jconvert<V>::from_java(cnv, v)));
+            jconvertRelease<K>(k);
+            jconvertRelease<V>(v);
+        }
+        env->DeleteLocalRef(entries);
+        return m;
+    }
+
+    static jobject to_java(Converter& cnv, const Map& x) {
+        jobjectArray entries = cnv.newObjectArray((jsize) (2 * x.size()));
+        jsize i = 0;
+        for (const auto& kv : x) {
+            jobject k = jconvert<K>::to_java(cnv, kv.first);
+            jobject v = jconvert<V>::to_java(cnv, kv.second);
+            env->SetObjectArrayElement(entries, i++, k);
+            env->SetObjectArrayElement(entries, i++, v);
+            if (k != NULL) { env->DeleteLocalRef(k); }
+            if (v != NULL) { env->DeleteLocalRef(v); }
+        }
+        jobject map = cnv.newMap(entries);
+        env->DeleteLocalRef(entries);
+        return map;
+    }
+};
+
+template <typename K, typename V, typename C, typename A> struct jconvert<std::map<K, V, C, A> >
+    : jconvertMap<std::map<K, V, C, A> > { };
+
+template <typename K, typename V, typename H, typename E, typename A> struct jconvert<std::unordered_map<K, V, H, E, A> >
+    : jconvertMap<std::unordered_map<K, V, H, E, A> > { };
+
+template <typename T> inline T Converter::c_convert(jobject x) {
+    return jconvert<T>::from_java(*this, x);
+}
+
+template <typename T> inline jobject Converter::j_convert(const T& x) {
+    return jconvert<T>::to_java(*this, x);
+}
+
+/**
+ ** Packed nested conversion
+ **/
+
+// Cursor over the bytes of cjay.converter.Packer: one tag per value, then
+// its payload in native byte order. Throws HandlerExc past the end.
+class PackedReader {
+public:
+    PackedReader(const char* data, std::size_t size) : pos(data), end(data + size) { }
+
+    char tag() { return *this->take(1); }
+    jsize count();
+    const char* take(std::size_t);
+    bool atEnd() const { return this->pos == this->end; }
+
+    template <typename T> T value() {
+        T x;
+        std::memcpy(&x, this->take(sizeof(T)), sizeof(T));
+        return x;
+    }
+
+    // Any boxed primitive (tag) converted to T with Java semantics
+    template <typename T> T number(char tag) {
+        switch (tag) {
+            case 'Z': return javaCast<T>(this->value<jboolean>());
+            case 'B': return javaCast<T>(this->value<jbyte>());
+            case 'C': return javaCast<T>(this->value<jchar>());
+            case 'S': return javaCast<T>(this->value<jshort>());
+            case 'I': return javaCast<T>(this->value<jint>());
+            case 'J': return javaCast<T>(this->value<jlong>());
+            case 'F': return javaCast<T>(this->value<jfloat>());
+            case 'D': return javaCast<T>(this->value<jdouble>());
+            default: throw mismatch(tag, "a number");
+        }
+    }
+
+    static HandlerExc mismatch(char, const char*);
+private:
+    const char* pos;
+    const char* end;
+};
+
+// Tag of the primitive arrays T can be copied from as is, 0 if none
+template <typename T> struct packedCode { static const char value = 0; };
+template <> struct packedCode<jboolean> { static const char value = 'Z'; };
+template <> struct packedCode<jbyte> { static const char value = 'B'; };
+template <> struct packedCode<jchar> { static const char value = 'C'; };
+template <> struct packedCode<jshort> { static const char value = 'S'; };
+template <> struct packedCode<jint> { static const char value = 'I'; };
+template <> struct packedCode<jlong> { static const char value = 'J'; };
+template <> struct packedCode<jfloat> { static const char value = 'F'; };
+template <> struct packedCode<jdouble> { static const char value = 'D'; };
+
+// Decoder of a packed value into T: static void read(PackedReader&, T&).
+// Provided for arithmetic types (from any boxed number), std::string,
+// std::vector, std::map and std::unordered_map, nested to any depth. null
+// reads as an empty string or container. packed is false when T, or a type
+// nested in it, has no decoder: c_cast_nested then falls back to jconvert<T>.
+template <typename T, typename Enable = void> struct junpack {
+    static const bool packed = false;
+};
+
+template <typename T> struct junpack<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+    static const bool packed = true;
+    static void read(PackedReader& in, T& out) { out = in.number<T>(in.tag()); }
+};
+
+template <typename C, typename T, typename A> struct junpack<std::basic_string<C, T, A> > {
+    static const bool packed = true;
+    static void read(PackedReader& in, std::basic_string<C, T, A>& out) {
+        char tag = in.tag();
+        if (tag == 'N') { out.clear(); return; }
+        if (tag != 'T' || sizeof(C) != 1) { throw PackedReader::mismatch(tag, "a string"); }
+        jsize n = in.count();
+        out.assign((const C*) in.take(n), n);
+    }
+};
+
+template <typename T, typename A> struct junpack<std::vector<T, A> > {
+    static const bool packed = junpack<T>::packed;
+    static void read(PackedReader& in, std::vector<T, A>& out) {
+        char tag = in.tag();
+        out.clear();
+        if (tag == 'N') { return; }
+        if (tag == '[') { return readArray(in, out, std::is_arithmetic<T>()); }
+        if (tag != 'L') { throw PackedReader::mismatch(tag, "a list"); }
+        jsize n = in.count();
+        out.reserve(n);
+        for (jsize i = 0; i < n; i++) {
+            T x;
+            junpack<T>::read(in, x);
+            out.push_back(std::move(x));
+        }
+    }
+
+    static void readArray(PackedReader& in, std::vector<T, A>& out, std::true_type) {
+        char code = in.tag();
+        jsize n = in.count();
+        if (code == packedCode<T>::value) { // same representation: one copy
+            out.resize(n);
+            if (n > 0) { std::memcpy(&out[0], in.take(n * sizeof(T)), n * sizeof(T)); }
+            return;
+        }
+        out.reserve(n);
+        for (jsize i = 0; i < n; i++) { out.push_back(in.number<T>(code)); }
+    }
+
+    static void readArray(PackedReader& in, std::vector<T, A>&, std::false_type) {
+        throw PackedReader::mismatch(in.tag(), "a list of objects");
+    }
+};
+
+template <typename Map> struct junpackMap {
+    static const bool packed = junpack<typename Map::key_type>::packed && junpack<typename Map::mapped_type>::packed;
+    static void read(PackedReader& in, Map& out) {
+        char tag = in.tag();
+        out.clear();
+        if (tag == 'N') { return; }
+        if (tag != 'M') { throw PackedReader::mismatch(tag, "a map"); }
+        jsize n = in.count();
+        for (jsize i = 0; i < n; i++) {
+            typename Map::key_type k;
+            typename Map::mapped_type v;
+            junpack<typename Map::key_type>::read(in, k);
+            junpack<typename Map::mapped_type>::read(in, v);
+            out.emplace(std::move(k), std::move(v));
+        }
+    }
+};
+
+template <typename K, typename V, typename C, typename A> struct junpack<std::map<K, V, C, A> >
+    : junpackMap<std::map<K, V, C, A> > { };
+
+template <typename K, typename V, typename H, typename E, typename A> struct junpack<std::unordered_map<K, V, H, E, A> >
+    : junpackMap<std::unordered_map<K, V, H, E, A> > { };
+
+template <typename T> T unpackNested(Converter& cnv, jobject x, std::true_type) {
+    std::vector<char> bytes = cnv.packNested(x);
+    PackedReader in(bytes.data(), bytes.size());
+    T out;
+    junpack<T>::read(in, out);
+    if (!in.atEnd()) {
+        throw HandlerExc("CJay: Packed structure has more values than the C++ type.");
+    }
+    return out;
+}
+
+template <typename T> T unpackNested(Converter& cnv, jobject x, std::false_type) {
+    return cnv.c_convert<T>(x);
+}
+
+template <typename T> T Converter::c_cast_nested(jobject x) {
+#ifdef CJAY_TRACING
+    TraceSpan span("c_cast_nested", "convert", Tracer::tracingCalls());
+#endif
+    return unpackNested<T>(*this, x, std::integral_constant<bool, junpack<T>::packed>());
+}
+
+// Local references of the calling thread are promoted to global ones, so
+// that results of calls executed on another thread remain valid.
+template <typename T>
+typename std::enable_if<std::is_convertible<T, jobject>::value, T>::type adoptRef(T x) {
+    if (x == NULL) { return x; }
+    T global = static_cast<T>(env->NewGlobalRef(x));
+    env->DeleteLocalRef(x);
+    return global;
+}
+
+template <typename T>
+typename std::enable_if<!std::is_convertible<T, jobject>::value, T>::type adoptRef(T x) {
+    return x;
+}
+
+// Pool of threads permanently attached to the JVM. Calls are queued on a
+// bounded per-worker deque; idle workers steal from the busy ones.
+// Reference arguments must be global references. Reference results are
+// returned as global references, which the caller must delete.
+class CallExecutor {
+protected:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+    struct Task {
+        std::function<void()> run;
+        std::function<void()> expire; // deadline passed before the call started
+        TimePoint deadline;
+    };
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> queue;
+    };
+    std::vector<std::unique_ptr<Worker> > workers;
+    std::vector<std::thread> threads;
+    std::size_t capacity;
+    std::atomic<std::size_t> pending;
+    std::atomic<std::size_t> nextWorker;
+    std::atomic<std::size_t> blockedSubmitters;
+    std::atomic<bool> stopping;
+    std::mutex stateMutex;
+    std::condition_variable hasWork;
+    std::condition_variable hasRoom;
+
+    bool push(Task&, bool);
+    bool pop(std::size_t, Task&);
+    void workerLoop(std::size_t);
+
+    template <typename F, typename R> static void complete(F&, std::promise<R>&);
+    template <typename F> static void complete(F&, std::promise<void>&);
+    template <typename F> Task makeTask(F, std::shared_ptr<std::promise<decltype(std::declval<F&>()())> >, TimePoint);
+    // Runs user code on a worker: what it throws is reported, not propagated
+    static void guard(const std::function<void()>&);
+public:
+    static TimePoint noDeadline() { return TimePoint::max(); }
+
+    // Blocks while every queue is full
+    template <typename F> std::future<decltype(std::declval<F&>()())> submit(F, TimePoint = noDeadline());
+    // Returns false instead of blocking while every queue is full
+    template <typename F> bool trySubmit(F, std::future<decltype(std::declval<F&>()())>&, TimePoint = noDeadline());
+    // Invokes callback on the worker thread with the ready future. Exceptions
+    // thrown by the callback are written to std::cerr.
+    template <typename F, typename C> void submitCallback(F, C, TimePoint = noDeadline());
+    // Bound CJay call, e.g. executor.call<jint>(cj, "parseInt", (jint) 1)
+    template <typename To, typename... Args> std::future<To> call(CJ&, std::string, Args...);
+    // Fire and forget, blocks while every queue is full
+    void post(std::function<void()>);
+
+    std::size_t size();
+    std::size_t queued();
+    CallExecutor(std::size_t, std::size_t = 1024);
+    virtual ~CallExecutor();
+};
+
+template <typename F, typename R> void CallExecutor::complete(F& f, std::promise<R>& promise) {
+    R result = f();
+    if (env->ExceptionCheck()) {
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+        throw HandlerExc("JNI: Java exception thrown by asynchronous call.");
+    }
+    promise.set_value(adoptRef(result));
+}
+
+template <typename F> void CallExecutor::complete(F& f, std::promise<void>& promise) {
+    f();
+    if (env->ExceptionCheck()) {
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+        throw HandlerExc("JNI: Java exception thrown by asynchronous call.");
+    }
+    promise.set_value();
+}
+
+template <typename F> CallExecutor::Task CallExecutor::makeTask(
+        F f, std::shared_ptr<std::promise<decltype(std::declval<F&>()())> > promise, TimePoint deadline) {
+    Task task;
+    task.run = [f, promise]() mutable {
+        // local references created by the call die with the frame
+        env->PushLocalFrame(16);
+        try {
+            complete(f, *promise);
+        } catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+        env->PopLocalFrame(NULL);
+    };
+    task.expire = [promise]() {
+        promise->set_exception(std::make_exception_ptr(
+                HandlerExc("CJay: Call deadline expired before execution.")));
+    };
+    task.deadline = deadline;
+    return task;
+}
+
+template <typename F> std::future<decltype(std::declval<F&>()())> CallExecutor::submit(F f, TimePoint deadline) {
+    typedef decltype(f()) R;
+    std::shared_ptr<std::promise<R> > promise(new std::promise<R>());
+    std::future<R> future = promise->get_future();
+    Task task = this->makeTask(f, promise, deadline);
+    this->push(task, true);
+    return future;
+}
+
+template <typename F> bool CallExecutor::trySubmit(
+        F f, std::future<decltype(std::declval<F&>()())>& future, TimePoint deadline) {
+    typedef decltype(f()) R;
+    std::shared_ptr<std::promise<R> > promise(new std::promise<R>());
+    Task task = this->makeTask(f, promise, deadline);
+    if (!this->push(task, false)) { return false; }
+    future = promise->get_future();
+    return true;
+}
+
+template <typename F, typename C> void CallExecutor::submitCallback(F f, C callback, TimePoint deadline) {
+    typedef decltype(f()) R;
+    std::shared_ptr<std::promise<R> > promise(new std::promise<R>());
+    std::shared_ptr<std::future<R> > future(new std::future<R>(promise->get_future()));
+    Task task = this->makeTask(f, promise, deadline);
+    std::function<void()> run = task.run;
+    std::function<void()> expire = task.expire;
+    task.run = [run, future, callback]() mutable { run(); guard([&]() { callback(std::move(*future)); }); };
+    task.expire = [expire, future, callback]() mutable { expire(); guard([&]() { callback(std::move(*future)); }); };
+    this->push(task, true);
+}
+
+template <typename To, typename... Args> std::future<To> CallExecutor::call(CJ& cj, std::string key, Args... args) {
+    CJ* target = &cj;
+    return this->submit([target, key, args...]() { return target->call<To>(key, args...); });
+}
+
+inline void callUnbox(jobject e, jmethodID mid, jboolean& slot) { slot = env->CallBooleanMethod(e, mid); }
+inline void callUnbox(jobject e, jmethodID mid, bool& slot) { slot = env->CallBooleanMethod(e, mid) != JNI_FALSE; }
+inline void callUnbox(jobject e, jmethodID mid, jbyte& slot) { slot = env->CallByteMethod(e, mid); }
+inline void callUnbox(jobject e, jmethodID mid, jchar& slot) { slot = env->CallCharMethod(e, mid); }
+inline void callUnbox(jobject e, jmethodID mid, jshort& slot) { slot = env->CallShortMethod(e, mid); }
+inline void callUnbox(jobject e, jmethodID mid, jint& slot) { slot = env->CallIntMethod(e, mid); }
+inline void callUnbox(jobject e, jmethodID mid, jlong& slot) { slot = env->CallLongMethod(e, mid); }
+inline void callUnbox(jobject e, jmethodID mid, jfloat& slot) { slot = env->CallFloatMethod(e, mid); }
+inline void callUnbox(jobject e, jmethodID mid, jdouble& slot) { slot = env->CallDoubleMethod(e, mid); }
+
+// Element conversion of a range. A primitive is unboxed through a method ID
+// resolved once: no binding snapshot, and no shared counter, per element.
+template <typename To, typename Enable = void> struct RangeElement {
+    Converter* cnv;
+    explicit RangeElement(Converter* cnv) : cnv(cnv) { }
+    void operator()(jobject e, To& slot) { convertInto(this->cnv, e, slot); }
+};
+
+template <typename To> struct RangeElement<To, typename std::enable_if<std::is_arithmetic<To>::value>::type> {
+    jmethodID mid;
+    explicit RangeElement(Converter* cnv) : mid(cnv->unboxMethod<To>()) { }
+    void operator()(jobject e, To& slot) { callUnbox(e, this->mid, slot); }
+};
+
+template <typename To> void convertArrayRange(Converter* cnv, jobjectArray x, jsize begin, jsize end, To* out) {
+    RangeElement<To> convert(cnv);
+    for (jsize i = begin; i < end; i++) {
+        jobject e = env->GetObjectArrayElement(x, i);
+        convert(e, out[i]);
+        env->DeleteLocalRef(e);
+    }
+}
+
+template <typename To> jsize Converter::c_cast_parallel_into(jobject x, To* out, jsize capacity, CallExecutor& executor, jsize grain) {
+    static_assert(!std::is_same<To, jobject>::value, "local references cannot leave the worker threads");
+    jobjectArray local = this->toObjectArray(x); // a new reference to x if already an Object[]
+    jsize size = env->GetArrayLength(local);
+    jsize n = std::min(size, capacity);
+    jsize ranges = std::min<jsize>((jsize) executor.size() + 1, (n + std::max<jsize>(grain, 1) - 1) / std::max<jsize>(grain, 1));
+    if (ranges <= 1) {
+        try {
+            convertArrayRange(this, local, 0, n, out);
+        } catch (...) {
+            env->DeleteLocalRef(local);
+            throw;
+        }
+        env->DeleteLocalRef(local);
+        return size;
+    }
+
+    jobjectArray array = (jobjectArray) env->NewGlobalRef(local); // shared with the workers
+    env->DeleteLocalRef(local);
+    std::vector<std::future<void> > parts;
+    std::exception_ptr error;
+    try {
+        for (jsize r = 1; r < ranges; r++) {
+            jsize begin = (jsize) ((std::int64_t) n * r / ranges);
+            jsize end = (jsize) ((std::int64_t) n * (r + 1) / ranges);
+            Converter* cnv = this;
+            parts.push_back(executor.submit([cnv, array, begin, end, out]() { convertArrayRange(cnv, array, begin, end, out); }));
+        }
+        convertArrayRange(this, array, 0, (jsize) ((std::int64_t) n / ranges), out);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    for (auto& part : parts) { part.wait(); } // no worker may write into out after returning
+    for (auto& part : parts) {
+        try { part.get(); } catch (...) { if (!error) { error = std::current_exception(); } }
+    }
+    env->DeleteGlobalRef(array);
+    if (error) { std::rethrow_exception(error); }
+    return size; // larger than capacity if truncated
+}
+
+template <typename To> std::vector<To> Converter::c_cast_parallel(jobject x, CallExecutor& executor, jsize grain) {
+    static_assert(!std::is_same<To, bool>::value, "std::vector<bool> cannot be written from several threads");
+    jobjectArray array = this->toObjectArray(x); // a List is copied only once
+    std::vector<To> out(env->GetArrayLength(array));
+    try {
+        if (!out.empty()) { this->c_cast_parallel_into(array, &out[0], (jsize) out.size(), executor, grain); }
+    } catch (...) {
+        env->DeleteLocalRef(array);
+        throw;
+    }
+    env->DeleteLocalRef(array);
+    return out;
+}
+
+// Completion of a java.util.concurrent.CompletionStage forwarded to native
+// code. The callback runs on the Java thread that completes the stage, with
+// the result as a global reference (or NULL) and the error message ("" on
+// success). If the stage is already complete it runs before listen returns.
+class JavaCompletion {
+public:
+    typedef std::function<void(jobject, std::string)> Callback;
+    static void listen(jobject, Callback);
+};
+
+#if defined(__cpp_impl_coroutine)
+// co_await-able CompletableFuture (C++20). The coroutine is resumed on the
+// executor if one is given, otherwise on the Java thread completing the
+// future. The result is converted with the Converter unless T is jobject,
+// in which case a global reference is returned.
+template <typename T = jobject> class JavaFuture {
+protected:
+    struct State {
+        std::coroutine_handle<> handle;
+        std::atomic<bool> done;
+        jobject value;
+        std::string error;
+        State() : done(false), value(NULL) { }
+    };
+    jobject future;
+    CallExecutor* executor;
+    Converter* cnv;
+    std::shared_ptr<State> state;
+public:
+    JavaFuture(jobject future, CallExecutor* executor = NULL, Converter* cnv = NULL) :
+        future(future), executor(executor), cnv(cnv), state(new State()) { }
+
+    bool await_ready() { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        std::shared_ptr<State> st = this->state;
+        CallExecutor* exec = this->executor;
+        st->handle = handle;
+        JavaCompletion::listen(this->future, [st, exec](jobject value, std::string error) {
+            st->value = value;
+            st->error = error;
+            if (st->done.exchange(true)) { // the coroutine is suspended
+                std::coroutine_handle<> h = st->handle;
+                if (exec != NULL) {
+                    exec->post([h]() { h.resume(); });
+                } else {
+                    h.resume();
+                }
+            }
+        });
+        // completed synchronously: do not suspend
+        return !st->done.exchange(true);
+    }
+
+    T await_resume() {
+        if (!this->state->error.empty()) {
+            throw HandlerExc("JNI: CompletableFuture completed exceptionally: " + this->state->error);
+        }
+        if constexpr (std::is_same<T, jobject>::value) {
+            return this->state->value;
+        } else {
+            if (this->cnv == NULL) {
+                throw HandlerExc("CJay: JavaFuture needs a Converter to convert the result.");
+            }
+            T result = this->cnv->template c_cast<T>(this->state->value);
+            if (this->state->value != NULL) { env->DeleteGlobalRef(this->state->value); }
+            return result;
+        }
+    }
+};
+#endif
+
+// C++ handlers fed from Java through a cjay.callback.NativeSink, so that
+// Java code can stream results into native code as they are produced.
+// Handlers run on the pushing Java thread, and an exception they throw is
+// rethrown in Java as a RuntimeException. Array handlers get a copy of the
+// pushed slice, so they may call JNI or block. The destructor waits for the
+// handlers in flight, so a sink must not be destroyed by one of its handlers.
+class NativeSink {
+protected:
+    jobject sink;
+    jlong handle;  // key of the sink for the Java side, never reused
+    int inFlight;  // handlers running, guarded by the sink registry
+    std::function<void(jboolean)> booleanHandler;
+    std::function<void(jbyte)> byteHandler;
+    std::function<void(jchar)> charHandler;
+    std::function<void(jshort)> shortHandler;
+    std::function<void(jint)> intHandler;
+    std::function<void(jlong)> longHandler;
+    std::function<void(jfloat)> floatHandler;
+    std::function<void(jdouble)> doubleHandler;
+    std::function<void(const jboolean*, jsize)> booleanArrayHandler;
+    std::function<void(const jbyte*, jsize)> byteArrayHandler;
+    std::function<void(const jchar*, jsize)> charArrayHandler;
+    std::function<void(const jshort*, jsize)> shortArrayHandler;
+    std::function<void(const jint*, jsize)> intArrayHandler;
+    std::function<void(const jlong*, jsize)> longArrayHandler;
+    std::function<void(const jfloat*, jsize)> floatArrayHandler;
+    std::function<void(const jdouble*, jsize)> doubleArrayHandler;
+    std::function<void(std::string)> stringHandler;
+    std::function<void(void*, jlong)> bufferHandler;
+    std::function<void(jobject)> objectHandler;
+    std::function<void()> closeHandler;
+    template <typename T> std::function<void(T)>& valueHandler();
+    template <typename T> std::function<void(const T*, jsize)>& arrayHandler();
+    friend struct NativeSinkDispatch;
+private:
+    NativeSink(const NativeSink&);
+    NativeSink& operator=(const NativeSink&);
+public:
+    // e.g. sink.on<jint>([](jint x) { ... }) and sink.onArray<jdouble>([](const jdouble* x, jsize n) { ... })
+    template <typename T, typename F> NativeSink& on(F f) { this->valueHandler<T>() = f; return *this; }
+    template <typename T, typename F> NativeSink& onArray(F f) { this->arrayHandler<T>() = f; return *this; }
+    NativeSink& onString(std::function<void(std::string)>);
+    NativeSink& onBuffer(std::function<void(void*, jlong)>);
+    NativeSink& onObject(std::function<void(jobject)>);
+    NativeSink& onClose(std::function<void()>);
+    jobject getObj(); // the Java cjay.callback.NativeSink (global reference)
+    NativeSink();
+    virtual ~NativeSink();
+};
+
+template <> inline std::function<void(jboolean)>& NativeSink::valueHandler<jboolean>() { return this->booleanHandler; }
+template <> inline std::function<void(jbyte)>& NativeSink::valueHandler<jbyte>() { return this->byteHandler; }
+template <> inline std::function<void(jchar)>& NativeSink::valueHandler<jchar>() { return this->charHandler; }
+template <> inline std::function<void(jshort)>& NativeSink::valueHandler<jshort>() { return this->shortHandler; }
+template <> inline std::function<void(jint)>& NativeSink::valueHandler<jint>() { return this->intHandler; }
+template <> inline std::function<void(jlong)>& NativeSink::valueHandler<jlong>() { return this->longHandler; }
+template <> inline std::function<void(jfloat)>& NativeSink::valueHandler<jfloat>() { return this->floatHandler; }
+template <> inline std::function<void(jdouble)>& NativeSink::valueHandler<jdouble>() { return this->doubleHandler; }
+template <> inline std::function<void(const jboolean*, jsize)>& NativeSink::arrayHandler<jboolean>() { return this->booleanArrayHandler; }
+template <> inline std::function<void(const jbyte*, jsize)>& NativeSink::arrayHandler<jbyte>() { return this->byteArrayHandler; }
+template <> inline std::function<void(const jchar*, jsize)>& NativeSink::arrayHandler<jchar>() { return this->charArrayHandler; }
+template <> inline std::function<void(const jshort*, jsize)>& NativeSink::arrayHandler<jshort>() { return this->shortArrayHandler; }
+template <> inline std::function<void(const jint*, jsize)>& NativeSink::arrayHandler<jint>() { return this->intArrayHandler; }
+template <> inline std::function<void(const jlong*, jsize)>& NativeSink::arrayHandler<jlong>() { return this->longArrayHandler; }
+template <> inline std::function<void(const jfloat*, jsize)>& NativeSink::arrayHandler<jfloat>() { return this->floatArrayHandler; }
+template <> inline std::function<void(const jdouble*, jsize)>& NativeSink::arrayHandler<jdouble>() { return this->doubleArrayHandler; }
+
+// Calls to bound methods recorded into one buffer, then run in a single
+// native-to-Java transition by cjay.batch.CommandInterpreter (through
+// reflection). Arguments are primitives, strings (sent as UTF-8), Java
+// objects, NULL or the Ref of an earlier command, whose result is passed on
+// without coming back to C++. A buffer can be executed again. Use jboolean
+// rather than bool, and jchar or jbyte rather than char.
+class CommandBuffer {
+public:
+    // Result of a recorded command
+    class Ref {
+    public:
+        int index;
+        explicit Ref(int index) : index(index) { }
+    };
+protected:
+    std::vector<std::uint8_t> commands; // int32 count, then the commands
+    int count;
+    std::vector<jobject> methods;       // java.lang.reflect.Method, global references
+    std::map<jmethodID, int> methodIndex;
+    std::vector<jobject> objects;       // targets and object arguments, global references
+    jobjectArray methodArray;           // methods and objects as Object[] (global references),
+    jobjectArray objectArray;           // rebuilt when they grow
+    std::vector<std::uint8_t> results;  // 16 bytes per command
+    jobjectArray values;                // reference results (global reference)
+    template <typename T> void put(T);
+    void putTag(char);
+    void putObject(jobject);
+    void putOperand(jboolean);
+    void putOperand(jbyte);
+    void putOperand(jchar);
+    void putOperand(jshort);
+    void putOperand(jint);
+    void putOperand(jlong);
+    void putOperand(jfloat);
+    void putOperand(jdouble);
+    void putOperand(const std::string&);
+    void putOperand(const char*);
+    void putOperand(jobject);
+    void putOperand(std::nullptr_t);
+    void putOperand(Ref);
+    void begin(CJ&, const std::string&, int);
+    void rollback(std::size_t, std::size_t);
+    void releaseArrays();
+    char resultTag(Ref) const;
+private:
+    CommandBuffer(const CommandBuffer&);
+    CommandBuffer& operator=(const CommandBuffer&);
+public:
+    // Records a call to the method key of cj (on its instance if not static).
+    // If it throws, nothing of the command is kept.
+    template <typename... Args> Ref add(CJ& cj, const std::string& key, Args... args) {
+        std::size_t commandBytes = this->commands.size();
+        std::size_t objectCount = this->objects.size();
+        try {
+            this->begin(cj, key, (int) sizeof...(Args));
+            int expand[] = { 0, (this->putOperand(args), 0)... };
+            (void) expand;
+        } catch (...) {
+            this->rollback(commandBytes, objectCount);
+            throw;
+        }
+        return Ref(this->count++);
+    }
+    int size() const { return this->count; }
+    void execute(); // one JNI call; a Java exception is thrown as HandlerExc
+    template <typename T> T get(Ref) const; // primitive result, converted to T as by javaCast
+    jobject getObject(Ref) const;           // local reference
+    std::string getString(Ref) const;
+    void clear();
+    CommandBuffer();
+    virtual ~CommandBuffer();
+};
+
+// Warm-up stage: initializes classes and repeats representative calls until
+// their timing stabilizes (the hot methods are then JIT-compiled), so that the
+// first real requests do not pay for interpretation and lazy linkage.
+class WarmupReport {
+public:
+    bool converged;
+    int rounds;
+    std::vector<std::uint64_t> roundNanos;
+    std::vector<std::string> failed; // calls dropped after throwing
+    std::string error;               // why the warm-up stopped early, "" if it did not
+    std::string toText() const;
+    WarmupReport();
+};
+
+class Warmup {
+protected:
+    std::vector<CJ*> classes;
+    std::vector<std::pair<std::string, std::function<void()> > > calls;
+    int minRounds;
+    int maxRounds;
+    int callsPerRound;
+    int window;
+    double tolerance;
+    std::atomic<bool> converged;
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool running;
+    WarmupReport report;
+    bool isStable(const std::vector<std::uint64_t>&) const;
+public:
+    // Force initialization of the bound class (static initializers run now)
+    Warmup& add(CJ&);
+    // Representative call, e.g. [&]() { cj.call<jint>("parseInt", (jint) 1); }
+    Warmup& add(std::string, std::function<void()>);
+    // Calls the listed method keys with zero arguments. Each method must take
+    // primitives only (throws otherwise); list only methods without side
+    // effects. Instance methods need CJ::Constructor.
+    Warmup& addSynthesized(CJ&, const std::vector<std::string>& keys);
+    Warmup& setRounds(int minRounds, int maxRounds);
+    Warmup& setCallsPerRound(int);
+    // Converged once the last window rounds differ by at most tolerance (relative)
+    Warmup& setConvergence(int window, double tolerance);
+    WarmupReport run();
+    void start(CallExecutor&); // run on an executor thread; a failure is kept in getReport().error
+    bool isConverged();
+    bool waitUntilFinished(std::chrono::milliseconds);
+    WarmupReport getReport();
+    Warmup();
+};
+
+/**
+ ** Generated proxies (see cjay.codegen.ProxyGenerator)
+ **/
+
+// Global class reference, e.g. proxyClass("example/Example"). Throws if missing.
+jclass proxyClass(const char*);
+jmethodID proxyMethod(jclass, const char* name, const char* descriptor, bool isStatic);
+// Throws a pending Java exception as HandlerExc (its toString as message)
+void checkJavaException();
+// UTF-8 content of a java.lang.String local reference, which is deleted ("" if null)
+std::string proxyString(jobject);
+
+// Class and method IDs of a generated proxy class. The class is looked up on
+// first use and again once bindingGeneration() changed, e.g. after addClass
+// replaced it; each method ID on the first call against that class.
+// Superseded entries stay valid until the table is destroyed, since calls in
+// flight may still use them.
+class ProxyTable {
+public:
+    struct Method {
+        const char* name;
+        const char* descriptor;
+        bool isStatic;
+    };
+    struct Entry {
+        jclass clazz; // global reference
+        std::uint64_t generation;
+        std::unique_ptr<std::atomic<jmethodID>[]> mids;
+    };
+protected:
+    const char* className;
+    std::vector<Method> methods;
+    std::atomic<Entry*> current;
+    std::vector<std::unique_ptr<Entry> > entries;
+    std::mutex mutex;
+private:
+    ProxyTable(const ProxyTable&);
+    ProxyTable& operator=(const ProxyTable&);
+public:
+    const Entry& get();
+    jmethodID getMid(const Entry&, std::size_t index);
+    ProxyTable(const char* className, std::initializer_list<Method>);
+    ~ProxyTable();
+};
+
+// Java string argument, released at the end of the call
+class ProxyString {
+protected:
+    jstring str;
+private:
+    ProxyString(const ProxyString&);
+    ProxyString& operator=(const ProxyString&);
+public:
+    jstring get() const { return this->str; }
+    explicit ProxyString(const std::string&);
+    ~ProxyString();
+};
+
+// Base of the generated classes: holds the Java instance as a global reference
+class ProxyBase {
+protected:
+    jobject obj;
+public:
+    jobject getObj() const { return this->obj; }
+    // adopt: obj is a local reference produced for this proxy, deleted here
+    ProxyBase(jobject, bool adopt);
+    ProxyBase(const ProxyBase&);
+    ProxyBase& operator=(const ProxyBase&);
+    virtual ~ProxyBase();
+};
+
+// Typed Call<Type>Method; object results are local references owned by the caller
+template <typename T> struct ProxyCall {
+    template <typename... Args> static T call(jobject obj, jmethodID mid, Args... args) {
+        T rtn = (T) env->CallObjectMethod(obj, mid, args...);
+        checkJavaException();
+        return rtn;
+    }
+    template <typename... Args> static T callStatic(jclass clazz, jmethodID mid, Args... args) {
+        T rtn = (T) env->CallStaticObjectMethod(clazz, mid, args...);
+        checkJavaException();
+        return rtn;
+    }
+};
+
+#define CJAY_PROXY_CALL(Type, JType) \
+template <> struct ProxyCall<JType> { \
+    template <typename... Args> static JType call(jobject obj, jmethodID mid, Args... args) { \
+        JType rtn = env->Call##Type##Method(obj, mid, args...); \
+        checkJavaException(); \
+        return rtn; \
+    } \
+    template <typename... Args> static JType callStatic(jclass clazz, jmethodID mid, Args... args) { \
+        JType rtn = env->CallStatic##Type##Method(clazz, mid, args...); \
+        checkJavaException(); \
+        return rtn; \
+    } \
+};
+CJAY_PROXY_CALL(Boolean, jboolean)
+CJAY_PROXY_CALL(Byte, jbyte)
+CJAY_PROXY_CALL(Char, jchar)
+CJAY_PROXY_CALL(Short, jshort)
+CJAY_PROXY_CALL(Int, jint)
+CJAY_PROXY_CALL(Long, jlong)
+CJAY_PROXY_CALL(Float, jfloat)
+CJAY_PROXY_CALL(Double, jdouble)
+#undef CJAY_PROXY_CALL
+
+template <> struct ProxyCall<void> {
+    template <typename... Args> static void call(jobject obj, jmethodID mid, Args... args) {
+        env->CallVoidMethod(obj, mid, args...);
+        checkJavaException();
+    }
+    template <typename... Args> static void callStatic(jclass clazz, jmethodID mid, Args... args) {
+        env->CallStaticVoidMethod(clazz, mid, args...);
+        checkJavaException();
+    }
+};
+
+template <typename... Args> jobject proxyNew(jclass clazz, jmethodID mid, Args... args) {
+    jobject obj = env->NewObject(clazz, mid, args...);
+    checkJavaException();
+    return obj;
+}
+
 } /* namespace VM */
 
 #endif /* CJAY_H_ */
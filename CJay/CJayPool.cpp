@@ -0,0 +1,615 @@
+/***************************************************************************
+ * Copyright 2014 Marcelo Sardelich <MSardelich@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************************/
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <new>
+#include <sstream>
+
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "CJayPool.hpp"
+
+namespace VM {
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "CJay: shared-memory rings need lock-free 64-bit atomics");
+
+/**
+ ** PoolValue implementation
+ **/
+PoolValue::PoolValue() : type(VOID) { this->value.j = 0; }
+PoolValue::PoolValue(jboolean z) : type(BOOLEAN) { this->value.j = 0; this->value.z = z; }
+PoolValue::PoolValue(jbyte b) : type(BYTE) { this->value.j = 0; this->value.b = b; }
+PoolValue::PoolValue(jchar c) : type(CHAR) { this->value.j = 0; this->value.c = c; }
+PoolValue::PoolValue(jshort s) : type(SHORT) { this->value.j = 0; this->value.s = s; }
+PoolValue::PoolValue(jint i) : type(INT) { this->value.j = 0; this->value.i = i; }
+PoolValue::PoolValue(jlong j) : type(LONG) { this->value.j = j; }
+PoolValue::PoolValue(jfloat f) : type(FLOAT) { this->value.j = 0; this->value.f = f; }
+PoolValue::PoolValue(jdouble d) : type(DOUBLE) { this->value.d = d; }
+PoolValue::PoolValue(std::string str) : type(STRING), bytes(str) { this->value.j = 0; }
+PoolValue::PoolValue(const char* str) : type(STRING), bytes(str) { this->value.j = 0; }
+
+template <typename T> static PoolValue arrayValue(PoolValue::Type type, const std::vector<T>& v) {
+    PoolValue pv;
+    pv.type = type;
+    pv.bytes.assign(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+    return pv;
+}
+
+template <> PoolValue::PoolValue(const std::vector<jboolean>& v) : PoolValue(arrayValue(BOOLEAN_ARRAY, v)) { }
+template <> PoolValue::PoolValue(const std::vector<jbyte>& v) : PoolValue(arrayValue(BYTE_ARRAY, v)) { }
+template <> PoolValue::PoolValue(const std::vector<jchar>& v) : PoolValue(arrayValue(CHAR_ARRAY, v)) { }
+template <> PoolValue::PoolValue(const std::vector<jshort>& v) : PoolValue(arrayValue(SHORT_ARRAY, v)) { }
+template <> PoolValue::PoolValue(const std::vector<jint>& v) : PoolValue(arrayValue(INT_ARRAY, v)) { }
+template <> PoolValue::PoolValue(const std::vector<jlong>& v) : PoolValue(arrayValue(LONG_ARRAY, v)) { }
+template <> PoolValue::PoolValue(const std::vector<jfloat>& v) : PoolValue(arrayValue(FLOAT_ARRAY, v)) { }
+template <> PoolValue::PoolValue(const std::vector<jdouble>& v) : PoolValue(arrayValue(DOUBLE_ARRAY, v)) { }
+
+static const char* typeNames[] = {
+    "void", "boolean", "byte", "char", "short", "int", "long", "float", "double", "String",
+    "boolean[]", "byte[]", "char[]", "short[]", "int[]", "long[]", "float[]", "double[]"
+};
+
+// JNI type descriptor of each PoolValue type, for arguments
+static const char* typeDescriptors[] = {
+    "V", "Z", "B", "C", "S", "I", "J", "F", "D", "Ljava/lang/String;",
+    "[Z", "[B", "[C", "[S", "[I", "[J", "[F", "[D"
+};
+
+// Parameter descriptors of a method descriptor, e.g. "(I[JLjava/lang/String;)V"
+static std::vector<std::string> parameterTypes(const std::string& descriptor) {
+    std::vector<std::string> types;
+    std::size_t end = descriptor.find(')');
+    for (std::size_t i = 1; i < end; ) {
+        std::size_t start = i;
+        while (descriptor[i] == '[') { i++; }
+        if (descriptor[i] == 'L') {
+            i = descriptor.find(';', i);
+            if (i == std::string::npos) { break; }
+        }
+        i++;
+        types.push_back(descriptor.substr(start, i - start));
+    }
+    return types;
+}
+
+static void checkType(const PoolValue& pv, PoolValue::Type expected) {
+    if (pv.type != expected) {
+        throw HandlerExc(std::string("CJay: Worker returned ") + typeNames[pv.type] + ", expected " + typeNames[expected]);
+    }
+}
+
+template <typename T> static std::vector<T> arrayAs(const PoolValue& pv, PoolValue::Type type) {
+    checkType(pv, type);
+    std::vector<T> v(pv.bytes.size() / sizeof(T));
+    if (!v.empty()) { std::memcpy(&v[0], pv.bytes.data(), v.size() * sizeof(T)); }
+    return v;
+}
+
+template <> void PoolValue::as() const { checkType(*this, VOID); }
+template <> jboolean PoolValue::as() const { checkType(*this, BOOLEAN); return this->value.z; }
+template <> jbyte PoolValue::as() const { checkType(*this, BYTE); return this->value.b; }
+template <> jchar PoolValue::as() const { checkType(*this, CHAR); return this->value.c; }
+template <> jshort PoolValue::as() const { checkType(*this, SHORT); return this->value.s; }
+template <> jint PoolValue::as() const { checkType(*this, INT); return this->value.i; }
+template <> jlong PoolValue::as() const { checkType(*this, LONG); return this->value.j; }
+template <> jfloat PoolValue::as() const { checkType(*this, FLOAT); return this->value.f; }
+template <> jdouble PoolValue::as() const { checkType(*this, DOUBLE); return this->value.d; }
+template <> std::string PoolValue::as() const { checkType(*this, STRING); return this->bytes; }
+template <> std::vector<jboolean> PoolValue::as() const { return arrayAs<jboolean>(*this, BOOLEAN_ARRAY); }
+template <> std::vector<jbyte> PoolValue::as() const { return arrayAs<jbyte>(*this, BYTE_ARRAY); }
+template <> std::vector<jchar> PoolValue::as() const { return arrayAs<jchar>(*this, CHAR_ARRAY); }
+template <> std::vector<jshort> PoolValue::as() const { return arrayAs<jshort>(*this, SHORT_ARRAY); }
+template <> std::vector<jint> PoolValue::as() const { return arrayAs<jint>(*this, INT_ARRAY); }
+template <> std::vector<jlong> PoolValue::as() const { return arrayAs<jlong>(*this, LONG_ARRAY); }
+template <> std::vector<jfloat> PoolValue::as() const { return arrayAs<jfloat>(*this, FLOAT_ARRAY); }
+template <> std::vector<jdouble> PoolValue::as() const { return arrayAs<jdouble>(*this, DOUBLE_ARRAY); }
+
+/**
+ ** Wire format
+ **/
+
+// request:  id, class name, method key, argument count, arguments
+// response: id, status (0 ok, 1 error), result or error message
+// value:    type, then 8 bytes (primitive) or length and bytes (string, array)
+class PoolWriter {
+public:
+    std::string buf;
+    void put(const void* p, std::size_t n) { this->buf.append(static_cast<const char*>(p), n); }
+    void putU8(std::uint8_t x) { this->put(&x, 1); }
+    void putU32(std::uint32_t x) { this->put(&x, 4); }
+    void putU64(std::uint64_t x) { this->put(&x, 8); }
+    void putString(const std::string& s) { this->putU32((std::uint32_t) s.size()); this->buf.append(s); }
+    void putValue(const PoolValue& pv) {
+        this->putU8(pv.type);
+        if (pv.type >= PoolValue::STRING) { this->putString(pv.bytes); } else { this->put(&pv.value, 8); }
+    }
+};
+
+class PoolReader {
+public:
+    const std::string& buf;
+    std::size_t pos;
+    explicit PoolReader(const std::string& buf) : buf(buf), pos(0) { }
+    void get(void* p, std::size_t n) {
+        if (this->pos + n > this->buf.size()) { throw HandlerExc("CJay: Truncated worker message"); }
+        std::memcpy(p, this->buf.data() + this->pos, n);
+        this->pos += n;
+    }
+    std::uint8_t getU8() { std::uint8_t x; this->get(&x, 1); return x; }
+    std::uint32_t getU32() { std::uint32_t x; this->get(&x, 4); return x; }
+    std::uint64_t getU64() { std::uint64_t x; this->get(&x, 8); return x; }
+    std::string getString() {
+        std::uint32_t n = this->getU32();
+        std::string s(n, '\0');
+        if (n > 0) { this->get(&s[0], n); }
+        return s;
+    }
+    PoolValue getValue() {
+        PoolValue pv;
+        pv.type = (PoolValue::Type) this->getU8();
+        if (pv.type >= PoolValue::STRING) { pv.bytes = this->getString(); } else { this->get(&pv.value, 8); }
+        return pv;
+    }
+};
+
+/**
+ ** Shared-memory ring
+ **/
+
+// Single-producer, single-consumer ring of length-prefixed messages. Lives in
+// memory mapped MAP_SHARED before fork, so both processes see the same ring.
+struct PoolRing {
+    std::atomic<std::uint64_t> head; // consumer position
+    std::atomic<std::uint64_t> tail; // producer position
+    sem_t items;                     // one post per message
+    sem_t space;                     // one post per consumed message
+    std::uint64_t capacity;
+
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+
+    void init(std::uint64_t capacity) {
+        this->head.store(0);
+        this->tail.store(0);
+        sem_init(&this->items, 1, 0);
+        sem_init(&this->space, 1, 0);
+        this->capacity = capacity;
+    }
+
+    void destroy() {
+        sem_destroy(&this->items);
+        sem_destroy(&this->space);
+    }
+
+    void copyIn(std::uint64_t pos, const char* p, std::size_t n) {
+        std::size_t off = pos % this->capacity;
+        std::size_t first = std::min<std::size_t>(n, this->capacity - off);
+        std::memcpy(this->data() + off, p, first);
+        std::memcpy(this->data(), p + first, n - first);
+    }
+
+    void copyOut(std::uint64_t pos, char* p, std::size_t n) {
+        std::size_t off = pos % this->capacity;
+        std::size_t first = std::min<std::size_t>(n, this->capacity - off);
+        std::memcpy(p, this->data() + off, first);
+        std::memcpy(p + first, this->data(), n - first);
+    }
+
+    static void deadline(struct timespec& ts, long timeoutMs) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += timeoutMs / 1000;
+        ts.tv_nsec += (timeoutMs % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+    }
+
+    // false if the ring stays full and the consumer is gone
+    bool write(const std::string& msg, const std::function<bool()>& consumerAlive) {
+        std::uint32_t n = (std::uint32_t) msg.size();
+        if (n + 4 > this->capacity) {
+            throw HandlerExc("CJay: Message larger than the worker ring. Increase ringBytes.");
+        }
+        std::uint64_t tail = this->tail.load(std::memory_order_relaxed);
+        while (this->capacity - (tail - this->head.load(std::memory_order_acquire)) < n + 4) {
+            struct timespec ts;
+            deadline(ts, 100);
+            if (sem_timedwait(&this->space, &ts) != 0 && errno == ETIMEDOUT && !consumerAlive()) { return false; }
+        }
+        this->copyIn(tail, reinterpret_cast<const char*>(&n), 4);
+        this->copyIn(tail + 4, msg.data(), n);
+        this->tail.store(tail + 4 + n, std::memory_order_release);
+        sem_post(&this->items);
+        return true;
+    }
+
+    // false on timeout
+    bool read(std::string& msg, long timeoutMs) {
+        struct timespec ts;
+        deadline(ts, timeoutMs);
+        while (sem_timedwait(&this->items, &ts) != 0) {
+            if (errno != EINTR) { return false; }
+        }
+        std::uint64_t head = this->head.load(std::memory_order_relaxed);
+        std::uint32_t n;
+        this->copyOut(head, reinterpret_cast<char*>(&n), 4);
+        msg.resize(n);
+        if (n > 0) { this->copyOut(head + 4, &msg[0], n); }
+        this->head.store(head + 4 + n, std::memory_order_release);
+        sem_post(&this->space);
+        return true;
+    }
+};
+
+// Request and response rings of one worker
+struct PoolChannel {
+    std::size_t ringBytes;
+    PoolRing* requests() { return reinterpret_cast<PoolRing*>(this + 1); }
+    PoolRing* responses() {
+        return reinterpret_cast<PoolRing*>(reinterpret_cast<char*>(this->requests()) + sizeof(PoolRing) + this->ringBytes);
+    }
+    static std::size_t mappedSize(std::size_t ringBytes) {
+        return sizeof(PoolChannel) + 2 * (sizeof(PoolRing) + ringBytes);
+    }
+};
+
+/**
+ ** WorkerPool implementation
+ **/
+struct WorkerPool::Worker {
+    std::atomic<pid_t> pid; // reset by the reader thread once the process is reaped
+    PoolChannel* channel;
+    std::mutex writeMutex;
+    std::mutex pendingMutex;
+    std::map<std::uint64_t, std::promise<PoolValue> > pending;
+    std::atomic<int> inFlight;
+    std::atomic<bool> alive;
+    std::thread reader;
+    Worker() : pid(-1), channel(NULL), inFlight(0), alive(true) { }
+};
+
+WorkerPool::WorkerPool(int nWorkers, const VMConfig& config, std::size_t ringBytes) : nextId(1), stopped(false) {
+    if (jvm != NULL) {
+        throw HandlerExc("CJay: WorkerPool forks its workers, so it must be created before VM::createVM.");
+    }
+    ringBytes = (ringBytes + 63) & ~(std::size_t) 63; // keeps the second ring aligned
+    // fork every worker before starting any thread
+    pid_t frontEnd = getpid();
+    for (int i = 0; i < nWorkers; i++) {
+        Worker* w = new Worker();
+        std::size_t size = PoolChannel::mappedSize(ringBytes);
+        void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            delete w;
+            this->shutdown();
+            throw HandlerExc("CJay: Unable to map shared memory for a worker.");
+        }
+        w->channel = new (p) PoolChannel();
+        w->channel->ringBytes = ringBytes;
+        new (w->channel->requests()) PoolRing();
+        new (w->channel->responses()) PoolRing();
+        w->channel->requests()->init(ringBytes);
+        w->channel->responses()->init(ringBytes);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            this->serve(w->channel, config, frontEnd); // never returns
+        }
+        w->pid = pid;
+        if (pid < 0) {
+            munmap(p, size);
+            delete w;
+            this->shutdown();
+            throw HandlerExc("CJay: Unable to fork a worker process.");
+        }
+        this->workers.push_back(w);
+    }
+    for (auto w : this->workers) {
+        w->reader = std::thread(&WorkerPool::readResponses, this, w);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    this->shutdown();
+}
+
+// Worker process: own JVM, one call at a time
+void WorkerPool::serve(PoolChannel* channel, const VMConfig& config, pid_t frontEnd) {
+    int status = EXIT_SUCCESS;
+    std::map<std::string, CJ*> classes;
+    // Reparented once the front end dies, not necessarily to pid 1 (subreapers)
+    std::function<bool()> frontEndAlive = [frontEnd]() { return getppid() == frontEnd; };
+    try {
+        createVM(config);
+        std::string msg;
+        for (;;) {
+            if (!channel->requests()->read(msg, 1000)) {
+                if (!frontEndAlive()) { break; }
+                continue;
+            }
+            PoolReader in(msg);
+            std::uint64_t id = in.getU64();
+            PoolWriter out;
+            out.putU64(id);
+            if (id == 0) { // shutdown
+                channel->responses()->write(out.buf, frontEndAlive);
+                break;
+            }
+            std::string className = in.getString();
+            std::string key = in.getString();
+            std::uint32_t nArgs = in.getU32();
+
+            env->PushLocalFrame(16 + 2 * nArgs);
+            try {
+                CJ* cj;
+                std::map<std::string, CJ*>::iterator bound = classes.find(className);
+                if (bound == classes.end()) { // kept only once bound, so that a failure is retried
+                    std::unique_ptr<CJ> fresh(new CJ());
+                    fresh->setClass(className);
+                    cj = fresh.get();
+                    classes[className] = fresh.release();
+                } else {
+                    cj = bound->second;
+                }
+                SignatureBase* sig = cj->getSignatureObj(key);
+
+                // Checked against the descriptor before any reaches the JVM
+                std::vector<std::string> params = parameterTypes(sig->descriptor);
+                if (params.size() != nArgs) {
+                    std::ostringstream what;
+                    what << "CJay: " << className << "." << key << " takes " << params.size() << " arguments, got " << nArgs;
+                    throw HandlerExc(what.str());
+                }
+                std::vector<PoolValue> values(nArgs);
+                for (std::uint32_t i = 0; i < nArgs; i++) {
+                    values[i] = in.getValue();
+                    if (values[i].type > PoolValue::DOUBLE_ARRAY || params[i] != typeDescriptors[values[i].type]) {
+                        std::ostringstream what;
+                        what << "CJay: Argument " << i << " of " << className << "." << key << " is " <<
+                                (values[i].type > PoolValue::DOUBLE_ARRAY ? "of an unknown type" : typeNames[values[i].type]) <<
+                                ", expected " << params[i];
+                        throw HandlerExc(what.str());
+                    }
+                }
+
+                if (!sig->isStatic && cj->getObj() == NULL) {
+                    cj->Constructor(cj->getUniqueKey("<init>", "()V"));
+                }
+
+                std::vector<jvalue> args(nArgs);
+                for (std::uint32_t i = 0; i < nArgs; i++) {
+                    const PoolValue& pv = values[i];
+                    jsize n;
+                    switch (pv.type)
+                    {
+                    case PoolValue::STRING :
+                        args[i].l = newJavaString(pv.bytes.data(), pv.bytes.size()); break;
+#define CJAY_POOL_ARRAY_ARG(Tag, JType, Type) \
+                    case PoolValue::Tag : \
+                        n = (jsize) (pv.bytes.size() / sizeof(JType)); \
+                        args[i].l = env->New##Type##Array(n); \
+                        env->Set##Type##ArrayRegion((JType##Array) args[i].l, 0, n, reinterpret_cast<const JType*>(pv.bytes.data())); \
+                        break;
+                    CJAY_POOL_ARRAY_ARG(BOOLEAN_ARRAY, jboolean, Boolean)
+                    CJAY_POOL_ARRAY_ARG(BYTE_ARRAY, jbyte, Byte)
+                    CJAY_POOL_ARRAY_ARG(CHAR_ARRAY, jchar, Char)
+                    CJAY_POOL_ARRAY_ARG(SHORT_ARRAY, jshort, Short)
+                    CJAY_POOL_ARRAY_ARG(INT_ARRAY, jint, Int)
+                    CJAY_POOL_ARRAY_ARG(LONG_ARRAY, jlong, Long)
+                    CJAY_POOL_ARRAY_ARG(FLOAT_ARRAY, jfloat, Float)
+                    CJAY_POOL_ARRAY_ARG(DOUBLE_ARRAY, jdouble, Double)
+#undef CJAY_POOL_ARRAY_ARG
+                    default :
+                        args[i] = pv.value;
+                    }
+                }
+
+                jvalue result = cj->callA(key, args.empty() ? NULL : &args[0]);
+                jthrowable exc = env->ExceptionOccurred();
+                if (exc) {
+                    env->ExceptionClear();
+                    jmethodID toString = env->GetMethodID(env->GetObjectClass(exc), "toString", "()Ljava/lang/String;");
+                    std::string what = toUTF8((jstring) env->CallObjectMethod(exc, toString));
+                    throw HandlerExc("JNI: " + className + "." + key + " threw " + what);
+                }
+
+                std::string rv = sig->descriptor.substr(sig->descriptor.find(')') + 1);
+                PoolValue pv;
+                switch (rv[0])
+                {
+                case 'V' : break;
+                case 'Z' : pv = PoolValue(result.z); break;
+                case 'B' : pv = PoolValue(result.b); break;
+                case 'C' : pv = PoolValue(result.c); break;
+                case 'S' : pv = PoolValue(result.s); break;
+                case 'I' : pv = PoolValue(result.i); break;
+                case 'J' : pv = PoolValue(result.j); break;
+                case 'F' : pv = PoolValue(result.f); break;
+                case 'D' : pv = PoolValue(result.d); break;
+                default :
+                    if (rv == "Ljava/lang/String;") {
+                        pv.type = PoolValue::STRING;
+                        if (result.l != NULL) { toUTF8((jstring) result.l, pv.bytes); }
+                        break;
+                    }
+                    jsize n = result.l == NULL ? 0 : env->GetArrayLength((jarray) result.l);
+#define CJAY_POOL_ARRAY_RESULT(Desc, Tag, JType, Type) \
+                    if (rv == Desc) { \
+                        pv.type = PoolValue::Tag; \
+                        pv.bytes.resize(n * sizeof(JType)); \
+                        if (n > 0) { env->Get##Type##ArrayRegion((JType##Array) result.l, 0, n, reinterpret_cast<JType*>(&pv.bytes[0])); } \
+                        break; \
+                    }
+                    CJAY_POOL_ARRAY_RESULT("[Z", BOOLEAN_ARRAY, jboolean, Boolean)
+                    CJAY_POOL_ARRAY_RESULT("[B", BYTE_ARRAY, jbyte, Byte)
+                    CJAY_POOL_ARRAY_RESULT("[C", CHAR_ARRAY, jchar, Char)
+                    CJAY_POOL_ARRAY_RESULT("[S", SHORT_ARRAY, jshort, Short)
+                    CJAY_POOL_ARRAY_RESULT("[I", INT_ARRAY, jint, Int)
+                    CJAY_POOL_ARRAY_RESULT("[J", LONG_ARRAY, jlong, Long)
+                    CJAY_POOL_ARRAY_RESULT("[F", FLOAT_ARRAY, jfloat, Float)
+                    CJAY_POOL_ARRAY_RESULT("[D", DOUBLE_ARRAY, jdouble, Double)
+#undef CJAY_POOL_ARRAY_RESULT
+                    throw HandlerExc("CJay: Worker can't return " + rv + " from " + className + "." + key);
+                }
+                out.putU8(0);
+                out.putValue(pv);
+            } catch (std::exception& e) {
+                out.putU8(1);
+                out.putString(e.what());
+            }
+            env->PopLocalFrame(NULL);
+            if (!channel->responses()->write(out.buf, frontEndAlive)) { break; }
+        }
+    } catch (std::exception& e) {
+        std::cerr << "CJay worker " << getpid() << ": " << e.what() << std::endl;
+        status = EXIT_FAILURE;
+    }
+    for (auto& kv : classes) { delete kv.second; }
+    if (jvm != NULL) { destroyVM(); }
+    _exit(status); // no destructors of the front end's objects
+}
+
+// Front end: one thread per worker completes the futures
+void WorkerPool::readResponses(Worker* w) {
+    std::string msg;
+    for (;;) {
+        if (!w->channel->responses()->read(msg, 100)) {
+            int status;
+            pid_t pid = w->pid;
+            if (waitpid(pid, &status, WNOHANG) == pid) {
+                w->alive = false;
+                w->pid = -1;
+                break;
+            }
+            continue;
+        }
+        PoolReader in(msg);
+        std::uint64_t id = in.getU64();
+        if (id == 0) { break; } // shutdown acknowledged
+
+        std::promise<PoolValue> promise;
+        {
+            std::lock_guard<std::mutex> lock(w->pendingMutex);
+            std::map<std::uint64_t, std::promise<PoolValue> >::iterator it = w->pending.find(id);
+            if (it == w->pending.end()) { continue; }
+            promise = std::move(it->second);
+            w->pending.erase(it);
+        }
+        w->inFlight--;
+        if (in.getU8() == 0) {
+            promise.set_value(in.getValue());
+        } else {
+            promise.set_exception(std::make_exception_ptr(HandlerExc(in.getString())));
+        }
+    }
+    // fail whatever is left
+    std::lock_guard<std::mutex> lock(w->pendingMutex);
+    for (auto& kv : w->pending) {
+        kv.second.set_exception(std::make_exception_ptr(HandlerExc("CJay: Worker process exited before replying.")));
+    }
+    w->pending.clear();
+    w->inFlight = 0;
+}
+
+WorkerPool::Worker* WorkerPool::route() {
+    Worker* best = NULL;
+    for (auto w : this->workers) {
+        if (!w->alive) { continue; }
+        if (best == NULL || w->inFlight < best->inFlight) { best = w; }
+    }
+    if (best == NULL) { throw HandlerExc("CJay: No live worker process."); }
+    return best;
+}
+
+std::future<PoolValue> WorkerPool::submit(std::string className, std::string key, std::vector<PoolValue> args) {
+    if (this->stopped) { throw HandlerExc("CJay: WorkerPool is shut down."); }
+    Worker* w = this->route();
+    std::uint64_t id = this->nextId++;
+
+    PoolWriter out;
+    out.putU64(id);
+    out.putString(className);
+    out.putString(key);
+    out.putU32((std::uint32_t) args.size());
+    for (auto& a : args) { out.putValue(a); }
+
+    std::future<PoolValue> f;
+    {
+        std::lock_guard<std::mutex> lock(w->pendingMutex);
+        f = w->pending[id].get_future();
+    }
+    w->inFlight++;
+    try {
+        std::lock_guard<std::mutex> lock(w->writeMutex);
+        if (!w->channel->requests()->write(out.buf, [w]() { return w->alive.load(); })) {
+            throw HandlerExc("CJay: Worker process exited.");
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(w->pendingMutex);
+        w->pending.erase(id);
+        w->inFlight--;
+        throw;
+    }
+    if (!w->alive) { // the reader may have failed pending calls already
+        std::lock_guard<std::mutex> lock(w->pendingMutex);
+        std::map<std::uint64_t, std::promise<PoolValue> >::iterator it = w->pending.find(id);
+        if (it != w->pending.end()) {
+            it->second.set_exception(std::make_exception_ptr(HandlerExc("CJay: Worker process exited before replying.")));
+            w->pending.erase(it);
+        }
+    }
+    return f;
+}
+
+void WorkerPool::shutdown() {
+    if (this->stopped.exchange(true)) { return; }
+    for (auto w : this->workers) {
+        if (w->alive) {
+            PoolWriter out;
+            out.putU64(0);
+            std::lock_guard<std::mutex> lock(w->writeMutex);
+            w->channel->requests()->write(out.buf, [w]() { return w->alive.load(); });
+        }
+    }
+    for (auto w : this->workers) {
+        if (w->reader.joinable()) { w->reader.join(); }
+        pid_t pid = w->pid;
+        if (pid > 0) { waitpid(pid, NULL, 0); }
+        std::size_t size = PoolChannel::mappedSize(w->channel->ringBytes);
+        w->channel->requests()->destroy();
+        w->channel->responses()->destroy();
+        munmap(w->channel, size);
+        delete w;
+    }
+    this->workers.clear();
+}
+
+int WorkerPool::size() {
+    return (int) this->workers.size();
+}
+
+pid_t WorkerPool::getPid(int i) {
+    return this->workers.at(i)->pid;
+}
+
+int WorkerPool::getInFlight(int i) {
+    return this->workers.at(i)->inFlight;
+}
+
+} /* namespace VM */
@@ -0,0 +1,93 @@
+/**************************************************************************
+ * Copyright 2014 Marcelo Sardelich <MSardelich@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************************/
+#ifndef CJAY_POOL_H_
+#define CJAY_POOL_H_
+
+#include <sys/types.h>
+
+#include "CJay.hpp"
+
+namespace VM {
+
+/**
+ ** Out-of-process calls (POSIX only)
+ **/
+
+// Argument or result of a call to a worker process: a primitive, a string
+// (UTF-8) or a primitive array.
+class PoolValue {
+public:
+    enum Type : std::uint8_t {
+        VOID, BOOLEAN, BYTE, CHAR, SHORT, INT, LONG, FLOAT, DOUBLE, STRING,
+        BOOLEAN_ARRAY, BYTE_ARRAY, CHAR_ARRAY, SHORT_ARRAY, INT_ARRAY, LONG_ARRAY, FLOAT_ARRAY, DOUBLE_ARRAY
+    };
+    Type type;
+    jvalue value;       // primitives
+    std::string bytes;  // string or array content
+    PoolValue();
+    PoolValue(jboolean);
+    PoolValue(jbyte);
+    PoolValue(jchar);
+    PoolValue(jshort);
+    PoolValue(jint);
+    PoolValue(jlong);
+    PoolValue(jfloat);
+    PoolValue(jdouble);
+    PoolValue(std::string);
+    PoolValue(const char*);
+    template <typename T> PoolValue(const std::vector<T>&);
+    template <typename To> To as() const;
+};
+
+struct PoolChannel;
+
+// Pool of worker processes, each running its own JVM. Calls are routed to
+// the worker with the fewest calls in flight, over shared-memory rings.
+// The pool forks its workers, so it must be created before createVM and
+// before any other thread is started.
+// Arguments must match the parameter types of the method exactly (String
+// for Ljava/lang/String;, std::vector<jint> for [I, ...): a mismatch fails
+// the call. Instance methods run on a single instance per class and worker,
+// built with the no-argument constructor on first use and shared by every
+// call routed to that worker.
+class WorkerPool {
+protected:
+    struct Worker;
+    std::vector<Worker*> workers;
+    std::atomic<std::uint64_t> nextId;
+    std::atomic<bool> stopped;
+    void serve(PoolChannel*, const VMConfig&, pid_t); // in the child, pid of the front end
+    void readResponses(Worker*);
+    Worker* route();
+public:
+    std::future<PoolValue> submit(std::string, std::string, std::vector<PoolValue>);
+    template <typename To, typename... Args> To call(std::string className, std::string key, Args... args) {
+        return this->submit(className, key, std::vector<PoolValue>{PoolValue(args)...}).get().template as<To>();
+    }
+    int size();
+    pid_t getPid(int);
+    int getInFlight(int);
+    void shutdown();
+    WorkerPool(int, const VMConfig&, std::size_t ringBytes = 1 << 20);
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    virtual ~WorkerPool();
+};
+
+} /* namespace VM */
+
+#endif /* CJAY_POOL_H_ */
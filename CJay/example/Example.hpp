@@ -0,0 +1,116 @@
+// Generated by cjay.codegen.ProxyGenerator from example.Example. Do not edit.
+#ifndef CJAY_PROXY_EXAMPLE_EXAMPLE_HPP_
+#define CJAY_PROXY_EXAMPLE_EXAMPLE_HPP_
+
+#include "CJay.hpp"
+
+namespace cjay {
+namespace example {
+
+class Example : public VM::ProxyBase {
+public:
+    static jclass javaClass() {
+        return table().get().clazz;
+    }
+
+    // Wraps an existing instance
+    explicit Example(jobject obj) : VM::ProxyBase(obj, false) { }
+
+    // public example.Example()
+    Example() : VM::ProxyBase(construct(), true) { }
+
+    // public static void example.Example.main(java.lang.String[])
+    static void main(jobjectArray x0) {
+        const VM::ProxyTable::Entry& binding = table().get();
+        VM::ProxyCall<void>::callStatic(binding.clazz, table().getMid(binding, 0), x0);
+    }
+
+    // public boolean[] example.Example.parseArrayBoolean(boolean[])
+    jbooleanArray parseArrayBoolean(jbooleanArray x0) {
+        const VM::ProxyTable::Entry& binding = table().get();
+        return VM::ProxyCall<jbooleanArray>::call(this->obj, table().getMid(binding, 1), x0);
+    }
+
+    // public boolean example.Example.parseBoolean(boolean)
+    jboolean parseBoolean(jboolean x0) {
+        const VM::ProxyTable::Entry& binding = table().get();
+        return VM::ProxyCall<jboolean>::call(this->obj, table().getMid(binding, 2), x0);
+    }
+
+    // public byte example.Example.parseByte(byte)
+    jbyte parseByte(jbyte x0) {
+        const VM::ProxyTable::Entry& binding = table().get();
+        return VM::ProxyCall<jbyte>::call(this->obj, table().getMid(binding, 3), x0);
+    }
+
+    // public char example.Example.parseChar(char)
+    jchar parseChar(jchar x0) {
+        const VM::ProxyTable::Entry& binding = table().get();
+        return VM::ProxyCall<jchar>::call(this->obj, table().getMid(binding, 4), x0);
+    }
+
+    // public double example.Example.parseDouble(double)
+    jdouble parseDouble(jdouble x0) {
+        const VM::ProxyTable::Entry& binding = table().get();
+        return VM::ProxyCall<jdouble>::call(this->obj, table().getMid(binding, 5), x0);
+    }
+
+    // public float example.Example.parseFloat(float)
+    jfloat parseFloat(jfloat x0) {
+        const VM::ProxyTable::Entry& binding = table().get();
+        return VM::ProxyCall<jfloat>::call(this->obj, table().getMid(binding, 6), x0);
+    }
+
+    // public int example.Example.parseInt(int)
+    jint parseInt(jint x0) {
+        const VM::ProxyTable::Entry& binding = table().get();
+        return VM::ProxyCall<jint>::call(this->obj, table().getMid(binding, 7), x0);
+    }
+
+    // public long example.Example.parseLong(long)
+    jlong parseLong(jlong x0) {
+        const VM::ProxyTable::Entry& binding = table().get();
+        return VM::ProxyCall<jlong>::call(this->obj, table().getMid(binding, 8), x0);
+    }
+
+    // public short example.Example.parseShort(short)
+    jshort parseShort(jshort x0) {
+        const VM::ProxyTable::Entry& binding = table().get();
+        return VM::ProxyCall<jshort>::call(this->obj, table().getMid(binding, 9), x0);
+    }
+
+    // public static java.lang.String example.Example.parseString(java.lang.String)
+    static std::string parseString(const std::string& x0) {
+        const VM::ProxyTable::Entry& binding = table().get();
+        VM::ProxyString s0(x0);
+        return VM::proxyString(VM::ProxyCall<jobject>::callStatic(binding.clazz, table().getMid(binding, 10), s0.get()));
+    }
+private:
+    static jobject construct() {
+        const VM::ProxyTable::Entry& binding = table().get();
+        return VM::proxyNew(binding.clazz, table().getMid(binding, 11));
+    }
+
+    static VM::ProxyTable& table() {
+        static VM::ProxyTable table("example/Example", {
+            { "main", "([Ljava/lang/String;)V", true },
+            { "parseArrayBoolean", "([Z)[Z", false },
+            { "parseBoolean", "(Z)Z", false },
+            { "parseByte", "(B)B", false },
+            { "parseChar", "(C)C", false },
+            { "parseDouble", "(D)D", false },
+            { "parseFloat", "(F)F", false },
+            { "parseInt", "(I)I", false },
+            { "parseLong", "(J)J", false },
+            { "parseShort", "(S)S", false },
+            { "parseString", "(Ljava/lang/String;)Ljava/lang/String;", true },
+            { "<init>", "()V", false }
+        });
+        return table;
+    }
+};
+
+} /* namespace example */
+} /* namespace cjay */
+
+#endif /* CJAY_PROXY_EXAMPLE_EXAMPLE_HPP_ */
@@ -0,0 +1,8 @@
+#!/bin/sh
+# Compiles java/src into java/bin (Java 8 or later). Run it from anywhere
+# before building or testing CJay: setClass binds the helper classes by
+# name, and -DCJAY_EMBED_CLASSES links them from java/bin with .incbin.
+set -e
+cd "$(dirname "$0")"
+mkdir -p bin
+javac -d bin $(find src -name '*.java')
@@ -0,0 +1,180 @@
+/***************************************************************************
+ * Copyright 2014 Marcelo Sardelich <MSardelich@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************************/
+package cjay.batch;
+
+import java.lang.invoke.MethodHandle;
+import java.lang.invoke.MethodHandles;
+import java.lang.invoke.MethodType;
+import java.lang.reflect.Method;
+import java.lang.reflect.Modifier;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
+
+// Runs the calls recorded by VM::CommandBuffer in one native-to-Java transition.
+//
+//   commands  int32 count, then per command: int32 method index, the target
+//             operand (N for a static method), int32 argument count, the operands
+//   operand   int32 tag, then Z B C S I: int32; J: int64; F: float32; D: float64;
+//             T: int32 length and UTF-8 bytes; R: int32 index of an earlier
+//             command (its result); L: int32 index into objects; N: nothing
+//   results   16 bytes per command: int32 tag (V, Z ... D, or L for a reference),
+//             int32 0, int64 value (raw bits of F and D)
+//
+// Reference results are returned in the array, at the index of their command.
+// Each method is resolved once per batch to a spread method handle, which
+// takes the target (if any) and the arguments in one Object[].
+public final class CommandInterpreter {
+  private CommandInterpreter() {
+  }
+
+  public static Object[] execute(ByteBuffer commands, Object[] methods, Object[] objects, ByteBuffer results) throws Throwable {
+    ByteBuffer in = commands.duplicate().order(ByteOrder.nativeOrder());
+    ByteBuffer out = results.duplicate().order(ByteOrder.nativeOrder());
+    int count = in.getInt();
+    Object[] values = new Object[count];
+    MethodHandle[] handles = new MethodHandle[methods.length];
+    for (int i = 0; i < count; i++) {
+      int index = in.getInt();
+      Method method = (Method) methods[index];
+      if (handles[index] == null) {
+        handles[index] = spread(method);
+      }
+      boolean isStatic = Modifier.isStatic(method.getModifiers());
+      Object target = operand(in, objects, values, i);
+      int offset = isStatic ? 0 : 1;
+      Object[] args = new Object[offset + in.getInt()];
+      if (!isStatic) {
+        args[0] = target;
+      }
+      for (int a = offset; a < args.length; a++) {
+        args[a] = operand(in, objects, values, i);
+      }
+      values[i] = (Object) handles[index].invokeExact(args);
+      store(out, i, method.getReturnType(), values[i]);
+    }
+    return values;
+  }
+
+  // (Object[]) -> Object handle of the method; void methods return null
+  private static MethodHandle spread(Method method) throws IllegalAccessException {
+    MethodHandle handle = unreflect(method).asFixedArity();
+    int arity = handle.type().parameterCount();
+    return handle.asType(MethodType.genericMethodType(arity)).asSpreader(Object[].class, arity);
+  }
+
+  // JNI ignores access control, reflection does not: a public method of a
+  // non-public class (ArrayList$Itr.hasNext) goes through the public type
+  // that declares it, and setAccessible is the last resort for the rest. It
+  // fails for classes of modules that are not open (Java 9+).
+  private static MethodHandle unreflect(Method method) throws IllegalAccessException {
+    try {
+      return MethodHandles.publicLookup().unreflect(method);
+    } catch (IllegalAccessException e) {
+      Method inherited = Modifier.isStatic(method.getModifiers()) ? null : publicDeclaration(method.getDeclaringClass(), method);
+      if (inherited != null) {
+        return MethodHandles.publicLookup().unreflect(inherited);
+      }
+      try {
+        method.setAccessible(true);
+      } catch (RuntimeException denied) {
+        e.addSuppressed(denied);
+        throw e;
+      }
+      return MethodHandles.lookup().unreflect(method);
+    }
+  }
+
+  private static Method publicDeclaration(Class<?> type, Method method) {
+    if (type == null) {
+      return null;
+    }
+    if (Modifier.isPublic(type.getModifiers()) && type != method.getDeclaringClass()) {
+      try {
+        Method declared = type.getMethod(method.getName(), method.getParameterTypes());
+        if (Modifier.isPublic(declared.getDeclaringClass().getModifiers())) {
+          return declared;
+        }
+      } catch (NoSuchMethodException e) {
+        // not declared by this type
+      }
+    }
+    for (Class<?> parent : type.getInterfaces()) {
+      Method declared = publicDeclaration(parent, method);
+      if (declared != null) {
+        return declared;
+      }
+    }
+    return publicDeclaration(type.getSuperclass(), method);
+  }
+
+  private static Object operand(ByteBuffer in, Object[] objects, Object[] values, int current) {
+    int tag = in.getInt();
+    switch (tag) {
+      case 'Z': return in.getInt() != 0;
+      case 'B': return (byte) in.getInt();
+      case 'C': return (char) in.getInt();
+      case 'S': return (short) in.getInt();
+      case 'I': return in.getInt();
+      case 'J': return in.getLong();
+      case 'F': return in.getFloat();
+      case 'D': return in.getDouble();
+      case 'T': {
+        byte[] bytes = new byte[in.getInt()];
+        in.get(bytes);
+        return new String(bytes, StandardCharsets.UTF_8);
+      }
+      case 'R': {
+        int index = in.getInt();
+        if (index < 0 || index >= current) {
+          throw new IllegalArgumentException("Command " + current + " depends on command " + index);
+        }
+        return values[index];
+      }
+      case 'L': return objects[in.getInt()];
+      case 'N': return null;
+      default: throw new IllegalArgumentException("Unknown operand tag " + tag);
+    }
+  }
+
+  private static void store(ByteBuffer out, int index, Class<?> type, Object value) {
+    int position = 16 * index;
+    long bits = 0;
+    int tag;
+    if (type == void.class) {
+      tag = 'V';
+    } else if (type == boolean.class) {
+      tag = 'Z';
+      bits = ((Boolean) value) ? 1 : 0;
+    } else if (type == char.class) {
+      tag = 'C';
+      bits = (Character) value;
+    } else if (type == float.class) {
+      tag = 'F';
+      bits = Float.floatToRawIntBits((Float) value);
+    } else if (type == double.class) {
+      tag = 'D';
+      bits = Double.doubleToRawLongBits((Double) value);
+    } else if (type == byte.class || type == short.class || type == int.class || type == long.class) {
+      tag = (type == byte.class) ? 'B' : (type == short.class) ? 'S' : (type == int.class) ? 'I' : 'J';
+      bits = ((Number) value).longValue();
+    } else {
+      tag = 'L';
+    }
+    out.putInt(position, tag).putInt(position + 4, 0).putLong(position + 8, bits);
+  }
+}
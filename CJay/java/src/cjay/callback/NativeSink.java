@@ -0,0 +1,197 @@
+/***************************************************************************
+ * Copyright 2014 Marcelo Sardelich <MSardelich@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************************/
+package cjay.callback;
+
+import java.nio.ByteBuffer;
+
+// Streams values produced in Java straight into C++ handlers (see VM::NativeSink).
+// Instances are created by CJay; the natives are registered through RegisterNatives.
+public class NativeSink implements AutoCloseable {
+  private volatile long handle;
+  
+  NativeSink(long handle) {
+    this.handle = handle;
+  }
+  
+  // Called by CJay when the C++ sink is destroyed
+  void detach() {
+    this.handle = 0;
+  }
+  
+  public void push(boolean x) {
+    pushBoolean(this.handle, x);
+  }
+  
+  public void push(byte x) {
+    pushByte(this.handle, x);
+  }
+  
+  public void push(char x) {
+    pushChar(this.handle, x);
+  }
+  
+  public void push(short x) {
+    pushShort(this.handle, x);
+  }
+  
+  public void push(int x) {
+    pushInt(this.handle, x);
+  }
+  
+  public void push(long x) {
+    pushLong(this.handle, x);
+  }
+  
+  public void push(float x) {
+    pushFloat(this.handle, x);
+  }
+  
+  public void push(double x) {
+    pushDouble(this.handle, x);
+  }
+  
+  public void push(boolean[] x) {
+    pushBooleanArray(this.handle, x, 0, x.length);
+  }
+  
+  public void push(boolean[] x, int offset, int length) {
+    if (offset < 0 || length < 0 || offset + length > x.length) {
+      throw new IndexOutOfBoundsException();
+    }
+    pushBooleanArray(this.handle, x, offset, length);
+  }
+  
+  public void push(byte[] x) {
+    pushByteArray(this.handle, x, 0, x.length);
+  }
+  
+  public void push(byte[] x, int offset, int length) {
+    if (offset < 0 || length < 0 || offset + length > x.length) {
+      throw new IndexOutOfBoundsException();
+    }
+    pushByteArray(this.handle, x, offset, length);
+  }
+  
+  public void push(char[] x) {
+    pushCharArray(this.handle, x, 0, x.length);
+  }
+  
+  public void push(char[] x, int offset, int length) {
+    if (offset < 0 || length < 0 || offset + length > x.length) {
+      throw new IndexOutOfBoundsException();
+    }
+    pushCharArray(this.handle, x, offset, length);
+  }
+  
+  public void push(short[] x) {
+    pushShortArray(this.handle, x, 0, x.length);
+  }
+  
+  public void push(short[] x, int offset, int length) {
+    if (offset < 0 || length < 0 || offset + length > x.length) {
+      throw new IndexOutOfBoundsException();
+    }
+    pushShortArray(this.handle, x, offset, length);
+  }
+  
+  public void push(int[] x) {
+    pushIntArray(this.handle, x, 0, x.length);
+  }
+  
+  public void push(int[] x, int offset, int length) {
+    if (offset < 0 || length < 0 || offset + length > x.length) {
+      throw new IndexOutOfBoundsException();
+    }
+    pushIntArray(this.handle, x, offset, length);
+  }
+  
+  public void push(long[] x) {
+    pushLongArray(this.handle, x, 0, x.length);
+  }
+  
+  public void push(long[] x, int offset, int length) {
+    if (offset < 0 || length < 0 || offset + length > x.length) {
+      throw new IndexOutOfBoundsException();
+    }
+    pushLongArray(this.handle, x, offset, length);
+  }
+  
+  public void push(float[] x) {
+    pushFloatArray(this.handle, x, 0, x.length);
+  }
+  
+  public void push(float[] x, int offset, int length) {
+    if (offset < 0 || length < 0 || offset + length > x.length) {
+      throw new IndexOutOfBoundsException();
+    }
+    pushFloatArray(this.handle, x, offset, length);
+  }
+  
+  public void push(double[] x) {
+    pushDoubleArray(this.handle, x, 0, x.length);
+  }
+  
+  public void push(double[] x, int offset, int length) {
+    if (offset < 0 || length < 0 || offset + length > x.length) {
+      throw new IndexOutOfBoundsException();
+    }
+    pushDoubleArray(this.handle, x, offset, length);
+  }
+  
+  public void push(String x) {
+    pushString(this.handle, x);
+  }
+  
+  // Pushes the remaining bytes of a direct buffer, without copying
+  public void push(ByteBuffer x) {
+    if (!x.isDirect()) {
+      throw new IllegalArgumentException("NativeSink accepts direct buffers only");
+    }
+    pushBuffer(this.handle, x, x.position(), x.remaining());
+  }
+  
+  public void pushObject(Object x) {
+    pushObject(this.handle, x);
+  }
+  
+  public void close() {
+    closeSink(this.handle);
+  }
+  
+  private static native void pushBoolean(long handle, boolean x);
+  private static native void pushByte(long handle, byte x);
+  private static native void pushChar(long handle, char x);
+  private static native void pushShort(long handle, short x);
+  private static native void pushInt(long handle, int x);
+  private static native void pushLong(long handle, long x);
+  private static native void pushFloat(long handle, float x);
+  private static native void pushDouble(long handle, double x);
+  private static native void pushBooleanArray(long handle, boolean[] x, int offset, int length);
+  private static native void pushByteArray(long handle, byte[] x, int offset, int length);
+  private static native void pushCharArray(long handle, char[] x, int offset, int length);
+  private static native void pushShortArray(long handle, short[] x, int offset, int length);
+  private static native void pushIntArray(long handle, int[] x, int offset, int length);
+  private static native void pushLongArray(long handle, long[] x, int offset, int length);
+  private static native void pushFloatArray(long handle, float[] x, int offset, int length);
+  private static native void pushDoubleArray(long handle, double[] x, int offset, int length);
+  private static native void pushString(long handle, String x);
+  private static native void pushBuffer(long handle, ByteBuffer x, int position, int remaining);
+  private static native void pushObject(long handle, Object x);
+  private static native void closeSink(long handle);
+  
+  public static void main(String[] args) { }
+}
@@ -0,0 +1,279 @@
+/***************************************************************************
+ * Copyright 2014 Marcelo Sardelich <MSardelich@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************************/
+package cjay.codegen;
+
+import java.io.*;
+import java.lang.reflect.*;
+import java.util.*;
+
+// Emits a typed C++ proxy (see VM::ProxyBase) for each given Java class:
+// one member function per public method, with the descriptor fixed at compile
+// time. The class and method IDs are kept in a VM::ProxyTable, which looks them
+// up again after addJar or addClass replaced the class.
+//
+//   java -cp java/bin:<classpath> cjay.codegen.ProxyGenerator <outdir> example.Example ...
+//
+// writes <outdir>/example/Example.hpp, with class cjay::example::Example.
+public class ProxyGenerator {
+  private static final Set<String> CPP_KEYWORDS = new HashSet<String>(Arrays.asList(
+      "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "catch", "char8_t",
+      "char16_t", "char32_t", "co_await", "co_return", "co_yield", "compl", "concept", "const_cast", "consteval",
+      "constexpr", "constinit", "decltype", "delete", "dynamic_cast", "explicit", "export", "extern", "friend",
+      "inline", "mutable", "namespace", "noexcept", "not", "not_eq", "nullptr", "operator", "or", "or_eq",
+      "register", "reinterpret_cast", "requires", "signed", "sizeof", "static_assert", "static_cast", "struct",
+      "template", "thread_local", "typedef", "typeid", "typename", "union", "unsigned", "using", "virtual",
+      "wchar_t", "xor", "xor_eq", "getObj", "javaClass", "obj", "table"));
+
+  @SuppressWarnings("rawtypes")
+  static String descriptor(Class c) {
+    if (c == boolean.class) return "Z";
+    if (c == byte.class) return "B";
+    if (c == char.class) return "C";
+    if (c == short.class) return "S";
+    if (c == int.class) return "I";
+    if (c == long.class) return "J";
+    if (c == float.class) return "F";
+    if (c == double.class) return "D";
+    if (c == void.class) return "V";
+    if (c.isArray()) return "[" + descriptor(c.getComponentType());
+    return "L" + c.getName().replace('.', '/') + ";";
+  }
+
+  @SuppressWarnings("rawtypes")
+  static String descriptor(Class[] params, Class rtn) {
+    StringBuilder sb = new StringBuilder("(");
+    for (Class p : params) sb.append(descriptor(p));
+    return sb.append(")").append(descriptor(rtn)).toString();
+  }
+
+  // C++ type of a JNI value (also the ProxyCall specialization)
+  @SuppressWarnings("rawtypes")
+  static String jniType(Class c) {
+    if (c == void.class) return "void";
+    if (c.isPrimitive()) return "j" + c.getName();
+    if (c == String.class) return "jstring";
+    if (c.isArray() && c.getComponentType().isPrimitive()) return "j" + c.getComponentType().getName() + "Array";
+    if (c.isArray()) return "jobjectArray";
+    return "jobject";
+  }
+
+  @SuppressWarnings("rawtypes")
+  static String paramType(Class c) {
+    return c == String.class ? "const std::string&" : jniType(c);
+  }
+
+  @SuppressWarnings("rawtypes")
+  static String returnType(Class c) {
+    return c == String.class ? "std::string" : jniType(c);
+  }
+
+  // JNI overload mangling: java/lang/String; -> java_lang_String_2, [ -> _3
+  static String mangle(String paramDescriptor) {
+    StringBuilder sb = new StringBuilder();
+    for (char ch : paramDescriptor.toCharArray()) {
+      if (ch == '/') sb.append('_');
+      else if (ch == ';') sb.append("_2");
+      else if (ch == '[') sb.append("_3");
+      else if (ch == '$') sb.append("_00024");
+      else sb.append(ch);
+    }
+    return sb.toString();
+  }
+
+  static String cppName(String name) {
+    return CPP_KEYWORDS.contains(name) ? name + "_" : name;
+  }
+
+  // Arguments of the call: strings go through a VM::ProxyString
+  @SuppressWarnings("rawtypes")
+  static void emitArguments(PrintWriter out, Class[] params, StringBuilder args) {
+    for (int i = 0; i < params.length; i++) {
+      if (params[i] == String.class) {
+        out.println("        VM::ProxyString s" + i + "(x" + i + ");");
+        args.append(", s").append(i).append(".get()");
+      } else {
+        args.append(", x").append(i);
+      }
+    }
+  }
+
+  @SuppressWarnings("rawtypes")
+  static String parameters(Class[] params) {
+    StringBuilder sb = new StringBuilder();
+    for (int i = 0; i < params.length; i++) {
+      if (i > 0) sb.append(", ");
+      sb.append(paramType(params[i])).append(" x").append(i);
+    }
+    return sb.toString();
+  }
+
+  @SuppressWarnings("rawtypes")
+  static String cppSignature(Class[] params) {
+    StringBuilder sb = new StringBuilder();
+    for (Class p : params) sb.append(paramType(p)).append(',');
+    return sb.toString();
+  }
+
+  @SuppressWarnings("rawtypes")
+  static void generate(Class clazz, File outDir) throws IOException {
+    String binaryName = clazz.getName().replace('.', '/');
+    String pkg = clazz.getPackage() == null ? "" : clazz.getPackage().getName();
+    String simpleName = clazz.getName().substring(pkg.isEmpty() ? 0 : pkg.length() + 1).replace('$', '_');
+    List<String> namespaces = new ArrayList<String>(Arrays.asList("cjay"));
+    if (!pkg.isEmpty()) namespaces.addAll(Arrays.asList(pkg.split("\\.")));
+    String guard = ("CJAY_PROXY_" + clazz.getName().replace('.', '_').replace('$', '_') + "_HPP_").toUpperCase();
+
+    File file = new File(outDir, (pkg.isEmpty() ? "" : pkg.replace('.', File.separatorChar) + File.separator) + simpleName + ".hpp");
+    file.getParentFile().mkdirs();
+    PrintWriter out = new PrintWriter(new FileWriter(file));
+
+    out.println("// Generated by cjay.codegen.ProxyGenerator from " + clazz.getName() + ". Do not edit.");
+    out.println("#ifndef " + guard);
+    out.println("#define " + guard);
+    out.println();
+    out.println("#include \"CJay.hpp\"");
+    out.println();
+    for (String ns : namespaces) out.println("namespace " + ns + " {");
+    out.println();
+    out.println("class " + simpleName + " : public VM::ProxyBase {");
+    out.println("public:");
+    out.println("    static jclass javaClass() {");
+    out.println("        return table().get().clazz;");
+    out.println("    }");
+    out.println();
+    out.println("    // Wraps an existing instance");
+    out.println("    explicit " + simpleName + "(jobject obj) : VM::ProxyBase(obj, false) { }");
+
+    // Constructors, in descriptor order
+    Constructor[] constructors = clazz.getDeclaredConstructors();
+    Arrays.sort(constructors, new Comparator<Constructor>() {
+      public int compare(Constructor a, Constructor b) {
+        return descriptor(a.getParameterTypes(), void.class).compareTo(descriptor(b.getParameterTypes(), void.class));
+      }
+    });
+    Set<String> seen = new HashSet<String>();
+    seen.add("jobject,"); // taken by the wrapping constructor
+    for (Constructor c : constructors) {
+      if (c.isSynthetic() || !Modifier.isPublic(c.getModifiers())) continue;
+      Class[] params = c.getParameterTypes();
+      String desc = descriptor(params, void.class);
+      out.println();
+      if (!seen.add(cppSignature(params))) {
+        out.println("    // " + desc + " skipped: same C++ parameters as another constructor");
+        continue;
+      }
+      out.println("    // " + c.toGenericString());
+      out.println("    " + (params.length == 1 ? "explicit " : "") + simpleName + "(" + parameters(params) + ") : VM::ProxyBase(construct" + mangle(desc.substring(1, desc.indexOf(')'))) + "(" + argumentNames(params) + "), true) { }");
+    }
+
+    // Methods, in name and descriptor order
+    Method[] methods = clazz.getDeclaredMethods();
+    Arrays.sort(methods, new Comparator<Method>() {
+      public int compare(Method a, Method b) {
+        int byName = a.getName().compareTo(b.getName());
+        return byName != 0 ? byName : descriptor(a.getParameterTypes(), a.getReturnType()).compareTo(descriptor(b.getParameterTypes(), b.getReturnType()));
+      }
+    });
+    Map<String, Set<String>> overloads = new HashMap<String, Set<String>>();
+    List<String> entries = new ArrayList<String>(); // ProxyTable methods, by index
+    for (Method m : methods) {
+      if (m.isSynthetic() || m.isBridge() || !Modifier.isPublic(m.getModifiers())) continue;
+      Class[] params = m.getParameterTypes();
+      Class rtn = m.getReturnType();
+      String desc = descriptor(params, rtn);
+      boolean isStatic = Modifier.isStatic(m.getModifiers());
+      String name = cppName(m.getName());
+      if (!overloads.containsKey(name)) overloads.put(name, new HashSet<String>());
+      if (!overloads.get(name).add(cppSignature(params))) {
+        name = name + "_" + mangle(desc.substring(1, desc.indexOf(')'))); // same C++ parameters: JNI-style suffix
+      }
+
+      out.println();
+      out.println("    // " + m.toGenericString());
+      out.println("    " + (isStatic ? "static " : "") + returnType(rtn) + " " + name + "(" + parameters(params) + ") {");
+      out.println("        const VM::ProxyTable::Entry& binding = table().get();");
+      StringBuilder args = new StringBuilder();
+      emitArguments(out, params, args);
+      String mid = "table().getMid(binding, " + entries.size() + ")";
+      entries.add("{ \"" + m.getName() + "\", \"" + desc + "\", " + isStatic + " }");
+      String call = "VM::ProxyCall<" + (rtn == String.class ? "jobject" : jniType(rtn)) + ">::"
+          + (isStatic ? "callStatic(binding.clazz" : "call(this->obj") + ", " + mid + args + ")";
+      if (rtn == void.class) out.println("        " + call + ";");
+      else if (rtn == String.class) out.println("        return VM::proxyString(" + call + ");");
+      else out.println("        return " + call + ";");
+      out.println("    }");
+    }
+
+    // Construction helpers, one per constructor
+    out.println("private:");
+    seen.clear();
+    seen.add("jobject,");
+    for (Constructor c : constructors) {
+      if (c.isSynthetic() || !Modifier.isPublic(c.getModifiers())) continue;
+      Class[] params = c.getParameterTypes();
+      if (!seen.add(cppSignature(params))) continue;
+      String desc = descriptor(params, void.class);
+      out.println("    static jobject construct" + mangle(desc.substring(1, desc.indexOf(')'))) + "(" + parameters(params) + ") {");
+      out.println("        const VM::ProxyTable::Entry& binding = table().get();");
+      StringBuilder args = new StringBuilder();
+      emitArguments(out, params, args);
+      out.println("        return VM::proxyNew(binding.clazz, table().getMid(binding, " + entries.size() + ")" + args + ");");
+      entries.add("{ \"<init>\", \"" + desc + "\", false }");
+      out.println("    }");
+      out.println();
+    }
+
+    // One table per proxy class: method indices as above
+    out.println("    static VM::ProxyTable& table() {");
+    out.println("        static VM::ProxyTable table(\"" + binaryName + "\", {");
+    for (int i = 0; i < entries.size(); i++) {
+      out.println("            " + entries.get(i) + (i + 1 < entries.size() ? "," : ""));
+    }
+    out.println("        });");
+    out.println("        return table;");
+    out.println("    }");
+
+    out.println("};");
+    out.println();
+    for (int i = namespaces.size() - 1; i >= 0; i--) out.println("} /* namespace " + namespaces.get(i) + " */");
+    out.println();
+    out.println("#endif /* " + guard + " */");
+    out.close();
+    System.out.println(file.getPath());
+  }
+
+  @SuppressWarnings("rawtypes")
+  static String argumentNames(Class[] params) {
+    StringBuilder sb = new StringBuilder();
+    for (int i = 0; i < params.length; i++) {
+      if (i > 0) sb.append(", ");
+      sb.append("x").append(i);
+    }
+    return sb.toString();
+  }
+
+  public static void main(String[] args) throws Exception {
+    if (args.length < 2) {
+      System.err.println("usage: ProxyGenerator <outdir> <class> [<class> ...]");
+      System.exit(1);
+    }
+    File outDir = new File(args[0]);
+    for (int i = 1; i < args.length; i++) {
+      generate(Class.forName(args[i]), outDir);
+    }
+  }
+}
@@ -0,0 +1,43 @@
+/***************************************************************************
+ * Copyright 2014 Marcelo Sardelich <MSardelich@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************************/
+package cjay.concurrent;
+
+import java.util.concurrent.CompletionStage;
+import java.util.function.BiConsumer;
+
+// Forwards the completion of a CompletionStage to native code.
+// The handle identifies the C++ continuation (see VM::JavaCompletion).
+public class NativeCompletion implements BiConsumer<Object, Throwable> {
+  private final long handle;
+  
+  NativeCompletion(long handle) {
+    this.handle = handle;
+  }
+  
+  public void accept(Object value, Throwable error) {
+    complete(this.handle, value, error);
+  }
+  
+  // Registered by CJay through RegisterNatives
+  private static native void complete(long handle, Object value, Throwable error);
+  
+  static void listen(CompletionStage<?> stage, long handle) {
+    stage.whenComplete(new NativeCompletion(handle));
+  }
+  
+  public static void main(String[] args) { }
+}
@@ -0,0 +1,149 @@
+/***************************************************************************
+ * Copyright 2014 Marcelo Sardelich <MSardelich@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************************/
+package cjay.converter;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
+import java.util.*;
+
+// Nested structure serialized into one byte[], decoded by VM::PackedReader
+// (native byte order). Every value starts with a one-byte tag:
+//
+//   N                  null
+//   Z B C S I J F D    boxed primitive, followed by its value
+//   T                  String: int32 length, UTF-8 bytes
+//   L                  Collection or Object[]: int32 count, elements
+//   M                  Map: int32 count, key and value of each entry
+//   [ and a code       primitive array: int32 count, values
+public class Packer {
+  static final int MAX_DEPTH = 256;
+
+  private byte[] bytes = new byte[256];
+  private ByteBuffer view = ByteBuffer.wrap(bytes).order(ByteOrder.nativeOrder());
+  private int size = 0;
+
+  public static byte[] pack(Object o) {
+    Packer packer = new Packer();
+    packer.write(o, 0);
+    return Arrays.copyOf(packer.bytes, packer.size);
+  }
+
+  private void ensure(int n) {
+    if (size + n > bytes.length) {
+      long capacity = Math.max(2L * bytes.length, (long) size + n);
+      if (capacity > Integer.MAX_VALUE - 8) {
+        throw new IllegalArgumentException("Packed structure larger than 2 GiB");
+      }
+      bytes = Arrays.copyOf(bytes, (int) capacity);
+      view = ByteBuffer.wrap(bytes).order(ByteOrder.nativeOrder());
+    }
+  }
+
+  private void tag(char tag, int n) {
+    ensure(1 + n);
+    bytes[size++] = (byte) tag;
+  }
+
+  private void count(int n) {
+    ensure(4);
+    view.putInt(size, n);
+    size += 4;
+  }
+
+  @SuppressWarnings("rawtypes")
+  private void write(Object o, int depth) {
+    if (depth > MAX_DEPTH) {
+      throw new IllegalArgumentException("Structure nested deeper than " + MAX_DEPTH + " levels");
+    }
+    if (o == null) {
+      tag('N', 0);
+    } else if (o instanceof String) {
+      byte[] utf8 = ((String) o).getBytes(StandardCharsets.UTF_8);
+      tag('T', 4 + utf8.length);
+      count(utf8.length);
+      System.arraycopy(utf8, 0, bytes, size, utf8.length);
+      size += utf8.length;
+    } else if (o instanceof Integer) {
+      tag('I', 4); view.putInt(size, (Integer) o); size += 4;
+    } else if (o instanceof Long) {
+      tag('J', 8); view.putLong(size, (Long) o); size += 8;
+    } else if (o instanceof Double) {
+      tag('D', 8); view.putDouble(size, (Double) o); size += 8;
+    } else if (o instanceof Float) {
+      tag('F', 4); view.putFloat(size, (Float) o); size += 4;
+    } else if (o instanceof Short) {
+      tag('S', 2); view.putShort(size, (Short) o); size += 2;
+    } else if (o instanceof Character) {
+      tag('C', 2); view.putChar(size, (Character) o); size += 2;
+    } else if (o instanceof Byte) {
+      tag('B', 1); bytes[size++] = (Byte) o;
+    } else if (o instanceof Boolean) {
+      tag('Z', 1); bytes[size++] = (byte) ((Boolean) o ? 1 : 0);
+    } else if (o instanceof Collection) {
+      Collection c = (Collection) o;
+      tag('L', 4);
+      count(c.size());
+      for (Object e : c) {
+        write(e, depth + 1);
+      }
+    } else if (o instanceof Object[]) {
+      Object[] a = (Object[]) o;
+      tag('L', 4);
+      count(a.length);
+      for (Object e : a) {
+        write(e, depth + 1);
+      }
+    } else if (o instanceof Map) {
+      Map m = (Map) o;
+      tag('M', 4);
+      count(m.size());
+      for (Object e : m.entrySet()) {
+        write(((Map.Entry) e).getKey(), depth + 1);
+        write(((Map.Entry) e).getValue(), depth + 1);
+      }
+    } else if (o.getClass().isArray()) {
+      writeArray(o);
+    } else {
+      throw new IllegalArgumentException("Cannot pack " + o.getClass().getName());
+    }
+  }
+
+  private void writeArray(Object o) {
+    char code = RecordBatch.typeOf(o);
+    int n = java.lang.reflect.Array.getLength(o);
+    long bytesOfValues = (long) RecordBatch.width(code) * n;
+    if (bytesOfValues > Integer.MAX_VALUE - 16) {
+      throw new IllegalArgumentException("Packed structure larger than 2 GiB");
+    }
+    tag('[', 1 + 4 + (int) bytesOfValues);
+    bytes[size++] = (byte) code;
+    count(n);
+    switch (code) {
+      case 'Z': { boolean[] a = (boolean[]) o; for (int i = 0; i < n; i++) bytes[size + i] = (byte) (a[i] ? 1 : 0); break; }
+      case 'B': System.arraycopy((byte[]) o, 0, bytes, size, n); break;
+      case 'C': { char[] a = (char[]) o; for (int i = 0; i < n; i++) view.putChar(size + 2 * i, a[i]); break; }
+      case 'S': { short[] a = (short[]) o; for (int i = 0; i < n; i++) view.putShort(size + 2 * i, a[i]); break; }
+      case 'I': { int[] a = (int[]) o; for (int i = 0; i < n; i++) view.putInt(size + 4 * i, a[i]); break; }
+      case 'J': { long[] a = (long[]) o; for (int i = 0; i < n; i++) view.putLong(size + 8 * i, a[i]); break; }
+      case 'F': { float[] a = (float[]) o; for (int i = 0; i < n; i++) view.putFloat(size + 4 * i, a[i]); break; }
+      case 'D': { double[] a = (double[]) o; for (int i = 0; i < n; i++) view.putDouble(size + 8 * i, a[i]); break; }
+      default: throw new IllegalArgumentException("Cannot pack " + o.getClass().getName());
+    }
+    size += (int) bytesOfValues;
+  }
+}
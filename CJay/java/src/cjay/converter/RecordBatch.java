@@ -0,0 +1,251 @@
+/***************************************************************************
+ * Copyright 2014 Marcelo Sardelich <MSardelich@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************************/
+package cjay.converter;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
+
+// Columnar table in one direct buffer, in the layout of VM::RecordBatch
+// (native byte order, every region 8-byte aligned):
+//
+//   header      int32 magic "CJRB", int32 version, int32 columns, int32 0, int64 rows, int64 bytes
+//   descriptor  per column: int32 type, int32 0, int64 null count, int64 offsets of the name,
+//               validity, data and text regions (0 if absent), int64 name length
+//   regions     name (UTF-8); validity bitmap, bit i set if row i is not null (only with nulls);
+//               values, or int32 offsets[rows + 1] into the UTF-8 text of a string column
+//
+// Types are the JNI codes Z B C S I J F D, and T for strings.
+public class RecordBatch {
+  public static final int MAGIC = 0x42524A43;
+  public static final int VERSION = 1;
+  static final int HEADER_BYTES = 32;
+  static final int DESCRIPTOR_BYTES = 56;
+
+  private final ByteBuffer buffer;
+  private final int columns;
+  private final int rows;
+
+  public RecordBatch(ByteBuffer buffer) {
+    this.buffer = buffer.duplicate().order(ByteOrder.nativeOrder());
+    if (this.buffer.getInt(0) != MAGIC || this.buffer.getInt(4) != VERSION) {
+      throw new IllegalArgumentException("Not a record batch (version " + VERSION + ")");
+    }
+    this.columns = this.buffer.getInt(8);
+    this.rows = (int) this.buffer.getLong(16);
+  }
+
+  public ByteBuffer buffer() {
+    return buffer;
+  }
+
+  public int rows() {
+    return rows;
+  }
+
+  public int columns() {
+    return columns;
+  }
+
+  private int descriptor(int column) {
+    if (column < 0 || column >= columns) {
+      throw new IndexOutOfBoundsException("column " + column);
+    }
+    return HEADER_BYTES + column * DESCRIPTOR_BYTES;
+  }
+
+  private int region(int column, int field) {
+    return (int) buffer.getLong(descriptor(column) + 16 + 8 * field);
+  }
+
+  public char type(int column) {
+    return (char) buffer.getInt(descriptor(column));
+  }
+
+  public long nullCount(int column) {
+    return buffer.getLong(descriptor(column) + 8);
+  }
+
+  public String name(int column) {
+    int length = (int) buffer.getLong(descriptor(column) + 48);
+    return utf8(region(column, 0), length);
+  }
+
+  // Index of the named column, or -1
+  public int column(String name) {
+    for (int c = 0; c < columns; c++) {
+      if (name(c).equals(name)) {
+        return c;
+      }
+    }
+    return -1;
+  }
+
+  public boolean isNull(int column, int row) {
+    int validity = region(column, 1);
+    return validity != 0 && ((buffer.get(validity + (row >> 3)) >> (row & 7)) & 1) == 0;
+  }
+
+  public boolean getBoolean(int column, int row) { return buffer.get(region(column, 2) + row) != 0; }
+  public byte getByte(int column, int row) { return buffer.get(region(column, 2) + row); }
+  public char getChar(int column, int row) { return buffer.getChar(region(column, 2) + 2 * row); }
+  public short getShort(int column, int row) { return buffer.getShort(region(column, 2) + 2 * row); }
+  public int getInt(int column, int row) { return buffer.getInt(region(column, 2) + 4 * row); }
+  public long getLong(int column, int row) { return buffer.getLong(region(column, 2) + 8 * row); }
+  public float getFloat(int column, int row) { return buffer.getFloat(region(column, 2) + 4 * row); }
+  public double getDouble(int column, int row) { return buffer.getDouble(region(column, 2) + 8 * row); }
+
+  // null for a null row
+  public String getString(int column, int row) {
+    if (isNull(column, row)) {
+      return null;
+    }
+    int offsets = region(column, 2);
+    int start = buffer.getInt(offsets + 4 * row);
+    int end = buffer.getInt(offsets + 4 * row + 4);
+    return utf8(region(column, 3) + start, end - start);
+  }
+
+  private String utf8(int position, int length) {
+    byte[] bytes = new byte[length];
+    ByteBuffer view = buffer.duplicate();
+    view.position(position);
+    view.get(bytes);
+    return new String(bytes, StandardCharsets.UTF_8);
+  }
+
+  static int align(long n) {
+    return (int) ((n + 7) & ~7L);
+  }
+
+  static int width(char type) {
+    switch (type) {
+      case 'Z': case 'B': return 1;
+      case 'C': case 'S': return 2;
+      case 'I': case 'F': case 'T': return 4;
+      case 'J': case 'D': return 8;
+      default: throw new IllegalArgumentException("Unknown column type " + type);
+    }
+  }
+
+  static char typeOf(Object column) {
+    if (column instanceof boolean[]) return 'Z';
+    if (column instanceof byte[]) return 'B';
+    if (column instanceof char[]) return 'C';
+    if (column instanceof short[]) return 'S';
+    if (column instanceof int[]) return 'I';
+    if (column instanceof long[]) return 'J';
+    if (column instanceof float[]) return 'F';
+    if (column instanceof double[]) return 'D';
+    if (column instanceof String[]) return 'T';
+    throw new IllegalArgumentException("Unsupported column " + column.getClass().getName());
+  }
+
+  // Batch in a new direct buffer. columns: primitive arrays or String[] (null
+  // elements are null rows), all of the same length. nulls[c], if any, marks
+  // the null rows of a primitive column.
+  public static RecordBatch build(String[] names, Object[] columns, boolean[][] nulls) {
+    int n = columns.length;
+    int rows = (n == 0) ? 0 : java.lang.reflect.Array.getLength(columns[0]);
+    byte[][] nameBytes = new byte[n][];
+    byte[][][] text = new byte[n][][];
+    long[] textBytes = new long[n];
+    long[] nullCounts = new long[n];
+    char[] types = new char[n];
+
+    long size = HEADER_BYTES + (long) n * DESCRIPTOR_BYTES;
+    for (int c = 0; c < n; c++) {
+      types[c] = typeOf(columns[c]);
+      if (java.lang.reflect.Array.getLength(columns[c]) != rows) {
+        throw new IllegalArgumentException("Column " + names[c] + " has a different number of rows");
+      }
+      nameBytes[c] = names[c].getBytes(StandardCharsets.UTF_8);
+      for (int r = 0; r < rows; r++) {
+        boolean isNull = (types[c] == 'T') ? ((String[]) columns[c])[r] == null : (nulls != null && nulls[c] != null && nulls[c][r]);
+        if (isNull) nullCounts[c]++;
+      }
+      if (types[c] == 'T') {
+        text[c] = new byte[rows][];
+        for (int r = 0; r < rows; r++) {
+          String s = ((String[]) columns[c])[r];
+          text[c][r] = (s == null) ? new byte[0] : s.getBytes(StandardCharsets.UTF_8);
+          textBytes[c] += text[c][r].length;
+        }
+      }
+      size += align(nameBytes[c].length);
+      if (nullCounts[c] > 0) size += align((rows + 7) / 8);
+      size += align((long) width(types[c]) * (types[c] == 'T' ? rows + 1 : rows));
+      size += align(textBytes[c]);
+    }
+    if (size > Integer.MAX_VALUE) {
+      throw new IllegalArgumentException("Record batch larger than 2 GiB");
+    }
+
+    ByteBuffer buffer = ByteBuffer.allocateDirect((int) size).order(ByteOrder.nativeOrder());
+    buffer.putInt(0, MAGIC).putInt(4, VERSION).putInt(8, n).putInt(12, 0).putLong(16, rows).putLong(24, size);
+    int position = HEADER_BYTES + n * DESCRIPTOR_BYTES;
+    for (int c = 0; c < n; c++) {
+      int d = HEADER_BYTES + c * DESCRIPTOR_BYTES;
+      buffer.putInt(d, types[c]).putInt(d + 4, 0).putLong(d + 8, nullCounts[c]).putLong(d + 48, nameBytes[c].length);
+
+      buffer.putLong(d + 16, position);
+      for (int i = 0; i < nameBytes[c].length; i++) buffer.put(position + i, nameBytes[c][i]);
+      position += align(nameBytes[c].length);
+
+      buffer.putLong(d + 24, nullCounts[c] > 0 ? position : 0);
+      if (nullCounts[c] > 0) {
+        for (int r = 0; r < rows; r++) {
+          boolean isNull = (types[c] == 'T') ? ((String[]) columns[c])[r] == null : nulls[c][r];
+          if (!isNull) buffer.put(position + (r >> 3), (byte) (buffer.get(position + (r >> 3)) | (1 << (r & 7))));
+        }
+        position += align((rows + 7) / 8);
+      }
+
+      buffer.putLong(d + 32, position);
+      Object values = columns[c];
+      for (int r = 0; r < rows; r++) {
+        switch (types[c]) {
+          case 'Z': buffer.put(position + r, (byte) (((boolean[]) values)[r] ? 1 : 0)); break;
+          case 'B': buffer.put(position + r, ((byte[]) values)[r]); break;
+          case 'C': buffer.putChar(position + 2 * r, ((char[]) values)[r]); break;
+          case 'S': buffer.putShort(position + 2 * r, ((short[]) values)[r]); break;
+          case 'I': buffer.putInt(position + 4 * r, ((int[]) values)[r]); break;
+          case 'J': buffer.putLong(position + 8 * r, ((long[]) values)[r]); break;
+          case 'F': buffer.putFloat(position + 4 * r, ((float[]) values)[r]); break;
+          case 'D': buffer.putDouble(position + 8 * r, ((double[]) values)[r]); break;
+          default: break;
+        }
+      }
+      if (types[c] == 'T') {
+        int textStart = position + align(4L * (rows + 1));
+        int offset = 0;
+        for (int r = 0; r < rows; r++) {
+          buffer.putInt(position + 4 * r, offset);
+          for (int i = 0; i < text[c][r].length; i++) buffer.put(textStart + offset + i, text[c][r][i]);
+          offset += text[c][r].length;
+        }
+        buffer.putInt(position + 4 * rows, offset);
+        buffer.putLong(d + 40, textStart);
+        position = textStart + align(textBytes[c]);
+      } else {
+        buffer.putLong(d + 40, 0);
+        position += align((long) width(types[c]) * rows);
+      }
+    }
+    return new RecordBatch(buffer);
+  }
+}
@@ -70,5 +70,177 @@ public class Util {
     return arrayList;
   }
   
+  // Iterator over an Iterable (List, Set, ...) or the Iterator itself
+  @SuppressWarnings("rawtypes")
+  static Iterator toIterator(Object o) {
+    if (o instanceof Iterator) {
+      return (Iterator) o;
+    }
+    return ((Iterable) o).iterator();
+  }
+  
+  // Fill buffer with the next elements of the iterator, unboxed.
+  // Return the number of elements written (less than buffer.length at the end).
+  @SuppressWarnings("rawtypes")
+  static int fillBooleans(Iterator it, boolean[] buffer) {
+    int n = 0;
+    while (n < buffer.length && it.hasNext()) {
+      buffer[n++] = ((Boolean) it.next()).booleanValue();
+    }
+    return n;
+  }
+  
+  @SuppressWarnings("rawtypes")
+  static int fillBytes(Iterator it, byte[] buffer) {
+    int n = 0;
+    while (n < buffer.length && it.hasNext()) {
+      buffer[n++] = ((Number) it.next()).byteValue();
+    }
+    return n;
+  }
+  
+  @SuppressWarnings("rawtypes")
+  static int fillChars(Iterator it, char[] buffer) {
+    int n = 0;
+    while (n < buffer.length && it.hasNext()) {
+      buffer[n++] = ((Character) it.next()).charValue();
+    }
+    return n;
+  }
+  
+  @SuppressWarnings("rawtypes")
+  static int fillShorts(Iterator it, short[] buffer) {
+    int n = 0;
+    while (n < buffer.length && it.hasNext()) {
+      buffer[n++] = ((Number) it.next()).shortValue();
+    }
+    return n;
+  }
+  
+  @SuppressWarnings("rawtypes")
+  static int fillInts(Iterator it, int[] buffer) {
+    int n = 0;
+    while (n < buffer.length && it.hasNext()) {
+      buffer[n++] = ((Number) it.next()).intValue();
+    }
+    return n;
+  }
+  
+  @SuppressWarnings("rawtypes")
+  static int fillLongs(Iterator it, long[] buffer) {
+    int n = 0;
+    while (n < buffer.length && it.hasNext()) {
+      buffer[n++] = ((Number) it.next()).longValue();
+    }
+    return n;
+  }
+  
+  @SuppressWarnings("rawtypes")
+  static int fillFloats(Iterator it, float[] buffer) {
+    int n = 0;
+    while (n < buffer.length && it.hasNext()) {
+      buffer[n++] = ((Number) it.next()).floatValue();
+    }
+    return n;
+  }
+  
+  @SuppressWarnings("rawtypes")
+  static int fillDoubles(Iterator it, double[] buffer) {
+    int n = 0;
+    while (n < buffer.length && it.hasNext()) {
+      buffer[n++] = ((Number) it.next()).doubleValue();
+    }
+    return n;
+  }
+  
+  @SuppressWarnings("rawtypes")
+  static int fillObjects(Iterator it, Object[] buffer) {
+    int n = 0;
+    while (n < buffer.length && it.hasNext()) {
+      buffer[n++] = it.next();
+    }
+    return n;
+  }
+  
+  // Shape of a rectangular N-dimensional primitive array.
+  // Return null if the array is jagged or has null rows.
+  static int[] shapeOf(Object array, int rank) {
+    int[] shape = new int[rank];
+    for (int d = 0; d < rank; d++) { shape[d] = -1; }
+    return hasShape(array, 0, shape) ? shape : null;
+  }
+  
+  private static boolean hasShape(Object array, int depth, int[] shape) {
+    if (array == null) { return false; }
+    int length = java.lang.reflect.Array.getLength(array);
+    if (shape[depth] == -1) { shape[depth] = length; }
+    if (shape[depth] != length) { return false; }
+    if (depth + 1 == shape.length) { return true; }
+    for (Object row : (Object[]) array) {
+      if (!hasShape(row, depth + 1, shape)) { return false; }
+    }
+    if (length == 0) { // nothing below: deeper extents are 0
+      for (int d = depth + 1; d < shape.length; d++) { if (shape[d] == -1) { shape[d] = 0; } }
+    }
+    return true;
+  }
+  
+  // Rectangular N-dimensional primitive array as a 1-D row-major array.
+  // Throws ArithmeticException if it holds more elements than an array can.
+  static Object flatten(Object array, int[] shape) {
+    int total = 1;
+    for (int n : shape) { total = Math.multiplyExact(total, n); }
+    Class<?> leaf = array.getClass();
+    while (leaf.isArray()) { leaf = leaf.getComponentType(); }
+    Object flat = java.lang.reflect.Array.newInstance(leaf, total);
+    copyRows(array, 0, shape, flat, 0);
+    return flat;
+  }
+  
+  private static int copyRows(Object array, int depth, int[] shape, Object flat, int offset) {
+    if (depth + 1 == shape.length) {
+      System.arraycopy(array, 0, flat, offset, shape[depth]);
+      return offset + shape[depth];
+    }
+    for (Object row : (Object[]) array) {
+      offset = copyRows(row, depth + 1, shape, flat, offset);
+    }
+    return offset;
+  }
+  
+  // Elements of a Collection, or the Object[] itself (jconvert)
+  @SuppressWarnings("rawtypes")
+  static Object[] toArray(Object o) {
+    if (o instanceof Object[]) {
+      return (Object[]) o;
+    }
+    return ((Collection) o).toArray();
+  }
+  
+  // Map as [key0, value0, key1, value1, ...]
+  @SuppressWarnings("rawtypes")
+  static Object[] entries(Map m) {
+    Object[] array = new Object[2 * m.size()];
+    int i = 0;
+    for (Object o : m.entrySet()) {
+      Map.Entry e = (Map.Entry) o;
+      array[i++] = e.getKey();
+      array[i++] = e.getValue();
+    }
+    return array;
+  }
+  
+  static ArrayList<Object> listOf(Object[] elements) {
+    return new ArrayList<Object>(Arrays.asList(elements));
+  }
+  
+  static HashMap<Object, Object> mapOf(Object[] keysAndValues) {
+    HashMap<Object, Object> map = new HashMap<Object, Object>(2 * keysAndValues.length / 3 + 1);
+    for (int i = 0; i + 1 < keysAndValues.length; i += 2) {
+      map.put(keysAndValues[i], keysAndValues[i + 1]);
+    }
+    return map;
+  }
+  
   public static void main(String[] args) { }  
 }
@@ -0,0 +1,96 @@
+/***************************************************************************
+ * Copyright 2014 Marcelo Sardelich <MSardelich@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ***************************************************************************/
+package cjay.loader;
+
+import java.io.*;
+import java.nio.ByteBuffer;
+import java.util.*;
+import java.util.jar.*;
+
+// Class loader over class files held in memory (jars or single classes),
+// handed over by VM::addJar and VM::addClass. No file is read.
+public class MemoryClassLoader extends ClassLoader {
+  private final Map<String, ByteBuffer> classes = new HashMap<String, ByteBuffer>(); // by binary name (a.b.C)
+
+  public MemoryClassLoader(ClassLoader parent) {
+    super(parent);
+  }
+
+  // Indexes the class files of a jar; returns their names (a/b/C)
+  public synchronized String[] addJar(ByteBuffer jar) throws IOException {
+    byte[] data = new byte[jar.remaining()];
+    jar.duplicate().get(data);
+    List<String> names = new ArrayList<String>();
+    JarInputStream in = new JarInputStream(new ByteArrayInputStream(data));
+    try {
+      byte[] chunk = new byte[8192];
+      for (JarEntry entry = in.getNextJarEntry(); entry != null; entry = in.getNextJarEntry()) {
+        String path = entry.getName();
+        if (entry.isDirectory() || !path.endsWith(".class") || path.endsWith("module-info.class")) {
+          continue;
+        }
+        ByteArrayOutputStream out = new ByteArrayOutputStream(entry.getSize() > 0 ? (int) entry.getSize() : chunk.length);
+        for (int n = in.read(chunk); n > 0; n = in.read(chunk)) {
+          out.write(chunk, 0, n);
+        }
+        String name = path.substring(0, path.length() - ".class".length());
+        classes.put(name.replace('/', '.'), ByteBuffer.wrap(out.toByteArray()));
+        names.add(name);
+      }
+    } finally {
+      in.close();
+    }
+    return names.toArray(new String[names.size()]);
+  }
+
+  public synchronized void addClass(String name, ByteBuffer bytes) {
+    ByteBuffer copy = ByteBuffer.allocate(bytes.remaining());
+    copy.put(bytes.duplicate()).flip();
+    classes.put(name.replace('/', '.'), copy);
+  }
+
+  // Class held in memory (name a/b/C), defined on first use; null if there is none
+  public synchronized Class<?> lookup(String name) throws ClassNotFoundException {
+    String binaryName = name.replace('/', '.');
+    return classes.containsKey(binaryName) ? loadClass(binaryName) : null;
+  }
+
+  // Classes held in memory come first, so that they also win over copies on the class path
+  @Override
+  protected synchronized Class<?> loadClass(String name, boolean resolve) throws ClassNotFoundException {
+    if (!classes.containsKey(name)) {
+      return super.loadClass(name, resolve);
+    }
+    Class<?> clazz = findLoadedClass(name);
+    if (clazz == null) {
+      clazz = findClass(name);
+    }
+    if (resolve) {
+      resolveClass(clazz);
+    }
+    return clazz;
+  }
+
+  @Override
+  protected synchronized Class<?> findClass(String name) throws ClassNotFoundException {
+    ByteBuffer bytes = classes.get(name);
+    if (bytes == null) {
+      throw new ClassNotFoundException(name);
+    }
+    return defineClass(name, bytes.duplicate(), null);
+  }
+}
@@ -17,6 +17,10 @@
 package example;
 
 import java.util.*;
+import java.util.concurrent.CompletableFuture;
+
+import cjay.callback.NativeSink;
+import cjay.converter.RecordBatch;
 
 public class Example {
   
@@ -62,9 +66,44 @@ public class Example {
     return x;
   }
   //Parse String
-  static String parseString(String x) {
+  public static String parseString(String x) {
+    return x;
+  }
+  //Parse double[][]
+  static double[][] parseMatrixDouble(double[][] x) {
     return x;
   }
+  //Sum of the first length elements (pooled array)
+  static long sumInts(int[] x, int length) {
+    long sum = 0;
+    for (int i = 0; i < length; i++) {
+      sum += x[i];
+    }
+    return sum;
+  }
+  //Parse RecordBatch (int, double and String columns), rebuilt on the Java side
+  static RecordBatch parseRecordBatch(RecordBatch x) {
+    String[] names = new String[x.columns()];
+    Object[] columns = new Object[x.columns()];
+    boolean[][] nulls = new boolean[x.columns()][x.rows()];
+    for (int c = 0; c < x.columns(); c++) {
+      names[c] = x.name(c);
+      int[] ints = new int[x.rows()];
+      double[] doubles = new double[x.rows()];
+      String[] strings = new String[x.rows()];
+      for (int r = 0; r < x.rows(); r++) {
+        nulls[c][r] = x.isNull(c, r);
+        switch (x.type(c)) {
+          case 'I': ints[r] = x.getInt(c, r); break;
+          case 'D': doubles[r] = x.getDouble(c, r); break;
+          case 'T': strings[r] = x.getString(c, r); break;
+          default: throw new IllegalArgumentException("Unsupported column " + x.name(c));
+        }
+      }
+      columns[c] = (x.type(c) == 'I') ? ints : (x.type(c) == 'D') ? doubles : strings;
+    }
+    return RecordBatch.build(names, columns, nulls);
+  }
   //Parse ArrayList<Byte>
   static ArrayList<Byte> parseArrayListByte(byte x, byte y) {
     ArrayList<Byte> result = new ArrayList<Byte>();
@@ -132,6 +171,27 @@ public class Example {
     return result;
   }
   
+  // Parse String asynchronously
+  static CompletableFuture<String> parseStringAsync(String x) {
+    return CompletableFuture.supplyAsync(() -> x);
+  }
+  
+  // Stream 0, 1, ..., n - 1 into a native sink, in chunks
+  static void exportInts(NativeSink sink, int n) {
+    int[] chunk = new int[1024];
+    int filled = 0;
+    for (int i = 0 ; i < n ; i++) {
+      chunk[filled++] = i;
+      if (filled == chunk.length) {
+        sink.push(chunk, 0, filled);
+        filled = 0;
+      }
+    }
+    sink.push(chunk, 0, filled);
+    sink.push("done");
+    sink.close();
+  }
+  
   public static void main(String[] args) { }
   
 }
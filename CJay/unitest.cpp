@@ -21,8 +21,14 @@
 #include <vector>
 #include <map>
 #include <cassert>
+#include <limits>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <cstdint>
 
 #include "CJay.hpp"
+#include "CJayPool.hpp"
 #include "example/Example.hpp"
 
 #define MAX_TOLERANCE 1.0e-4
@@ -31,7 +37,73 @@ jint VM::CJ::JNI_VERSION = DEFAULT_JNI_VERSION; // Depends on installed JDK!
 
 using namespace VM;
 
+#if defined(__cpp_impl_coroutine)
+// Minimal eager coroutine type to exercise JavaFuture
+struct AsyncTest {
+    struct promise_type {
+        AsyncTest get_return_object() { return AsyncTest(); }
+        std::suspend_never initial_suspend() { return std::suspend_never(); }
+        std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+        void return_void() { }
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+AsyncTest awaitString(jobject future, CallExecutor& executor, Converter& cnv, std::promise<std::string>& result) {
+    result.set_value(co_await JavaFuture<std::string>(future, &executor, &cnv));
+}
+#endif
+
+// User type converted with jconvert<>, to and from double[2]
+struct Point { double x, y; };
+
+namespace VM {
+template <> struct jconvert<Point> {
+    static Point from_java(Converter&, jobject obj) {
+        Point p;
+        env->GetDoubleArrayRegion((jdoubleArray) obj, 0, 1, &p.x);
+        env->GetDoubleArrayRegion((jdoubleArray) obj, 1, 1, &p.y);
+        return p;
+    }
+    static jobject to_java(Converter&, const Point& p) {
+        jdoubleArray arr = env->NewDoubleArray(2);
+        env->SetDoubleArrayRegion(arr, 0, 1, &p.x);
+        env->SetDoubleArrayRegion(arr, 1, 1, &p.y);
+        return arr;
+    }
+};
+}
+
+// Jar holding one uncompressed entry (zip local file header, no central directory)
+static std::string storedJar(const std::string& name, const std::string& data) {
+    std::uint32_t crc = 0xFFFFFFFF;
+    for (unsigned char c : data) {
+        crc ^= c;
+        for (int k = 0; k < 8; k++) { crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1))); }
+    }
+    crc = ~crc;
+    std::string jar;
+    auto put = [&jar](std::uint32_t x, int bytes) { for (int i = 0; i < bytes; i++) { jar += (char) ((x >> (8 * i)) & 0xFF); } };
+    put(0x04034b50, 4); put(10, 2); put(0, 2); put(0, 2); put(0, 2); put(0, 2); // signature, version, flags, stored, time, date
+    put(crc, 4); put((std::uint32_t) data.size(), 4); put((std::uint32_t) data.size(), 4);
+    put((std::uint32_t) name.size(), 2); put(0, 2);
+    return jar + name + data;
+}
+
 int main (int argc, char* argv[]) {
+    // Worker processes, each with its own JVM (forked before createVM)
+    {
+        VMConfig config;
+        WorkerPool pool(2, config);
+        assert ( pool.call<jint>("example/Example", "parseInt", (jint) 5) == 5 );
+        assert ( pool.call<std::string>("example/Example", "parseString", "foo") == "foo" );
+        std::vector<jboolean> zs{JNI_TRUE, JNI_FALSE};
+        assert ( pool.call<std::vector<jboolean> >("example/Example", "parseArrayBoolean", zs) == zs );
+        bool mismatched = false; // a long for an int parameter
+        try { pool.call<jint>("example/Example", "parseInt", (jlong) 5); } catch (HandlerExc&) { mismatched = true; }
+        assert ( mismatched );
+    }
+
     // Create JVM
     std::vector<std::string> paramVM{"-ea", "-Xdebug"};
     VM::createVM(paramVM);
@@ -63,18 +135,20 @@ int main (int argc, char* argv[]) {
     // Instantiate caster
     Converter cnv;
 
-    // test seamless integration
-    /*
+    // test seamless integration (generated proxy)
     try {
         cjay::example::Example example;
         jboolean test = example.parseBoolean((jboolean) false);
         assert (test == false);
+        assert (example.parseInt((jint) 41) == 41);
+        assert (cjay::example::Example::parseString("foo") == "foo");
+        cjay::example::Example copy(example);
+        assert (env->IsSameObject(copy.getObj(), example.getObj()));
     } catch(std::exception& e) {
         std::cout << e.what() << std::endl;
         VM::destroyVM();
         return EXIT_FAILURE;
     }
-    */
 
     // Assertions
     try {
@@ -112,6 +186,19 @@ int main (int argc, char* argv[]) {
         std::string str = cnv.c_cast<std::string>(L); // From java.lang.String To string
         assert ( str == std::string("foo") );
 
+        // Standard UTF-8 both ways: NUL and supplementary characters survive
+        std::string utf8("a\0\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80", 11);
+        L = CJ.call<jobject>( "parseString", cnv.j_cast<jstring>(utf8) );
+        assert ( cnv.c_cast<std::string>(L) == utf8 );
+        assert ( env->GetStringLength((jstring) L) == 6 ); // surrogate pair for U+1F600
+
+        // Interned strings: the same Java string for the same content
+        jstring key = internString("symbol");
+        assert ( env->IsSameObject(key, internString(std::string("symbol"))) );
+        assert ( env->IsSameObject(registerStaticString("metric"), internString("metric")) );
+        L = CJ.call<jobject>( "parseString", key );
+        assert ( cnv.c_cast<std::string>(L) == "symbol" );
+
         L = CJ.call<jobject>( "parseArrayListByte", (jbyte) 123, (jbyte) -123 );
         std::vector<jbyte> vb = cnv.c_cast_vector<jbyte>(L, 2); // From java.lang.ArrayList<byte> To vector<jbyte> (or vector<signed char>)
         assert ( (int) vb[0] == 123 ); assert( (int) vb[1] == -123 ); // convert signed char to int
@@ -145,6 +232,393 @@ int main (int argc, char* argv[]) {
         std::map<std::string, std::string> m_str_str = cnv.c_cast_map<std::string, std::string>(L); // From java.util.Map<String, String> To std::map<string, string>
         assert ( m_str_str["arg 1"] == "foo" ); assert ( m_str_str["arg 2"] == "bar" ); assert ( m_str_str["arg 3"] == "foo.bar" );
 
+        // Conversions into caller-owned memory
+        {
+            jboolean buf[2];
+            assert ( cnv.c_cast_array_into<jboolean>(Za, buf, 2) == 2 ); assert ( buf[0] == true ); assert ( buf[1] == false );
+            assert ( cnv.c_cast_array_into<jboolean>(Za, buf, 1) == 2 ); // truncated: full length reported
+
+            std::vector<std::string> strs;
+            L = CJ.call<jobject>( "parseArrayListString", cnv.j_cast<jstring>("foo") , cnv.j_cast<jstring>("bar"));
+            cnv.c_cast_vector_into<std::string>(L, std::back_inserter(strs));
+            assert ( strs.size() == 2 ); assert ( strs[0] == "foo" ); assert ( strs[1] == "bar" );
+
+            std::map<std::string, std::string> m;
+            L = CJ.call<jobject>( "parseSimpleMap", cnv.j_cast<jstring>("foo") , cnv.j_cast<jstring>("bar"), cnv.j_cast<jstring>("foo.bar"));
+            cnv.c_cast_map_into(L, m);
+            assert ( m["arg 3"] == "foo.bar" );
+#if defined(__cpp_lib_memory_resource)
+            char arena[4096];
+            std::pmr::monotonic_buffer_resource mr(arena, sizeof(arena));
+            L = CJ.call<jobject>( "parseArrayListInteger", (jint) 123, (jint) 456 );
+            std::pmr::vector<jint> pv = cnv.c_cast_vector<jint>(L, &mr);
+            assert ( pv.size() == 2 ); assert ( pv[1] == 456 );
+            std::pmr::vector<jboolean> pz = cnv.c_cast_array<jboolean>(Za, &mr);
+            assert ( pz[0] == true );
+#endif
+        }
+
+        // Widening, narrowing and bit-packed array conversions
+        {
+            std::vector<jlong> longs {1, -2, 3, (jlong) 1 << 40};
+            jintArray ints = cnv.j_cast<jintArray>(longs); // narrowing: static_cast per element
+            std::vector<jdouble> doubles = cnv.c_cast_array<jdouble>(ints);
+            assert ( doubles.size() == 4 ); assert ( doubles[1] == -2.0 ); assert ( doubles[3] == (jdouble) (jint) ((jlong) 1 << 40) );
+
+            // floating to integral as in Java: NaN is 0, out-of-range values saturate
+            const jdouble inf = std::numeric_limits<jdouble>::infinity();
+            std::vector<jdouble> special {std::numeric_limits<jdouble>::quiet_NaN(), inf, -inf, 1e10, -1e10, -2.9};
+            std::vector<jint> clamped = cnv.c_cast_array<jint>( cnv.j_cast<jdoubleArray>(special) );
+            assert ( clamped[0] == 0 ); assert ( clamped[1] == 2147483647 ); assert ( clamped[2] == -2147483647 - 1 );
+            assert ( clamped[3] == 2147483647 ); assert ( clamped[4] == -2147483647 - 1 ); assert ( clamped[5] == -2 );
+            std::vector<jlong> huge = cnv.c_cast_array<jlong>( cnv.j_cast<jfloatArray>(std::vector<jfloat>{1e30f, -1e30f}) );
+            assert ( huge[0] == std::numeric_limits<jlong>::max() ); assert ( huge[1] == std::numeric_limits<jlong>::min() );
+
+            std::vector<std::uint64_t> bits = cnv.c_cast_bits(Za);
+            assert ( bits.size() == 1 ); assert ( bits[0] == 1 ); // {true, false}
+            std::vector<jboolean> back = cnv.c_cast_array<jboolean>(cnv.j_cast_bits(bits, 2));
+            assert ( back[0] == true ); assert ( back[1] == false );
+        }
+
+        // N-dimensional arrays as row-major buffers
+        {
+            NDArray<jdouble> m;
+            m.reshape(std::vector<jsize>{2, 3});
+            for (std::size_t i = 0; i < m.data.size(); i++) { m.data[i] = (jdouble) i; }
+            jobjectArray jm = CJ.call<jobjectArray>( "parseMatrixDouble", cnv.j_cast_ndarray(m) );
+            NDArray<jdouble> back = cnv.c_cast_ndarray<jdouble>(jm);
+            assert ( !back.isJagged() ); assert ( back.shape[1] == 3 ); assert ( back.at(1, 2) == 5.0 );
+            NDArray<jdouble> flat = cnv.c_cast_ndarray<jdouble>(jm, true); // single Java-side copy
+            assert ( flat.data == m.data );
+
+            m.lengths = std::vector<std::vector<jsize> >{ {2}, {3, 1} }; // jagged: second row holds one element
+            back = cnv.c_cast_ndarray<jdouble>(cnv.j_cast_ndarray(m), true);
+            assert ( back.isJagged() ); assert ( back.at(1, 0) == 3.0 ); assert ( back.at(1, 1) == 0.0 );
+        }
+
+        // Command buffers: four calls in one transition
+        {
+            CommandBuffer batch;
+            CommandBuffer::Ref s = batch.add(CJ, "parseString", "foo");
+            CommandBuffer::Ref t = batch.add(CJ, "parseString", s); // result of the previous command
+            CommandBuffer::Ref i = batch.add(CJ, "parseInt", (jint) 41);
+            CommandBuffer::Ref d = batch.add(CJ, "parseDouble", (jdouble) 1.5);
+            batch.execute();
+            assert ( batch.getString(t) == "foo" ); assert ( batch.get<jint>(i) == 41 ); assert ( batch.get<jdouble>(d) == 1.5 );
+            batch.execute(); // again
+            assert ( batch.size() == 4 ); assert ( batch.get<jlong>(i) == 41 );
+
+            // A command that fails to record leaves no bytes behind
+            bool failed = false;
+            try { batch.add(CJ, "parseString", CommandBuffer::Ref(99)); } catch (HandlerExc&) { failed = true; }
+            assert ( failed ); assert ( batch.size() == 4 );
+            CommandBuffer::Ref j = batch.add(CJ, "parseInt", (jint) 42);
+            batch.execute();
+            assert ( batch.get<jint>(j) == 42 ); assert ( batch.getString(t) == "foo" );
+        }
+
+        // Pooled arrays: the second call reuses the array of the first
+        {
+            std::vector<jint> ints {1, 2, 3};
+            std::uint64_t hits = ArrayPool<jintArray>::instance().getHits();
+            for (int i = 0; i < 2; i++) {
+                PooledArray<jintArray> a = cnv.j_cast_pooled(ints);
+                assert ( a.size() == 3 ); assert ( a.capacity() == 16 );
+                assert ( CJ.call<jlong>( "sumInts", a.get(), a.size() ) == 6 );
+            }
+            assert ( ArrayPool<jintArray>::instance().getHits() == hits + 1 );
+        }
+
+        // Columnar batches over one shared direct buffer
+        {
+            RecordBatch batch = RecordBatchBuilder()
+                .add("id", std::vector<jint>{1, 2, 3})
+                .add("price", std::vector<jdouble>{1.5, 0.0, 3.5}, std::vector<bool>{true, false, true})
+                .add("symbol", std::vector<std::string>{"ABC", "", "\xc3\xa9t\xc3\xa9"}, std::vector<bool>{true, false, true})
+                .build();
+            RecordBatch back = cnv.c_cast_batch( CJ.call<jobject>( "parseRecordBatch", cnv.j_cast_batch(batch) ) ); // rebuilt in Java
+            assert ( back.numRows() == 3 ); assert ( back.numColumns() == 3 );
+            assert ( back.values<jint>(back.columnIndex("id"))[2] == 3 );
+            assert ( back.values<jdouble>(1)[2] == 3.5 ); assert ( back.column(1).isNull(1) ); assert ( back.column(1).nullCount == 1 );
+            assert ( back.getString(2, 2) == "\xc3\xa9t\xc3\xa9" ); assert ( back.column(2).isNull(1) );
+
+            // A header with a huge row count must not pass validation through an overflow
+            RecordBatch text = RecordBatchBuilder().add("s", std::vector<std::string>{"a", "b"}).build();
+            std::vector<char> bytes((const char*) text.data(), (const char*) text.data() + text.byteSize());
+            std::int64_t rows = (std::int64_t) 1 << 62; // (rows + 1) * 4 wraps around to 4
+            std::memcpy(&bytes[16], &rows, sizeof(rows));
+            bool rejected = false;
+            try { RecordBatch bad(bytes.data(), bytes.size()); } catch (HandlerExc&) { rejected = true; }
+            assert ( rejected );
+        }
+
+        // Nested types composed from jconvert<> traits
+        {
+            std::vector<Point> points = {{1.0, 2.0}, {3.0, 4.0}};
+            std::vector<Point> pointsBack = cnv.c_convert<std::vector<Point> >( cnv.j_convert(points) );
+            assert ( pointsBack.size() == 2 ); assert ( pointsBack[1].y == 4.0 );
+
+            std::map<std::string, std::vector<jint> > series = {{"a", {1, 2}}, {"b", {}}};
+            L = cnv.j_convert(series); // HashMap<String, ArrayList<Integer>>
+            std::map<std::string, std::vector<jint> > seriesBack = cnv.c_convert<std::map<std::string, std::vector<jint> > >(L);
+            assert ( seriesBack == series );
+
+            jintArray ints = env->NewIntArray(3); // int[] read with one region copy
+            assert ( cnv.c_convert<std::vector<jint> >(ints).size() == 3 );
+        }
+
+        // Nested structures decoded from one packed buffer
+        {
+            std::unordered_map<std::string, std::vector<jlong> > series = {{"a", {1, 2}}, {"b", {}}};
+            L = cnv.j_convert(series); // HashMap<String, ArrayList<Long>>
+            std::unordered_map<std::string, std::vector<jlong> > seriesBack = cnv.c_cast_nested<std::unordered_map<std::string, std::vector<jlong> > >(L);
+            assert ( seriesBack == series );
+
+            std::vector<std::vector<jint> > rows = {{1, 2, 3}, {4}};
+            std::vector<std::vector<jdouble> > asDoubles = cnv.c_cast_nested<std::vector<std::vector<jdouble> > >( cnv.j_convert(rows) );
+            assert ( asDoubles.size() == 2 ); assert ( asDoubles[0][2] == 3.0 ); assert ( asDoubles[1][0] == 4.0 );
+
+            // Point has a jconvert only: decoded through it
+            std::vector<Point> points = {{1.0, 2.0}, {3.0, 4.0}};
+            std::vector<Point> pointsBack = cnv.c_cast_nested<std::vector<Point> >( cnv.j_convert(points) );
+            assert ( pointsBack.size() == 2 ); assert ( pointsBack[1].x == 3.0 );
+
+            std::vector<jdouble> big = {1e10, -1e10};
+            std::vector<jint> saturated = cnv.c_cast_nested<std::vector<jint> >( cnv.j_convert(big) );
+            assert ( saturated[0] == std::numeric_limits<jint>::max() ); assert ( saturated[1] == std::numeric_limits<jint>::min() );
+        }
+
+        // Large arrays and lists converted in ranges on attached threads
+        {
+            CallExecutor executor(2);
+            L = CJ.call<jobject>( "parseArrayListString", cnv.j_cast<jstring>("foo") , cnv.j_cast<jstring>("bar"));
+            std::vector<std::string> strings = cnv.c_cast_parallel<std::string>(L, executor, 1); // one element per range
+            assert ( strings.size() == 2 ); assert ( strings[0] == "foo" ); assert ( strings[1] == "bar" );
+            std::vector<jint> ints(3, -1);
+            assert ( cnv.c_cast_parallel_into( cnv.j_convert(std::vector<jint>{7, 8, 9}), &ints[0], 2, executor, 1 ) == 3 );
+            assert ( ints[1] == 8 ); assert ( ints[2] == -1 ); // truncated
+        }
+
+        // Lazy, chunked iteration over java.util.List
+        {
+            L = CJ.call<jobject>( "parseArrayListInteger", (jint) 123, (jint) 456 );
+            std::vector<jint> seen;
+            for (jint x : cnv.c_range<jint>(L, 1)) { seen.push_back(x); } // one element per chunk
+            assert ( seen.size() == 2 ); assert ( seen[0] == 123 ); assert ( seen[1] == 456 );
+
+            L = CJ.call<jobject>( "parseArrayListString", cnv.j_cast<jstring>("foo") , cnv.j_cast<jstring>("bar"));
+            JavaRange<std::string> strings = cnv.c_range<std::string>(L);
+            JavaRange<std::string>::iterator it = strings.begin();
+            assert ( *it == "foo" ); ++it; assert ( *it == "bar" ); ++it; assert ( it == strings.end() );
+
+            bool failed = false; // ClassCastException in Util.fillInts
+            try { for (jint x : cnv.c_range<jint>(L)) { (void) x; } } catch (HandlerExc&) { failed = true; }
+            assert ( failed ); assert ( !env->ExceptionCheck() );
+        }
+
+        // Classes bound in this run (CDS class list)
+        std::vector<std::string> bound = VM::getBoundClasses();
+        assert ( std::find(bound.begin(), bound.end(), "example/Example") != bound.end() );
+        assert ( std::find(bound.begin(), bound.end(), "cjay/converter/Util") != bound.end() );
+
+        // Binding cache: a second binding of the same class reuses reflection and method IDs
+        {
+            assert ( VM::ownsVM() );
+            VM::CJ again;
+            again.setClass("example/Example");
+            again.Constructor( again.getUniqueKey("<init>", "()V") );
+            assert ( again.call<jint>( "parseInt", (jint) 7 ) == 7 );
+        }
+
+        // Warm-up before serving traffic
+        {
+            Warmup warmup;
+            warmup.add(CJ).add("parseInt", [&]() { CJ.call<jint>( "parseInt", (jint) 1 ); })
+                  .setRounds(2, 20).setCallsPerRound(100);
+            WarmupReport report = warmup.run();
+            assert ( report.rounds >= 2 && report.rounds <= 20 ); assert ( report.failed.empty() );
+
+            Warmup synthesized; // explicit keys only, checked up front
+            synthesized.addSynthesized(CJ, std::vector<std::string>{ "parseInt" }).setRounds(2, 2).setCallsPerRound(10);
+            assert ( synthesized.run().failed.empty() );
+            bool rejected = false;
+            try { Warmup().addSynthesized(CJ, std::vector<std::string>{ "noSuchMethod" }); } catch (HandlerExc&) { rejected = true; }
+            assert ( rejected );
+
+            VM::CJ unbound; // initializeClass throws on an executor thread
+            Warmup broken;
+            broken.add(unbound);
+            CallExecutor executor(1);
+            broken.start(executor);
+            assert ( broken.waitUntilFinished(std::chrono::milliseconds(5000)) );
+            assert ( !broken.getReport().error.empty() ); assert ( !broken.isConverged() );
+            assert ( warmup.isConverged() == report.converged );
+        }
+
+        // JNI call budgets
+        JNITrace::install();
+        {
+            JNITraceScope scope;
+            L = CJ.call<jobject>( "parseArrayListInteger", (jint) 123, (jint) 456 );
+            assert ( scope.delta().totalCalls() == 1 ); // a single CallObjectMethodV
+        }
+        {
+            JNITraceScope scope;
+            std::vector<jint> vBudget = cnv.c_cast_vector<jint>(L, 2);
+            JNICounters used = scope.delta();
+            assert ( used.totalCalls() <= 6 ); // get + intValue + DeleteLocalRef per element
+            assert ( used.callsTo("FindClass") == 0 );
+        }
+        {
+            JNITraceScope scope;
+            env->PushLocalFrame(4);
+            env->NewStringUTF("a"); env->NewStringUTF("b");
+            jobject kept = env->PopLocalFrame(env->NewStringUTF("c"));
+            assert ( scope.delta().localRefsLeaked() == 1 ); // only the one returned by PopLocalFrame
+            env->DeleteLocalRef(kept);
+            assert ( scope.delta().localRefsLeaked() == 0 );
+        }
+        JNITrace::uninstall();
+
+        // Asynchronous calls on JVM-attached worker threads
+        {
+            CallExecutor executor(2, 16);
+            jobject gFoo = env->NewGlobalRef(cnv.j_cast<jstring>("foo")); // arguments must be global refs
+            std::future<jint> fI = executor.call<jint>( CJ, "parseInt", (jint) 321 );
+            std::future<jobject> fL = executor.call<jobject>( CJ, "parseString", gFoo );
+            assert ( fI.get() == 321 );
+            jobject gResult = fL.get(); // results are global refs
+            assert ( cnv.c_cast<std::string>(gResult) == "foo" );
+            env->DeleteGlobalRef(gResult);
+            env->DeleteGlobalRef(gFoo);
+
+            // A throwing callback is reported and leaves the workers running
+            std::promise<jint> delivered;
+            executor.submitCallback([&]() { return CJ.call<jint>( "parseInt", (jint) 7 ); },
+                                    [](std::future<jint> r) { r.get(); throw std::runtime_error("callback"); });
+            executor.submitCallback([&]() { return CJ.call<jint>( "parseInt", (jint) 8 ); },
+                                    [&](std::future<jint> r) { delivered.set_value(r.get()); });
+            assert ( delivered.get_future().get() == 8 );
+            assert ( executor.call<jint>( CJ, "parseInt", (jint) 9 ).get() == 9 );
+        }
+
+#if defined(__cpp_impl_coroutine)
+        // co_await a java.util.concurrent.CompletableFuture
+        {
+            CallExecutor executor(1);
+            std::promise<std::string> result;
+            awaitString(CJ.call<jobject>( "parseStringAsync", cnv.j_cast<jstring>("async") ), executor, cnv, result);
+            assert ( result.get_future().get() == "async" );
+        }
+#endif
+
+        // Stream results from Java into a native sink
+        {
+            jlong sum = 0; jsize count = 0; std::string last; bool closed = false;
+            NativeSink sink;
+            sink.onArray<jint>([&](const jint* x, jsize n) { for (jsize i = 0; i < n; i++) { sum += x[i]; } count += n; })
+                .onString([&](std::string x) { last = x; })
+                .onClose([&]() { closed = true; });
+            CJ.call<void>( "exportInts", sink.getObj(), (jint) 5000 );
+            assert ( count == 5000 ); assert ( sum == (jlong) 5000 * 4999 / 2 );
+            assert ( last == "done" ); assert ( closed );
+
+            // Array handlers may call JNI; any C++ exception reaches Java
+            NativeSink throwing;
+            throwing.onArray<jint>([&](const jint*, jsize n) { env->DeleteLocalRef(env->NewIntArray(n)); })
+                .onString([](std::string) { throw 42; });
+            CJ.call<void>( "exportInts", throwing.getObj(), (jint) 10 );
+            bool rethrown = false;
+            try { checkJavaException(); } catch (HandlerExc&) { rethrown = true; }
+            assert ( rethrown );
+        }
+
+        // Rebind while other threads call through the same CJ
+        {
+            CallExecutor executor(2, 64);
+            std::vector<std::future<jint> > results;
+            for (jint i = 0; i < 200; i++) {
+                results.push_back(executor.call<jint>( CJ, "parseInt", i ));
+                if (i % 20 == 0) { CJ.setClass("example/Example"); }
+            }
+            for (jint i = 0; i < 200; i++) { assert ( results[i].get() == i ); }
+            { VM::CJ::Snapshot snap(CJ); assert ( snap->className == "example/Example" ); }
+            assert ( CJ.getRetiredCount() == 0 ); // no call in flight
+
+            // A snapshot keeps only its own binding alive
+            {
+                VM::CJ::Snapshot pinned(CJ);
+                CJ.setClass("example/Example");
+                CJ.setClass("example/Example");
+                assert ( CJ.getRetiredCount() == 1 );
+                assert ( pinned->className == "example/Example" );
+            }
+            assert ( CJ.getRetiredCount() == 0 );
+        }
+
+#ifdef CJAY_METHOD_STATS
+        // Per-method call statistics
+        CJ.resetStats();
+        CJ.call<jint>( "parseInt", (jint) 1 );
+        CJ.call<jint>( "parseInt", (jint) 2 );
+        MethodStatsSnapshot snap = methodStatsOf(*CJ.getSignatureObj("parseInt")).snapshot();
+        assert ( snap.count == 2 ); assert ( snap.maxNanos >= snap.percentile(50.0) );
+        assert ( CJ.getStatsJSON().find("\"key\":\"parseInt\",") != std::string::npos );
+#endif
+
+#ifdef CJAY_TRACING
+        // Spans as Chrome trace JSON
+        Tracer::traceCalls(true);
+        CJ.call<jint>( "parseInt", (jint) 1 );
+        Tracer::traceCalls(false);
+        std::string trace = Tracer::getChromeTrace();
+        assert ( trace.find("\"name\":\"GetMethodID\"") != std::string::npos );
+        assert ( trace.find("\"detail\":\"parseInt\"") != std::string::npos );
+
+        // A full buffer drops spans until clear() rewinds it
+        for (std::size_t i = 0; i <= Tracer::CHUNK_EVENTS * Tracer::MAX_CHUNKS; i++) {
+            Tracer::record("fill", "test", NULL, 0, 0, 1);
+        }
+        assert ( Tracer::getDropped() >= 1 );
+        Tracer::clear();
+        assert ( Tracer::getChromeTrace().find("\"name\":\"fill\"") == std::string::npos );
+        Tracer::record("afterClear", "test", NULL, 0, 0, 1);
+        assert ( Tracer::getDropped() == 0 );
+        assert ( Tracer::getChromeTrace().find("\"name\":\"afterClear\"") != std::string::npos );
+#endif
+
+        // Classes served from memory win over the class path (keep last: rebinds example/Example)
+        {
+            std::ifstream in("java/bin/example/Example.class", std::ios::binary);
+            assert ( in ); // run from the CJay folder
+            std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            addClass("example/Example", bytes.data(), bytes.size());
+            jclass fromMemory = findClass("example/Example");
+            assert ( !env->IsSameObject(fromMemory, CJ.getClass()) ); // other class loader
+            VM::CJ inMemory;
+            inMemory.setClass("example/Example");
+            assert ( env->IsSameObject(inMemory.getClass(), fromMemory) );
+            L = inMemory.call<jobject>( "parseString", cnv.j_cast<jstring>("mem") );
+            assert ( cnv.c_cast<std::string>(L) == "mem" );
+
+            // Jars are indexed in memory; classes are defined on first use
+            std::ifstream utilIn("java/bin/cjay/converter/Util.class", std::ios::binary);
+            assert ( utilIn );
+            std::string util((std::istreambuf_iterator<char>(utilIn)), std::istreambuf_iterator<char>());
+            std::string jar = storedJar("cjay/converter/Util.class", util);
+            std::vector<std::string> names = addJar(jar.data(), jar.size());
+            assert ( names.size() == 1 ); assert ( names[0] == "cjay/converter/Util" );
+            jclass utilFromJar = findClass("cjay/converter/Util");
+            jclass utilFromPath = env->FindClass("cjay/converter/Util");
+            assert ( !env->IsSameObject(utilFromJar, utilFromPath) );
+
+            // A malformed class fails when it is defined, without a pending exception
+            addClass("example/Broken", "not a class", 11);
+            bool rejected = false;
+            try { findClass("example/Broken"); } catch (HandlerExc&) { rejected = true; }
+            assert ( rejected ); assert ( !env->ExceptionCheck() );
+        }
+
     } catch(std::exception& e) {
         std::cout << e.what() << std::endl;
         VM::destroyVM();